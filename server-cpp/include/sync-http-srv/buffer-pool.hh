@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace sync_http_srv {
+namespace util {
+
+/**\brief Pool of equally-sized memory blocks
+ *
+ * Blocks released to the pool are kept for reuse, up to the high-water
+ * mark of idle blocks; blocks released beyond it are freed, so footprint of
+ * the pool follows the peak of simultaneously used blocks but never exceeds
+ * it by more than high-water mark. Blocks are not cleared on reuse.
+ *
+ * Acquisition and release are thread-safe. Counters are updated with no
+ * lock and are approximate while pool is in use.
+ * */
+class BufferPool {
+private:
+    const size_t _blockSize;
+    /// Max number of idle blocks kept
+    size_t _highWater;
+    /// Idle blocks
+    std::vector<char *> _idle;
+    mutable std::mutex _mtx;
+    /// Number of blocks taken from and not found in the pool
+    std::atomic<size_t> _nHits
+                      , _nMisses
+                      ;
+    /// Number of blocks in use and its maximum
+    std::atomic<size_t> _nInUse
+                      , _peakInUse
+                      ;
+public:
+    BufferPool(size_t blockSize, size_t highWater);
+    /// Frees idle blocks; all blocks must be released by this time
+    ~BufferPool();
+
+    BufferPool(const BufferPool &) = delete;
+    BufferPool & operator=(const BufferPool &) = delete;
+
+    /// Returns idle block or allocates new one
+    char * acquire();
+    /// Returns block to the pool, frees it if high-water mark is reached
+    void release(char *);
+
+    size_t block_size() const { return _blockSize; }
+    /// Returns max number of idle blocks kept
+    size_t high_water() const;
+    /// Sets max number of idle blocks kept, frees the ones beyond it
+    void high_water(size_t);
+    /// Returns number of idle blocks
+    size_t n_idle() const;
+    /// Returns number of acquisitions served by idle block
+    size_t n_hits() const { return _nHits; }
+    /// Returns number of acquisitions that allocated new block
+    size_t n_misses() const { return _nMisses; }
+    /// Returns number of blocks currently in use
+    size_t n_in_use() const { return _nInUse; }
+    /// Returns max number of blocks used at once
+    size_t peak_in_use() const { return _peakInUse; }
+};
+
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "sync-http-srv/server.hh"
+
+#if defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+#   include <zlib.h>
+#endif
+
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/// Content codings server may apply to response payload
+enum class ContentCoding {
+    kIdentity,
+    kGzip,
+    kDeflate,
+};
+
+/// Returns name of the content coding used in `Content-Encoding` header
+const char * to_str(ContentCoding);
+
+///\brief Chooses content coding acceptable for client
+///
+/// Considers `Accept-Encoding` header value with respect to quality values
+/// (including `*` and `q=0` exclusions); gzip is preferred over deflate on
+/// equal quality. Returns `kIdentity` if neither is acceptable or if header
+/// is empty.
+ContentCoding negotiate_coding(std::string_view acceptEncoding);
+
+///\brief Returns whether payload of given media type is worth compressing
+///
+/// Textual types (`text/*`, JSON, XML, YAML, JavaScript, SVG) are. Types
+/// which are compressed by their nature (images, archives, media) are not.
+bool compressible_type(std::string_view contentType);
+
+///\brief Returns entity tag of coded representation
+///
+/// Distinct representations must bear distinct strong entity tags, so
+/// coding name is appended to the opaque tag (`"v1"` becomes `"v1-gzip"`).
+/// Identity coding and malformed tags are returned as is.
+std::string coded_etag(std::string_view etag, ContentCoding);
+
+///\brief Returns whether `If-None-Match` header value matches entity tag
+///
+/// Applies weak comparison (RFC 9110, 13.1.2) to each listed tag, `*`
+/// matches any tag. Coding suffix appended by `coded_etag()` is ignored, so
+/// client's tag matches if the state of representation it has is current.
+bool etag_matches(std::string_view ifNoneMatch, std::string_view etag);
+
+#if defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+///\brief Compresses data at once with given coding
+///
+/// Meant for payloads compressed once and sent many times, hence the
+/// maximum compression level by default. Throws `GenericRuntimeError` on
+/// zlib failure.
+std::string compress(std::string_view data, ContentCoding, int level=9);
+
+/**\brief Content compressed while being sent
+ *
+ * Wraps another content and deflates it with zlib by portions, as data are
+ * pulled for dispatch, so compressed payload is never kept entirely.
+ * Source content is read through its in-memory segments when available,
+ * otherwise copied or pulled (if streamed) into input buffer. Compressed
+ * length is not known in advance, so content is streamed.
+ *
+ * zlib state and input buffer are allocated in given memory resource.
+ * */
+class DeflateContent : public Msg::iContent {
+public:
+    /// Size of input buffer used for sources lacking in-memory segments
+    static constexpr size_t kInputBufferSize = 16*1024;
+protected:
+    std::shared_ptr<Msg::iContent> _src;
+    std::pmr::memory_resource * _mr;
+    z_stream _zs;
+    /// Input buffer (allocated on demand)
+    char * _in;
+    /// Number of source bytes read so far
+    size_t _srcRead;
+    /// Number of compressed bytes produced so far
+    size_t _size;
+    /// Set once source is exhausted and once compressed stream is ended
+    bool _srcExhausted
+       , _finished
+       ;
+
+    /// Provides next portion of source data to deflate
+    void _feed();
+
+    static void * _zalloc(void * mr, unsigned int nItems, unsigned int size);
+    static void _zfree(void * mr, void * ptr);
+public:
+    ///\brief Wraps source content
+    ///
+    /// `level` is zlib compression level, -1 for default. Throws
+    /// `GenericRuntimeError` if zlib can not be initialized.
+    DeflateContent( std::shared_ptr<Msg::iContent> src
+                  , ContentCoding coding
+                  , int level=-1
+                  , std::pmr::memory_resource * mr=std::pmr::get_default_resource() );
+    ~DeflateContent();
+
+    DeflateContent(const DeflateContent &) = delete;
+    DeflateContent & operator=(const DeflateContent &) = delete;
+
+    /// Returns number of compressed bytes produced so far
+    virtual size_t size() const override { return _size; }
+    /// Throws `GenericRuntimeError`, content is read-only
+    virtual void append(const char *, size_t) override;
+    /// Throws `GenericRuntimeError`, compressed data are not retained
+    virtual size_t copy_to(char *, size_t, size_t from=0) const override;
+    virtual bool streamed() const override { return true; }
+    virtual size_t pull(char * dest, size_t maxLen) override;
+};
+#endif  // defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
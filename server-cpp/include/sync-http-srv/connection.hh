@@ -0,0 +1,254 @@
+#pragma once
+
+#include "sync-http-srv/server.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/**\brief State of the client connection being served
+ *
+ * Keeps incremental parsing and dispatch state of the request/response pair
+ * currently handled over the client socket. Operations (`receive()`,
+ * `send()`) never block on non-blocking socket, so event-driven server modes
+ * may interleave many connections. On blocking socket they return once
+ * request is received or response is sent entirely.
+ *
+ * Connection does not close the socket; buffers are either provided by
+ * caller, taken from the pool (and returned on destruction) or allocated
+ * (and owned) by connection instance. Connections created with `create()`
+ * are placed in the pooled block along with their buffers, so accepting
+ * connection takes single block from the pool and allocates nothing.
+ *
+ * Request, its headers and dispatch state are allocated in request-scoped
+ * arena released at once by `reset()`. Arena starts with a buffer kept by
+ * connection, so requests fitting it cause no heap allocations; handlers
+ * may put response objects there as well (see `RequestMsg::response()`).
+ * */
+class Connection {
+public:
+    /// Size of the arena buffer kept by connection
+    static constexpr size_t kArenaBufferSize = 8*1024;
+    /// Room for connection object (and pool reference) ahead of buffers in
+    /// pooled block
+    static constexpr size_t kPooledObjectSize = 1024;
+    /// Size of pooled block keeping connection object, IO buffers and arena
+    /// buffer
+    static constexpr size_t pooled_block_size(size_t ioBufSize)
+        { return kPooledObjectSize + 2*ioBufSize + kArenaBufferSize; }
+
+    enum State {
+        kReceiving,  ///< request is being received
+        kHandling,  ///< request received, response is not yet set
+        kSending,  ///< response is being sent
+        kDone,  ///< response sent
+    };
+protected:
+    /// Client socket descriptor
+    const int _fd;
+    /// Client IP address string
+    char _ipStr[INET_ADDRSTRLEN];
+    /// Logging category in use
+    iJournal & _L;
+    /// IO buffers for data receiving and dispatch
+    char * _recvBuffer
+       , * _respBuffer;
+    const size_t _ioBufSize;
+    /// Buffers allocated by connection (if any)
+    std::unique_ptr<char[]> _ownBlock;
+    /// Pool buffers were taken from by constructor (if any)
+    util::BufferPool * const _pool;
+    const size_t _maxInMemContentLen;
+    /// Number of received bytes kept in receive buffer
+    size_t _nInRecvBuf;
+    /// Number of bytes received by connection for current request
+    size_t _nBytesReceived;
+    /// Descriptor of data handed over along with connection, read before
+    /// the socket ones (-1 if none)
+    int _handedFD;
+
+    State _state;
+    /// Execution flags returned by route handling
+    uint16_t _execFlags;
+    /// Whether connection persists after current response
+    bool _keepAlive;
+    /// Number of requests served by this connection
+    size_t _nServed;
+    /// Time connection became idle (awaiting for a request)
+    std::chrono::steady_clock::time_point _idleSince;
+    /// Time first data of current request were received
+    std::chrono::steady_clock::time_point _requestSince;
+    /// Time response was set or its data were last accepted by socket
+    std::chrono::steady_clock::time_point _lastSent;
+    /// In-flight counter of the route handling current request (if limited)
+    std::atomic<size_t> * _inFlight;
+    /// Request-scoped arena, must outlive objects allocated in it
+    std::pmr::monotonic_buffer_resource _arena;
+    std::shared_ptr<RequestMsg> _rq;
+    std::optional<MsgParser> _parser;
+    std::shared_ptr<ResponseMsg> _rp;
+    std::optional<MsgSender> _sender;
+
+    ///\brief Reads data from the socket
+    ///
+    /// Follows `recv(2)` semantics. Subclasses may override it to supply data
+    /// read by other means (e.g. by asynchronous IO engine) directly into
+    /// `recv_window()`.
+    virtual ssize_t _recv(char * dest, size_t n);
+    /// Offset of connection object in block of `create()`, ahead of it the
+    /// pool reference is kept
+    static constexpr size_t kBlockHeaderSize = alignof(std::max_align_t);
+public:
+    ///\brief Creates connection using given buffers
+    ///
+    /// Arena buffer must be of `kArenaBufferSize` bytes.
+    Connection( int fd
+              , const sockaddr_in & clientAddr
+              , iJournal & L
+              , char * recvBuffer
+              , char * respBuffer
+              , char * arenaBuffer
+              , size_t ioBufSize
+              , size_t maxInMemContentLen
+              );
+    ///\brief Creates connection using buffers block taken from the pool
+    ///
+    /// Pool blocks must be of `pooled_block_size(ioBufSize)` bytes. Meant
+    /// for connection object of automatic storage, heap one is rather
+    /// created with `create()`.
+    Connection( int fd
+              , const sockaddr_in & clientAddr
+              , iJournal & L
+              , util::BufferPool & pool
+              , size_t ioBufSize
+              , size_t maxInMemContentLen
+              );
+    /// Creates connection with own buffers
+    Connection( int fd
+              , const sockaddr_in & clientAddr
+              , iJournal & L
+              , size_t ioBufSize
+              , size_t maxInMemContentLen
+              );
+    ///\brief Frees own or returns pooled buffers, does not close the socket
+    ///
+    /// Descriptor of handed over data (see `prefill(int)`) is closed.
+    virtual ~Connection();
+
+    Connection(const Connection &) = delete;
+    Connection & operator=(const Connection &) = delete;
+
+    ///\brief Creates connection in the block taken from the pool
+    ///
+    /// Connection object is placed at the beginning of the block, its
+    /// buffers follow. Block is returned to the pool once connection is
+    /// deleted. Pool blocks must be of `pooled_block_size(ioBufSize)` bytes.
+    static Connection * create( int fd
+                              , const sockaddr_in & clientAddr
+                              , iJournal & L
+                              , util::BufferPool & pool
+                              , size_t ioBufSize
+                              , size_t maxInMemContentLen
+                              );
+    /// Allocates connection object on heap
+    static void * operator new(size_t);
+    ///\brief Frees connection object
+    ///
+    /// Object created by `create()` returns its block to the pool.
+    static void operator delete(void *);
+
+    int fd() const { return _fd; }
+    const char * ip_str() const { return _ipStr; }
+    /// Returns logging category associated with connection
+    iJournal & journal() const { return _L; }
+    State state() const { return _state; }
+    /// Returns execution flags set by route handling (see `Server::k*`)
+    uint16_t exec_flags() const { return _execFlags; }
+    /// Sets execution flags
+    void exec_flags(uint16_t flags) { _execFlags = flags; }
+    /// Returns whether connection persists after current response
+    bool keep_alive() const { return _keepAlive; }
+    /// Sets whether connection persists after current response
+    void keep_alive(bool v) { _keepAlive = v; }
+    /// Returns number of requests served by connection
+    size_t n_served() const { return _nServed; }
+    /// Returns whether no data of the next request has been received yet
+    bool idle() const { return kReceiving == _state && !_nBytesReceived; }
+    /// Returns time connection became idle
+    std::chrono::steady_clock::time_point idle_since() const { return _idleSince; }
+    /// Returns time first data of current request were received
+    std::chrono::steady_clock::time_point request_since() const { return _requestSince; }
+    /// Returns time response data were last accepted by socket
+    std::chrono::steady_clock::time_point last_sent() const { return _lastSent; }
+    /// Returns whether receive buffer keeps unparsed (pipelined) data
+    bool has_buffered_data() const { return _nInRecvBuf || _handedFD >= 0; }
+    /// Sets pointer to unparsed data in receive buffer, returns its length
+    size_t buffered_data(const char *& ptr) const
+        { ptr = _recvBuffer; return _nInRecvBuf; }
+    ///\brief Puts data to receive buffer as if they were received
+    ///
+    /// Used for connections handed over from other process along with
+    /// data already read from socket. Throws `RequestHeaderIsTooLong` if data
+    /// do not fit the buffer.
+    void prefill(const char * data, size_t n);
+    ///\brief Makes data of given descriptor to be received first
+    ///
+    /// Used for connections handed over along with data that do not fit
+    /// receive buffer: descriptor (e.g. memory file) is read till EOF before
+    /// the socket, so request of any size can be parsed as usual. Connection
+    /// takes ownership over the descriptor.
+    void prefill(int fd);
+    ///\brief Prepares connection for the next request
+    ///
+    /// Retains unparsed data of pipelined request(s) in receive buffer.
+    /// Releases in-flight counter held for current request and the
+    /// request-scoped arena.
+    void reset();
+    ///\brief Keeps in-flight counter of the route till request is served
+    ///
+    /// Counter must be already incremented by caller; connection decrements
+    /// it on `reset()` or destruction.
+    void hold(std::atomic<size_t> & inFlight);
+
+    ///\brief Receives and parses available data
+    ///
+    /// Returns `true` once request is complete. Request content is limited
+    /// by `maxContentLen` (see `MsgParser`). Throws
+    /// `ClientClosedConnection`, `ClientSocketError` or `RequestError`
+    /// subclasses on failures.
+    bool receive(size_t maxContentLen=SIZE_MAX);
+    /// Returns request being handled (can be null before `receive()`)
+    std::shared_ptr<RequestMsg> request() const { return _rq; }
+    /// Sets response to be sent
+    void respond(std::shared_ptr<ResponseMsg>);
+    /// Returns response being sent (can be null)
+    std::shared_ptr<ResponseMsg> response() const { return _rp; }
+    ///\brief Sends response data
+    ///
+    /// Returns `true` once response is sent entirely. Throws
+    /// `ClientSocketError` on failure.
+    bool send();
+
+    /// Returns free part of receive buffer where next data has to be read
+    std::pair<char *, size_t> recv_window() const
+        { return {_recvBuffer + _nInRecvBuf, _ioBufSize - _nInRecvBuf}; }
+    ///\brief Returns next portion of response data to be sent
+    ///
+    /// For IO performed externally. Data are provided as IO vector of at
+    /// most `maxSegments` entries, number of entries set is returned.
+    size_t outgoing(iovec * iov, size_t maxSegments)
+        { return _sender->next_segments(iov, maxSegments, _respBuffer, _ioBufSize); }
+    /// Accounts response data sent externally
+    void sent(size_t n);
+};
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "sync-http-srv/session-endpoint.hh"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/**\brief Server-Sent Events endpoint (`text/event-stream`)
+ *
+ * Pushes events to subscribed clients as soon as they are published, so
+ * viewers of forward-iterable collection get each new item (or its delta)
+ * with no polling:
+ *
+ *      EventStream events(log);
+ *      routes.push_back({&eventsRoute, &events});
+ *      ...
+ *      events.publish(itemJSON, "item", std::to_string(nItem));
+ *
+ * GET request makes connection a subscriber: endpoint writes response head
+ * itself and takes ownership over client socket (returns
+ * `kKeepClientConnection | kNoDispatchResponse`), so server drops the
+ * connection from its serving loop. Subscribers beyond `maxSubscribers`
+ * are answered by `503 Service Unavailable`.
+ *
+ * Sockets of subscribers are served by the endpoint's thread (see
+ * `SessionEndpoint`). It writes queued events without blocking, sends
+ * heartbeat comment when stream stays silent for `heartbeat` interval (so
+ * proxies and client notice dead connections) and closes connections of
+ * disconnected clients, as well as of the ones lagging more than
+ * `maxBacklog` bytes behind.
+ *
+ * In prefork mode subscriptions are handed over to the leader shard (see
+ * `steering()`), where state advancing requests are served as well.
+ * */
+class EventStream : public SessionEndpoint {
+protected:
+    /// Subscribed connection
+    struct Subscriber {
+        int fd;
+        /// Data queued for dispatch and number of bytes of it sent already
+        std::string pending;
+        size_t nSent;
+        /// Time of the last write, to schedule heartbeat
+        Clock::time_point lastSent;
+        /// Set if subscriber has to be dropped by the thread
+        const char * dropReason;
+        /// Remote address, for logging
+        std::string ipStr;
+    };
+
+    const size_t _maxSubscribers
+               , _maxBacklog
+               ;
+    const std::chrono::milliseconds _heartbeat;
+    /// Header lines written to new subscribers after server's common ones
+    std::string _head;
+
+    /// Subscribers, guarded by `_mtx` along with counters
+    std::vector<Subscriber> _subscribers;
+    /// Number of events published and subscribers dropped for lagging
+    size_t _nPublished
+         , _nLagging
+         ;
+
+    /// Flushes pending data, sends heartbeats and drops subscribers
+    Clock::time_point _visit(std::unique_lock<std::mutex> &, Clock::time_point) override;
+    /// Polls subscribers for disconnection and for writing pending data
+    void _poll_set(std::vector<pollfd> &) const override;
+    /// Drops subscribers which closed connection
+    void _on_ready(const pollfd *, size_t) override;
+    ///\brief Writes pending data of subscriber without blocking
+    ///
+    /// Returns `false` if connection is broken (`errno` is set). Lock must
+    /// be held.
+    bool _flush(Subscriber &);
+    /// Closes connection and removes subscriber, lock must be held
+    void _drop(size_t nSubscriber, const char * reason);
+public:
+    ///\brief Creates endpoint
+    ///
+    /// Throws `GenericRuntimeError` if wake-up descriptor can not be created.
+    EventStream( iJournal &
+               , size_t maxSubscribers=64
+               , std::chrono::milliseconds heartbeat=std::chrono::seconds(15)
+               , size_t maxBacklog=4*1024*1024 );
+    /// Stops the thread and closes subscribers' connections
+    ~EventStream();
+
+    ///\brief Adds header to response head of the stream
+    ///
+    /// Sent along with server's common headers (see
+    /// `Server::common_header()`). Must not be called while server runs.
+    void header(std::string_view name, std::string_view value);
+
+    ///\brief Subscribes GET request's connection to events
+    ///
+    /// Other methods are answered by `405 Method Not Allowed`.
+    Server::HandleResult handle( const RequestMsg &, int clientFD
+                               , const Server::iRoute::URLParameters & ) override;
+    /// Subscriptions are guarded by lock of its own
+    ThreadSafety thread_safety() const override { return kConcurrent; }
+    /// Subscribers are served by the leader shard, events are published there
+    bool steering(const RequestMsg &) const override { return true; }
+
+    ///\brief Formats event in `text/event-stream` format
+    ///
+    /// Multi-line data are sent as several `data` fields. Empty `event` and
+    /// `id` fields are omitted.
+    static std::string format( std::string_view data
+                             , std::string_view event=""
+                             , std::string_view id="" );
+    ///\brief Sends event to all the subscribers
+    ///
+    /// Event is formatted once and queued for dispatch, so call does not
+    /// block on slow clients. Thread-safe.
+    void publish( std::string_view data
+                , std::string_view event=""
+                , std::string_view id="" );
+    /// Closes connections of all the subscribers
+    void close_all();
+
+    /// Returns number of subscribed connections
+    size_t n_subscribers() const;
+    /// Returns number of events published
+    size_t n_published() const;
+    /// Returns number of subscribers dropped for lagging behind
+    size_t n_lagging() const;
+};
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <mutex>
+#include <string>
+
 namespace sync_http_srv {
 
 class iJournal {
@@ -24,5 +27,26 @@ public:
     void error(const char *) override;
 };
 
+/// Logging context of a thread
+///
+/// Prepends messages with given prefix and serializes access to the
+/// destination journal, so concurrent workers may share one sink.
+class PrefixedJournal : public iJournal {
+private:
+    iJournal & _dest;
+    std::mutex & _mtx;
+    const std::string _prefix;
+public:
+    PrefixedJournal( iJournal & dest
+                   , std::mutex & mtx
+                   , const std::string & prefix
+                   ) : _dest(dest), _mtx(mtx), _prefix(prefix) {}
+    bool debug_enabled() const override;
+    void debug(const char *) override;
+    void info(const char *) override;
+    void warn(const char *) override;
+    void error(const char *) override;
+};
+
 };
 
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "sync-http-srv/server.hh"
+
+#include <memory>
+#include <memory_resource>
+#include <string_view>
+#include <vector>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/// Byte range of content, `[first, last]` inclusive as in `Range` header
+struct ByteRange {
+    size_t first, last;
+    size_t length() const { return last - first + 1; }
+};
+
+/// Result of `Range` header parsing
+enum class RangesParse {
+    kIgnored,  ///< malformed header, unknown unit or too many ranges
+    kSatisfiable,  ///< at least one range overlaps the content
+    kUnsatisfiable,  ///< none of the ranges overlaps the content
+};
+
+///\brief Parses `Range` header value against content of given size
+///
+/// Sets `ranges` to satisfiable ranges clipped to content size, sorted and
+/// coalesced if they overlap or adjoin (RFC 9110, 14.2). More than
+/// `maxRanges` range specifications make header to be ignored, `ranges`
+/// are left empty then. Ranges are kept in vector's memory resource, which
+/// is request-scoped arena when called by server.
+RangesParse parse_ranges( std::string_view value, size_t contentSize
+                        , std::pmr::vector<ByteRange> & ranges
+                        , size_t maxRanges=16 );
+
+/**\brief Content made of slices of other contents and in-memory fragments
+ *
+ * Used for partial responses: slices refer to source content with no copy,
+ * keeping its in-memory segments and file regions, so data are still
+ * gathered into `sendmsg()` or sent with `sendfile()`. Fragments (e.g.
+ * multipart framing) are kept by content itself. Source contents must not
+ * be streamed.
+ * */
+class CompositeContent : public Msg::iContent {
+protected:
+    struct Piece {
+        /// Source content, null for fragment kept in `_text`
+        std::shared_ptr<Msg::iContent> src;
+        /// Offset of piece data in source (or in `_text`)
+        size_t srcOffset;
+        /// Offset of piece in composite content and its length
+        size_t offset, length;
+    };
+    std::pmr::vector<Piece> _pieces;
+    /// Fragments data
+    std::pmr::string _text;
+    size_t _size;
+
+    /// Returns piece keeping `from`-th byte
+    const Piece & _piece(size_t from) const;
+public:
+    /// Pieces table and fragments are kept in given memory resource
+    CompositeContent(std::pmr::memory_resource * mr=std::pmr::get_default_resource());
+
+    /// Appends `length` bytes of source content starting from `from`
+    void add_slice(std::shared_ptr<Msg::iContent> src, size_t from, size_t length);
+    /// Appends fragment
+    void add_text(std::string_view);
+
+    virtual size_t size() const override { return _size; }
+    /// Throws `GenericRuntimeError`, use `add_text()` instead
+    virtual void append(const char *, size_t) override;
+    virtual size_t copy_to(char * dest, size_t maxLen, size_t from=0) const override;
+    virtual size_t segment(size_t from, const char *& ptr) const override;
+    virtual size_t file_region(size_t from, int & fd, off_t & offset) const override;
+};
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
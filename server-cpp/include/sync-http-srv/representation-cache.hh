@@ -0,0 +1,104 @@
+#pragma once
+
+#include "sync-http-srv/server.hh"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/**\brief Cache of immutable response representations
+ *
+ * Keeps complete responses of routes which output does not change while
+ * server runs (geometry descriptions, static assets, etc), keyed by route,
+ * URL parameters and query string. Each entry is built once -- put
+ * explicitly at startup or made of the first response of the route (see
+ * `Server::immutable()`) -- and holds identity payload along with gzip-coded
+ * one, if the latter is smaller. Payloads are shared by responses with no
+ * copy, so serving an entry costs neither serialization nor compression.
+ *
+ * Thread-safe. Entries stay till invalidated explicitly.
+ * */
+class RepresentationCache {
+public:
+    /// Pre-built response of the route
+    struct Representation {
+        /// Headers of the response, except framing and connection ones
+        std::vector<std::pair<std::string, std::string>> headers;
+        /// Identity and gzip-coded payloads, the latter is null if not built
+        std::shared_ptr<StringContent> identity
+                                     , gzip
+                                     ;
+        /// Returns number of payload bytes kept
+        size_t n_bytes() const;
+    };
+    typedef std::shared_ptr<const Representation> RepresentationPtr;
+protected:
+    typedef std::pair<const Server::iRoute *, std::string> Key;
+    mutable std::shared_mutex _mtx;
+    std::map<Key, RepresentationPtr> _entries;
+    /// Number of payload bytes kept by entries
+    size_t _nBytes;
+    /// Number of lookups which found (or not found) an entry
+    mutable std::atomic<size_t> _nHits
+                              , _nMisses
+                              ;
+public:
+    RepresentationCache();
+
+    /// Returns key of the representation within route
+    static std::string key( const Server::iRoute::URLParameters &
+                          , std::string_view queryString );
+    /// Returns query string of request target (empty if there is none)
+    static std::string_view query_string(const RequestMsg &);
+
+    ///\brief Builds representation of the response
+    ///
+    /// Content of response is read entirely (streamed content is pulled).
+    /// Gzip-coded payload is built for compressible content if it turns out
+    /// to be smaller than identity one.
+    static RepresentationPtr represent(const ResponseMsg &);
+
+    /// Returns cached representation, null if there is none
+    RepresentationPtr find(const Server::iRoute &, const std::string & key) const;
+    ///\brief Builds representation of the response and caches it
+    ///
+    /// Content of response is read entirely (see `represent()`), so
+    /// response must not be sent afterwards -- send the one made by
+    /// `respond()` instead. Representation larger than `maxSize` bytes is
+    /// returned, but not cached. If representation is already cached,
+    /// cached one is returned.
+    RepresentationPtr put( const Server::iRoute &, const std::string & key
+                         , const ResponseMsg &, size_t maxSize=SIZE_MAX );
+    ///\brief Creates response of the representation
+    ///
+    /// Gzip-coded payload is chosen if request's `Accept-Encoding` admits
+    /// it. Response is allocated in memory resource of the request.
+    static std::shared_ptr<ResponseMsg> respond(const Representation &, const RequestMsg &);
+
+    /// Drops representations of the route
+    void invalidate(const Server::iRoute &);
+    /// Drops all the representations
+    void invalidate();
+
+    /// Returns number of representations cached
+    size_t size() const;
+    /// Returns number of payload bytes kept
+    size_t n_bytes() const;
+    /// Returns number of lookups served from cache
+    size_t n_hits() const { return _nHits; }
+    /// Returns number of lookups not found in cache
+    size_t n_misses() const { return _nMisses; }
+};
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -15,6 +15,11 @@ struct RESTTraits<JSON> {
     static constexpr auto contentTypeStr = "application/json";
     static JSON parse_request_body(const Msg::iContent &);
     static void set_content(ResponseMsg &, const JSON &);
+    ///\brief Sets content serialized on demand while being sent
+    ///
+    /// Document is kept by content; top-level array or object is serialized
+    /// member by member, so no full copy of serialized payload exists.
+    static void set_content(ResponseMsg &, JSON &&);
 };
 
 }  // namespace ::sync_http_srv::util::http
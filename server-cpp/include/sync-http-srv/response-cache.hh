@@ -0,0 +1,110 @@
+#pragma once
+
+#include "sync-http-srv/representation-cache.hh"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/**\brief LRU cache of responses depending on versioned state
+ *
+ * Keeps representations of GET responses (see
+ * `RepresentationCache::Representation`) of the routes which output changes
+ * only along with some state (current event, algorithm iteration, etc).
+ * Entry is keyed by route, URL parameters and query string, and is valid for
+ * certain state version only: lookup with other version misses and drops
+ * the stale entry, so viewers of the same state share single serialization
+ * of it (see `Server::cache()`).
+ *
+ * Number of entries and number of payload bytes are limited, least recently
+ * used entries are evicted to fit the limits. Thread-safe.
+ * */
+class ResponseCache {
+public:
+    typedef RepresentationCache::Representation Representation;
+    typedef RepresentationCache::RepresentationPtr RepresentationPtr;
+protected:
+    typedef std::pair<const Server::iRoute *, std::string> Key;
+    struct Entry;
+    /// Entries ordered by recent use, most recent first
+    typedef std::list<Entry> Entries;
+    struct Entry {
+        /// Iterator of the index item, for removal on eviction
+        std::map<Key, Entries::iterator>::iterator indexIt;
+        /// State version representation corresponds to
+        uint64_t version;
+        RepresentationPtr repr;
+    };
+    mutable std::mutex _mtx;
+    Entries _entries;
+    std::map<Key, Entries::iterator> _index;
+    /// Limits of payload bytes and entries number
+    size_t _maxBytes
+         , _maxEntries
+         ;
+    /// Number of payload bytes kept by entries
+    size_t _nBytes;
+    /// Counters of lookups served from cache, lookups not found (or found
+    /// stale) and entries evicted to fit limits
+    size_t _nHits
+         , _nMisses
+         , _nEvictions
+         ;
+
+    /// Drops the entry, lock must be held
+    void _erase(Entries::iterator);
+    /// Evicts least recently used entries to fit the limits, lock must be held
+    void _evict();
+public:
+    ResponseCache(size_t maxBytes=64*1024*1024, size_t maxEntries=1024);
+
+    ///\brief Sets cache limits
+    ///
+    /// Entries exceeding new limits are evicted immediately. Zero
+    /// `maxEntries` disables caching.
+    void limits(size_t maxBytes, size_t maxEntries);
+    /// Returns max number of payload bytes kept
+    size_t max_bytes() const;
+    /// Returns max number of entries kept
+    size_t max_entries() const;
+
+    ///\brief Returns cached representation of given state version
+    ///
+    /// Returns null if there is no entry for the key or if entry is of other
+    /// version (it is dropped then). Found entry becomes most recently used.
+    RepresentationPtr find( const Server::iRoute &, const std::string & key
+                          , uint64_t version );
+    ///\brief Builds representation of the response and caches it
+    ///
+    /// Content of response is read entirely, so response must not be sent
+    /// afterwards -- send the one made by `RepresentationCache::respond()`
+    /// instead. Replaces entry of the key, if any. Representation exceeding
+    /// bytes limit is returned, but not cached.
+    RepresentationPtr put( const Server::iRoute &, const std::string & key
+                         , uint64_t version, const ResponseMsg & );
+
+    /// Drops entries of the route
+    void invalidate(const Server::iRoute &);
+    /// Drops all the entries
+    void invalidate();
+
+    /// Returns number of entries cached
+    size_t size() const;
+    /// Returns number of payload bytes kept
+    size_t n_bytes() const;
+    /// Returns number of lookups served from cache
+    size_t n_hits() const;
+    /// Returns number of lookups not found in cache or found stale
+    size_t n_misses() const;
+    /// Returns number of entries evicted to fit the limits
+    size_t n_evictions() const;
+};
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -19,6 +19,8 @@ public:
                                , int clientFD
                                , const Server::iRoute::URLParameters &
                                ) override;
+    /// Routes list is not modified while serving, so view is reentrant
+    ThreadSafety thread_safety() const override { return kConcurrent; }
 };
 
 }  // namespace ::sync_http_srv::util::http
@@ -1,16 +1,24 @@
 #pragma once
 
 /**\file
- * \brief Extremely simple implementation of single-threaded HTTP server
+ * \brief Simple HTTP server with blocking and event-driven run modes
  *
  * Purpose of this server implementation is to facilitate REST-like API for
  * computational applications and serve static files for single-page
- * applications. It works in synchroneous mode, so request/response cycle can
- * take significant amount of time.
+ * applications. Request handlers are synchroneous, so request/response cycle
+ * can take significant amount of time.
  *
- * This rudimentary server implementation operates in blocking mode (so no
- * parallel executors, event polling, queues, etc) typically found for
- * full-fledged servers designed to handle multiple connections.
+ * Server runs in one of the following modes:
+ *  - blocking (`Server::run()`, default) serves one connection at a time;
+ *  - event-driven (`run_epoll()`) multiplexes client connections with
+ *    `epoll(7)`, yet requests are still handled one by one;
+ *  - multi-threaded (`run_threaded()`) hands connections to a pool of
+ *    worker threads, subject to thread-safety level of endpoints;
+ *  - io_uring (`run_io_uring()`, optional at build time) submits socket IO
+ *    to `io_uring(7)` in batches, handling requests as event-driven mode;
+ *  - prefork (`run_prefork()`) runs event-driven loop in several processes
+ *    sharing the port with `SO_REUSEPORT`, steering requests of shared
+ *    state to the leader process.
  *
  * The document provides some constrains for HTTP protocol and simplistic
  * server implementation as well.
@@ -21,12 +29,25 @@
 //#include "na64util/uri.hh"
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
 #include <list>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <regex>
+#include <sstream>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 
+#include "sync-http-srv/buffer-pool.hh"
 #include "sync-http-srv/error.hh"
 #include "sync-http-srv/logging.hh"
 #include "sync-http-srv/uri.hh"
@@ -80,6 +101,15 @@ public:
         : GenericHTTPError(s, sc) {}
 };
 
+///\brief Request was not received in time
+///
+/// Corresponds to 408 (Request Timeout) HTTP status code
+class RequestTimeout : public RequestError {
+public:
+    RequestTimeout() throw()
+        : RequestError("Request was not received in time.", 408) {}
+};
+
 ///\brief Base class of request format error
 ///
 /// Corresponds to 431 (Request Header Fields Too Large) HTTP status code,
@@ -167,11 +197,14 @@ namespace http {
     M( MethodNotAllowed,            405, "Method Not Allowed"               ) \
     M( RequestTimeout,              408, "Request Timeout"                  ) \
     M( Gone,                        410, "Gone"                             ) \
+    M( PayloadTooLarge,             413, "Payload Too Large"                ) \
+    M( RangeNotSatisfiable,         416, "Range Not Satisfiable"            ) \
     M( ImATeapot,                   418, "I'm a teapot"                     ) \
+    M( UpgradeRequired,             426, "Upgrade Required"                 ) \
     M( InternalServerError,         500, "Internal Server Error"            ) \
     M( NotImplemented,              501, "Not Implemented"                  ) \
     M( BadGateway,                  502, "Bad Gateway"                      ) \
-    M( ServiceUnvailable,           503, "Service Unvailable"               ) \
+    M( ServiceUnvailable,           503, "Service Unavailable"              ) \
     M( GatewayTimeout,              504, "Gateway Timeout"                  ) \
     M( HttpVersionNotSupported,     505, "HTTP Version Not Supported"       ) \
     /* ... */
@@ -182,6 +215,7 @@ namespace http {
  * methods, versions, etc. is restricted to somewhat common usage.
  * */
 class Msg {
+    friend class MsgParser;
 public:
     /**\brief Abstraction for payload data
      *
@@ -192,6 +226,89 @@ public:
         virtual size_t size() const = 0;
         virtual void append(const char * data, size_t n) = 0;
         virtual size_t copy_to(char * dest, size_t maxLen, size_t from=0) const = 0;
+        ///\brief Provides contiguous span of content data kept in memory
+        ///
+        /// Sets `ptr` to data starting from `from`-th byte and returns length
+        /// of the span. Zero return means content has no in-memory data at
+        /// this offset, so it must be copied with `copy_to()` (default).
+        virtual size_t segment(size_t /*from*/, const char *& ptr) const
+            { ptr = nullptr; return 0; }
+        ///\brief Provides file region keeping content data
+        ///
+        /// Sets file descriptor and `offset` in file of data starting from
+        /// `from`-th byte, returns length of the region. Zero return
+        /// (default) means data are not backed by file, otherwise they are
+        /// dispatched with `sendfile()`.
+        virtual size_t file_region(size_t /*from*/, int & fd, off_t & offset) const
+            { fd = -1; offset = 0; return 0; }
+        ///\brief Returns whether content is produced while being sent
+        ///
+        /// Length of streamed content is not known in advance, so it is sent
+        /// with chunked transfer coding (or delimited by closing connection
+        /// for HTTP/1.0 peer). Its data are obtained with `pull()`.
+        virtual bool streamed() const { return false; }
+        ///\brief Produces next portion of streamed content
+        ///
+        /// Writes at most `maxLen` bytes to `dest` and returns number of
+        /// bytes written, zero once content is exhausted.
+        virtual size_t pull(char * /*dest*/, size_t /*maxLen*/)
+            { return 0; }
+    };
+
+    /**\brief Flat table of message headers
+     *
+     * Lowercased names and values of all headers are kept back to back in a
+     * single character block owned by message, table entries are offsets
+     * into this block. Lookup compares names case-insensitively in place,
+     * so neither setting nor getting a header copies the key. Headers are
+     * iterated in order of insertion as pairs of string views.
+     * */
+    class Headers {
+    public:
+        typedef std::pair<std::string_view, std::string_view> Entry;
+    protected:
+        struct Span {
+            uint32_t keyOffset, keyLen
+                   , valueOffset, valueLen
+                   ;
+        };
+        /// Characters of names and values
+        std::pmr::string _block;
+        /// Table of entries
+        std::pmr::vector<Span> _spans;
+
+        Entry _entry(const Span & s) const
+            { return { std::string_view(_block.data() + s.keyOffset, s.keyLen)
+                     , std::string_view(_block.data() + s.valueOffset, s.valueLen) }; }
+        /// Returns entry of given name or `nullptr`
+        const Span * _find(std::string_view key) const;
+    public:
+        explicit Headers(std::pmr::memory_resource * mr=std::pmr::get_default_resource())
+            : _block(mr), _spans(mr) {}
+
+        class const_iterator {
+        private:
+            const Headers * _h;
+            size_t _n;
+        public:
+            const_iterator(const Headers * h, size_t n) : _h(h), _n(n) {}
+            Entry operator*() const { return _h->_entry(_h->_spans[_n]); }
+            const_iterator & operator++() { ++_n; return *this; }
+            bool operator!=(const const_iterator & o) const { return _n != o._n; }
+        };
+        /// Sets (or replaces) header value
+        void set(std::string_view key, std::string_view value);
+        /// Sets `value` of header and returns `true` if header is set
+        bool get(std::string_view key, std::string_view & value) const;
+        /// Removes header, if set
+        void erase(std::string_view key);
+        /// Returns number of headers
+        size_t size() const { return _spans.size(); }
+        /// Removes all headers
+        void clear() { _block.clear(); _spans.clear(); }
+
+        const_iterator begin() const { return const_iterator(this, 0); }
+        const_iterator end() const { return const_iterator(this, _spans.size()); }
     };
 public:
     enum Method {
@@ -199,54 +316,113 @@ public:
         M_na64sw_for_every_http_method(M_declare_method)
         #undef M_declare_method
     };
-    static Method method_from_str(const std::string &);
-    static std::string to_str(Method);
+    static Method method_from_str(std::string_view);
+    static const char * to_str(Method);
 
     enum Version {
         #define M_declare_version(nm, code) nm = code,
         M_na64sw_for_every_http_version(M_declare_version)
         #undef M_declare_version
     };
-    static Version version_from_str(const std::string &);
-    static std::string to_str(Version);
+    static Version version_from_str(std::string_view);
+    static const char * to_str(Version);
 
     enum StatusCode {
         #define M_declare_status_code(nm, code, verb) nm = code,
         M_na64sw_for_every_http_status_code(M_declare_status_code)
         #undef M_declare_status_code
     };
-    static std::string to_str(StatusCode);
+    /// Returns reason phrase of status code
+    static const char * to_str(StatusCode);
+    /// Returns pre-serialized "HTTP/1.1 <code> <phrase>\r\n" status line
+    static std::string_view status_line(StatusCode);
 protected:
     Version _version;
-    std::map<std::string, std::string> _headers;
+    /// Memory of headers and objects created with `allocate()`
+    std::pmr::memory_resource * _mr;
+    Headers _headers;
     std::shared_ptr<iContent> _content;
+    /// Parsed value of `Content-Length` header, `kNoContentLength` if not set
+    size_t _contentLength;
+    /// Whether `Transfer-Encoding` header ends with "chunked" coding
+    bool _chunked;
+    /// Pre-rendered header lines appended to the header verbatim
+    std::string_view _headerBlock;
+
+    /// Appends header lines and blank line terminating header
+    void _write_fields(std::pmr::string & out) const;
 
     ///\brief For request message -- sets URL, method, and version
     ///
     /// This is a stub handling 1st line of request message. Default
-    /// impleemntation emits an error.
-    virtual void _consider_request_header(const std::vector<std::string> &);
+    /// impleemntation emits an error. Arguments are method, request target
+    /// and protocol version.
+    virtual void _consider_request_header( std::string_view, std::string_view
+                                         , std::string_view );
     ///\brief For response message -- sets status code and version
     ///
     /// This is a stub handling 1st line of response message. Default
-    /// impleemntation emits an error.
-    virtual void _consider_response_header(const std::vector<std::string> &);
-    ///\brief Sets HTTP message's header
+    /// impleemntation emits an error. Arguments are protocol version,
+    /// status code (of three digits) and reason phrase.
+    virtual void _consider_response_header( std::string_view, std::string_view
+                                          , std::string_view );
+    ///\brief Sets HTTP message's header from trimmed line `[lb, le)`
     ///
-    /// Besides of header treatment, may forward to `_consider_header_line()`
-    /// internally (so treats also 1st line of requests).
-    void _consider_header_line(const std::string &);
+    /// Validates field name to be a token and value to have no control
+    /// characters. For 1st line of message forwards to
+    /// `_consider_request_header()` or `_consider_response_header()`.
+    /// Throws `RequestError` on malformed line. Position of the first colon
+    /// in line (`le` if there is none) may be provided by line scanner,
+    /// otherwise it is looked up.
+    void _consider_header_line( const char * lb, const char * le, bool startLine
+                              , const char * colon=nullptr );
 public:
-    Msg(Version ver=HTTP_1_1)
+    static constexpr size_t kNoContentLength = SIZE_MAX;
+
+    Msg( Version ver=HTTP_1_1
+       , std::pmr::memory_resource * mr=std::pmr::get_default_resource() )
             : _version(ver)
+            , _mr(mr)
+            , _headers(mr)
             , _content(nullptr)
+            , _contentLength(kNoContentLength)
+            , _chunked(false)
             {}
     virtual ~Msg() {}
 
+    /// Returns memory resource of the message
+    std::pmr::memory_resource * memory_resource() const { return _mr; }
+    ///\brief Creates object in memory resource of the message
+    ///
+    /// For request received by server, this is request-scoped arena of the
+    /// connection, released at once after response is sent -- objects
+    /// must not outlive the response dispatch.
+    template<typename T, typename ... ArgsT> std::shared_ptr<T>
+    allocate(ArgsT && ... args) const {
+        return std::allocate_shared<T>( std::pmr::polymorphic_allocator<T>(_mr)
+                                      , std::forward<ArgsT>(args)... );
+    }
+
     // header routines
-    const std::map<std::string, std::string> & headers() const { return _headers; }
-    void set_header(std::string key, const std::string& value);
-    std::string get_header(std::string key, const std::string & dftVal="") const;
+    const Headers & headers() const { return _headers; }
+    ///\brief Sets header (name is case-insensitive)
+    ///
+    /// Throws `RequestError` on malformed `Content-Length` value.
+    void set_header(std::string_view key, std::string_view value);
+    /// Removes header, if set
+    void erase_header(std::string_view key);
+    std::string get_header(std::string_view key, const std::string & dftVal="") const;
+    ///\brief Returns view on header value, or `dftVal` if header is not set
+    ///
+    /// View remains valid till next header is set.
+    std::string_view get_header_view(std::string_view key, std::string_view dftVal={}) const;
+    /// Returns `Content-Length` value, `kNoContentLength` if not set
+    size_t content_length() const { return _contentLength; }
+    ///\brief Sets block of pre-rendered header lines
+    ///
+    /// Block of `name: value\r\n` lines is written after the headers set,
+    /// as is. It is not copied, so must outlive the message dispatch.
+    void header_block(std::string_view block) { _headerBlock = block; }
 
     // content routines
     /// Clears associated content
@@ -264,25 +440,44 @@ public:
     /// HTTP version
     Version version() const { return _version; }
 
+    ///\brief Appends header (with trailing blank line) to given string
+    ///
+    /// Base implementation writes header lines only, subclasses precede
+    /// them with the start line.
+    virtual void write_header(std::pmr::string & out) const;
     /// Returns header string (with trailing blank line)
-    virtual std::string header() const;
+    std::string header() const;
+    /// Returns whether content is transferred with chunked coding
+    bool chunked() const { return _chunked; }
 
-    /// Appends content instance with given data block
+    ///\brief Appends content instance with given data block
     ///
-    /// Does not check content type.
+    /// Does not check content type. New content is kept in memory unless
+    /// `Content-Length` exceeds given limit, in which case `TmpFileContent`
+    /// is used.
     void append_content_data(const char * data, size_t, size_t);
 
-    /// Dispatch message by socket FD using given buffer
+    ///\brief Dispatch message by socket FD using given buffer
+    ///
+    /// Waits for socket to become writable if it would block, throws
+    /// `RequestTimeout` if client does not accept data for `timeout`
+    /// seconds (zero disables the timeout).
     void dispatch( int clientFD
                  , char * buffer, size_t bufSize
                  , iJournal &
+                 , uint32_t timeout=0
                  ) const;
 
-    /// Receive message by socket FD using given buffer
+    ///\brief Receive message by socket FD using given buffer
+    ///
+    /// Waits for data if socket would block, throws `RequestTimeout` if
+    /// message is not received within `timeout` seconds (zero disables
+    /// the timeout).
     void receive( int clientFD
                 , char * buffer, size_t bufLen
                 , size_t maxInMemContentLen
                 , iJournal &
+                , uint32_t timeout=0
                 );
 };  // class Msg
 
@@ -294,14 +489,109 @@ protected:
 public:
     StringContent() {}
     StringContent(const std::string & s) : _content(s) {}
+    StringContent(std::string && s) : _content(std::move(s)) {}
 
     virtual void append(const char * data, size_t n) override
-        { _content += std::string(data, n); }
+        { _content.append(data, n); }
     virtual size_t size() const override
         { return _content.size(); }
     virtual size_t copy_to(char * dest, size_t maxLen, size_t from=0) const override;
+    virtual size_t segment(size_t from, const char *& ptr) const override;
+};
+
+/**\brief Content produced on demand while being sent
+ *
+ * Data are pulled by dispatch into the send buffer, so serialization overlaps
+ * with transmission and whole payload is never kept. Producer is called
+ * repeatedly, each call writes next portion of content to given stream and
+ * returns `false` once the last portion is written. Content length is not
+ * known in advance, so it is sent with chunked transfer coding.
+ *
+ * \note Producer is called after endpoint returned response, by the thread
+ * sending it, so it must not refer to state that can change meanwhile.
+ * */
+class GeneratorContent : public Msg::iContent {
+public:
+    typedef std::function<bool(std::ostream &)> Producer;
+protected:
+    /// Stream buffer appending data to the portion
+    struct PortionBuf : public std::streambuf {
+        std::pmr::string & dest;
+        PortionBuf(std::pmr::string & dest_) : dest(dest_) {}
+        int_type overflow(int_type c) override {
+            if(!traits_type::eq_int_type(c, traits_type::eof()))
+                dest.push_back(traits_type::to_char_type(c));
+            return traits_type::not_eof(c);
+        }
+        std::streamsize xsputn(const char * s, std::streamsize n) override
+            { dest.append(s, n); return n; }
+    };
+
+    Producer _producer;
+    /// Current portion and number of its bytes pulled; portion storage is
+    /// reused, so producer writes are not copied
+    std::pmr::string _portion;
+    size_t _portionPulled;
+    /// Stream receiving portions from producer
+    PortionBuf _buf;
+    std::ostream _os;
+    /// Number of bytes pulled in total
+    size_t _size;
+    /// Set once producer wrote the last portion
+    bool _finished;
+public:
+    /// Portions are kept in given memory resource
+    GeneratorContent( Producer producer
+                    , std::pmr::memory_resource * mr=std::pmr::get_default_resource() );
+
+    /// Returns number of bytes produced so far
+    virtual size_t size() const override { return _size; }
+    /// Throws `GenericRuntimeError`, content is read-only
+    virtual void append(const char *, size_t) override;
+    /// Throws `GenericRuntimeError`, produced data are not retained
+    virtual size_t copy_to(char *, size_t, size_t from=0) const override;
+    virtual bool streamed() const override { return true; }
+    virtual size_t pull(char * dest, size_t maxLen) override;
+};
+
+/**\brief Content kept in anonymous temporary file
+ *
+ * Used for request content exceeding in-memory limit, so memory stays bounded
+ * regardless of number and size of uploads being received. File is created
+ * with `O_TMPFILE` (falls back to unlinked `mkstemp()` file), so it never
+ * appears in the directory and vanishes once content is destroyed. Data are
+ * read by mapping the file into memory.
+ * */
+class TmpFileContent : public Msg::iContent {
+protected:
+    int _fd;
+    size_t _size;
+    /// Lazily created read-only mapping of the file (null if not mapped)
+    mutable char * _map;
+    /// Length of the mapping
+    mutable size_t _mapLen;
+
+    void _unmap() const;
+public:
+    ///\brief Creates temporary file in given directory
+    ///
+    /// Null `dir` stands for `$TMPDIR` or `/tmp`. Throws
+    /// `GenericRuntimeError` on failure.
+    TmpFileContent(const char * dir=nullptr);
+    ~TmpFileContent();
+
+    TmpFileContent(const TmpFileContent &) = delete;
+    TmpFileContent & operator=(const TmpFileContent &) = delete;
+
+    virtual void append(const char * data, size_t n) override;
+    virtual size_t size() const override { return _size; }
+    virtual size_t copy_to(char * dest, size_t maxLen, size_t from=0) const override;
+    virtual size_t segment(size_t from, const char *& ptr) const override;
+    virtual size_t file_region(size_t from, int & fd, off_t & offset) const override;
 };
 
+class ResponseMsg;
+
 /**\brief Subtype of HTTP message bearing data specific for request
  *
  * Additional data:
@@ -314,18 +604,31 @@ protected:
     std::string _strURI;
     URI _uri;
     std::string _clientIP;
+    std::string_view _commonHeaders;
 
-    void _consider_request_header(const std::vector<std::string> &) override;
+    void _consider_request_header( std::string_view, std::string_view
+                                 , std::string_view ) override;
 public:
-    /// Ctr
-    RequestMsg() : _method(GET) {}
+    /// Ctr, headers are kept in given memory resource
+    RequestMsg(std::pmr::memory_resource * mr=std::pmr::get_default_resource())
+        : Msg(HTTP_1_1, mr), _method(GET) {}
     /// Parses header line
     void consider_line(const std::string &);
 
     /// Client IP setter
     void client_ip(const std::string & ips) { _clientIP = ips; }
+    ///\brief Sets header lines server sends with every response
+    ///
+    /// Set by server before request is handled. Block is not copied, so it
+    /// must outlive the request.
+    void common_headers(std::string_view block) { _commonHeaders = block; }
+    ///\brief Returns header lines server sends with every response
+    ///
+    /// Meant for endpoints writing response head themselves (ones taking
+    /// over client connection), as `name: value\r\n` lines.
+    std::string_view common_headers() const { return _commonHeaders; }
 
-    std::string header() const override;
+    void write_header(std::pmr::string & out) const override;
 
     Method method() const { return _method; }
     const std::string & str_uri() const { return _strURI; }
@@ -333,6 +636,16 @@ public:
     const std::string & ip_str() const { return _clientIP; }
     void uri(const URI & uri_);
     void uri(const std::string & uri_);
+
+    ///\brief Returns whether client wants connection to persist
+    ///
+    /// Respects `Connection` header: HTTP/1.1 connections are persistent
+    /// unless `close` is given, HTTP/1.0 ones only if `keep-alive` is given.
+    bool keep_alive() const;
+    ///\brief Creates response in memory resource of the request
+    ///
+    /// See `allocate()` for lifetime restrictions.
+    std::shared_ptr<ResponseMsg> response(StatusCode) const;
 };
 
 /**\brief Subtype of HTTP message bearing data specific for response messages
@@ -347,18 +660,154 @@ class ResponseMsg : public Msg {
 protected:
     StatusCode _code;
 
-    void _consider_response_header(const std::vector<std::string> &) override;
+    void _consider_response_header( std::string_view, std::string_view
+                                  , std::string_view ) override;
 public:
-    ResponseMsg(StatusCode c=Msg::Ok) : _code(c) {}
+    ResponseMsg( StatusCode c=Msg::Ok
+               , std::pmr::memory_resource * mr=std::pmr::get_default_resource() )
+        : Msg(HTTP_1_1, mr), _code(c) {}
     StatusCode status_code() const { return _code; }
     void status_code(Msg::StatusCode c) { _code = c; }
 
-    std::string header() const override;
+    void write_header(std::pmr::string & out) const override;
 
     ///\brief Finalizes response object before dispatch
-    void finalize();
+    ///
+    /// Sets `Content-Length`, or `Transfer-Encoding: chunked` for streamed
+    /// content if peer supports HTTP/1.1 (otherwise streamed content is
+    /// delimited by closing connection).
+    void finalize(Version peer=HTTP_1_1);
 };
 
+/**\brief Incremental (push) parser of HTTP message
+ *
+ * Consumes data portions of arbitrary length, as they arrive from the socket,
+ * and fills the associated message instance. Header lines are considered only
+ * when complete line is available, so parser may consume less data than was
+ * provided -- caller must keep the remainder and provide it again, followed
+ * by newly received data.
+ * */
+class MsgParser {
+public:
+    enum State {
+        kHeaders,  ///< receiving header lines
+        kContent,  ///< receiving message body
+        kChunkSize,  ///< receiving size line of content chunk
+        kChunkData,  ///< receiving data of content chunk
+        kChunkEnd,  ///< receiving line break terminating chunk data
+        kTrailers,  ///< receiving trailer lines after last chunk
+        kDone,  ///< message is complete
+    };
+protected:
+    /// Message being filled
+    Msg & _msg;
+    /// Max content length to be kept in memory
+    const size_t _maxInMemContentLen;
+    /// Max content length accepted
+    const size_t _maxContentLen;
+    /// Current parser state
+    State _state;
+    /// Number of non-empty header lines considered so far
+    size_t _nLines;
+    /// Content (or current chunk) length expected and currently received
+    size_t _expectedLength
+         , _receivedLength
+         ;
+    /// Called once blank line terminating headers block is met
+    void _headers_done(iJournal &);
+    /// Consumes chunk size line, chunk terminator or trailer line
+    void _chunk_line(const char * lb, const char * le, iJournal &);
+public:
+    ///\brief Creates parser filling given message
+    ///
+    /// Content longer than `maxInMemContentLen` is spilled to temporary
+    /// file. Message declaring content longer than `maxContentLen`, or which
+    /// chunks grow beyond it, is rejected with `413 Payload Too Large`.
+    MsgParser(Msg & msg, size_t maxInMemContentLen, size_t maxContentLen=SIZE_MAX);
+    /// Consumes (part of) given data, returns number of bytes used
+    size_t feed(const char * data, size_t n, iJournal &);
+    /// Returns current state of the parser
+    State state() const { return _state; }
+    /// Returns whether message is complete
+    bool done() const { return kDone == _state; }
+};
+
+/**\brief Incremental dispatch of HTTP message
+ *
+ * Sends header and content of the message by portions, as long as socket
+ * accepts data. Header and content segments are gathered into single
+ * `sendmsg()` call; file-backed content is sent with `sendfile()`, other
+ * content without in-memory segments is staged by portions in the dispatch
+ * buffer. On non-blocking socket `send_some()` returns `false` once
+ * socket is not ready for writing, so caller may wait for socket to become
+ * writable and call it again.
+ * */
+class MsgSender {
+protected:
+    /// Message being sent
+    const Msg & _msg;
+    /// Rendered header string
+    std::pmr::string _header;
+    /// Number of bytes sent for header and content (including chunk framing)
+    size_t _headerSent
+         , _contentSent
+         ;
+    /// Content size (zero if message has no content or content is streamed)
+    const size_t _contentSize;
+    /// Set if content is streamed and whether it is framed in chunks
+    const bool _streamed
+             , _chunked
+             ;
+    /// Range of streamed data staged in buffer and not yet sent
+    size_t _stagedBegin
+         , _stagedEnd
+         ;
+    /// Set once streamed content is exhausted
+    bool _exhausted;
+
+    /// Pulls streamed content, throws `ClientSocketError` on failure
+    size_t _pull(char * dest, size_t maxLen);
+    /// Pulls next portion of streamed content into buffer
+    void _stage(char * buffer, size_t bufSize);
+public:
+    /// Max number of IO vector entries gathered at once
+    static constexpr size_t kMaxSegments = 16;
+
+    /// Renders header in given memory resource
+    MsgSender(const Msg &, std::pmr::memory_resource * mr=std::pmr::get_default_resource());
+    ///\brief Fills IO vector with next portion of data to be sent
+    ///
+    /// Returns number of entries set (at most `maxSegments`), zero once
+    /// message is sent entirely. Content lacking in-memory segments is
+    /// copied to given buffer, which then backs at most one entry. Unless
+    /// `stageFiles` is set, gathering stops at file-backed content.
+    /// Streamed content is pulled into buffer, which must not be altered
+    /// till staged data are sent.
+    size_t next_segments( iovec * iov, size_t maxSegments
+                        , char * buffer, size_t bufSize
+                        , bool stageFiles=true );
+    ///\brief Provides file region of content to be sent next
+    ///
+    /// Returns zero if header is not sent yet or content at current
+    /// position is not backed by file.
+    size_t next_file_region(int & fd, off_t & offset) const;
+    /// Accounts `n` bytes of data as sent
+    void advance(size_t n);
+    ///\brief Sends as much data as socket accepts using given buffer
+    ///
+    /// Returns `true` when message is sent entirely and `false` if socket
+    /// would block. Throws `ClientSocketError` on socket failure.
+    bool send_some(int fd, char * buffer, size_t bufSize, iJournal &);
+    /// Returns whether whole message has been sent
+    bool done() const;
+    /// Returns number of bytes sent so far (header and content)
+    size_t bytes_sent() const { return _headerSent + _contentSent; }
+};
+
+class Connection;  // fwd, see connection.hh
+class RepresentationCache;  // fwd, see representation-cache.hh
+class ResponseCache;  // fwd, see response-cache.hh
+
 /**\brief Simpistic HTTP server implementation
  *
  * Operates by receiving HTTP requests and forwarding pre-parsed messages
@@ -381,6 +830,9 @@ public:
     static constexpr uint16_t kNoDispatchResponse = 0x1;
     static constexpr uint16_t kStop = 0x2;
     static constexpr uint16_t kKeepClientConnection = 0x4;
+    /// Set internally for steering request received by follower shard in
+    /// prefork mode, makes connection to be handed over to leader shard
+    static constexpr uint16_t kHandOver = 0x8;
 
     /// Result type of route handling
     typedef std::pair< uint16_t, std::shared_ptr<ResponseMsg> > HandleResult;
@@ -400,14 +852,73 @@ public:
     };
     /// Abstract route's endpoint
     struct iEndpoint {
+        ///\brief Thread-safety level declared by endpoint
+        ///
+        /// Used by multi-threaded server mode to decide whether `handle()`
+        /// may be called in parallel.
+        enum ThreadSafety {
+            kExclusive,  ///< never runs in parallel with other exclusive endpoints
+            kSerialized,  ///< calls to this endpoint are serialized
+            kConcurrent,  ///< may be called from multiple threads at once
+        };
         ///\brief Should check the request for match and return response
         ///
         /// Returned nullptr is considered as non-matching result
         virtual HandleResult handle( const RequestMsg &, int clientFD, const iRoute::URLParameters & ) = 0;
+        ///\brief Returns thread-safety level of the endpoint
+        ///
+        /// Default is the most conservative level, so endpoints have to opt
+        /// in for parallel handling explicitly.
+        virtual ThreadSafety thread_safety() const { return kExclusive; }
+        ///\brief Returns whether request affects state shared among shards
+        ///
+        /// In prefork mode (see `Server::run_prefork()`) such "steering"
+        /// requests are served by the leader shard only, so the state stays
+        /// consistent. Default is `false` (read-only endpoint or endpoint
+        /// with no shared state).
+        virtual bool steering(const RequestMsg &) const { return false; }
+        /// Version value standing for endpoint state not being versioned
+        static constexpr uint64_t kUnversioned = UINT64_MAX;
+        ///\brief Returns version of the state GET response depends on
+        ///
+        /// Meant to be cheap (a counter, event number, etc) as it is called
+        /// for every GET request before `handle()`, holding the same lock.
+        /// Server derives strong `ETag` of the response from version and
+        /// answers request with matching `If-None-Match` by `304 Not
+        /// Modified` without calling `handle()`. Default implementation
+        /// returns `kUnversioned`, disabling it.
+        virtual uint64_t state_version( const RequestMsg &
+                                      , const iRoute::URLParameters & ) const
+            { return kUnversioned; }
         virtual ~iEndpoint() {}
     };
     /// Routes list to serve
     typedef std::list< std::pair<iRoute *, iEndpoint *> > Routes;
+    /// Callback returning version of the state route output depends on
+    typedef std::function<uint64_t( const RequestMsg &
+                                  , const iRoute::URLParameters & )> StateVersion;
+    /// Server statistics counters
+    struct Statistics {
+        /// Number of accepted connections
+        std::atomic<size_t> nConnections;
+        /// Number of received requests
+        std::atomic<size_t> nRequests;
+        /// Number of requests not received in time (responded with 408)
+        std::atomic<size_t> nReadTimeouts;
+        /// Number of connections closed as client did not accept response
+        std::atomic<size_t> nWriteTimeouts;
+        /// Number of idle connections expired (no request was sent)
+        std::atomic<size_t> nIdleTimeouts;
+        /// Number of connections rejected by admission control (503)
+        std::atomic<size_t> nShedConnections;
+        /// Number of requests rejected due to route concurrency limit (503)
+        std::atomic<size_t> nShedRequests;
+
+        Statistics() : nConnections(0), nRequests(0)
+                     , nReadTimeouts(0), nWriteTimeouts(0), nIdleTimeouts(0)
+                     , nShedConnections(0), nShedRequests(0)
+                     {}
+    };
 private:
     /// Host name, used for server socket bind
     const std::string _host;
@@ -417,25 +928,200 @@ private:
     iJournal & _L;
     /// Number of simultaneous connections on socket (see `man listen()`)
     uint16_t _backlog;
-    /// Connections timeout, sec
+    ///\brief Connections timeout, sec
+    ///
+    /// Request must be received within this time since its first byte and
+    /// response data must be accepted by client with no longer pauses.
+    /// Also applies to new connection awaiting for the first request. Zero
+    /// disables timeouts.
     const uint32_t _connectionTimeout;
 
     /// Server socket descriptor
     int _sockFD;
     /// Server socket address struct
     sockaddr_in _srvAddr;
-    /// IO buffers for data receiving and dispatch
-    char * _recvBuffer
-       , * _respBuffer;
+    /// Size of connection IO buffers for data receiving and dispatch
     const size_t _ioBufSize;
+    /// Pool of connection buffers blocks (see `Connection`)
+    util::BufferPool _connBuffers;
 
     const size_t _maxInMemContentLen;
+    /// Max length of request content accepted
+    size_t _maxContentLen;
 
     /// Flag used to decide whether server has to accept new request
-    bool _keepGoing;
+    std::atomic<bool> _keepGoing;
+    /// Idle timeout of persistent connections, sec (zero disables keep-alive)
+    uint32_t _keepAliveTimeout;
+    /// Max number of requests served by persistent connection
+    size_t _keepAliveMaxRequests;
+
+    /// Number of worker threads in multi-threaded mode (zero otherwise)
+    size_t _nWorkers;
+    /// Lock shared by endpoints of `kExclusive` thread-safety level
+    std::mutex _exclusiveLock;
+    /// Locks of endpoints of `kSerialized` thread-safety level
+    std::unordered_map<const iEndpoint *, std::unique_ptr<std::mutex>> _endpointLocks;
+
+    /// Shard number in prefork mode, zero for leader shard
+    size_t _nShard;
+    /// Number of shards in prefork mode (zero otherwise)
+    size_t _nShards;
+    /// Socket used to hand over connections to leader shard (-1 if unused)
+    int _leaderFD;
+
+    /// Server statistics
+    Statistics _stats;
+
+    /// Number of pending connections to start (and stop) shedding load at,
+    /// zero disables admission control
+    size_t _highWatermark
+         , _lowWatermark
+         ;
+    /// Whether new connections are currently rejected
+    bool _shedding;
+    /// `Retry-After` value of 503 response, unset if it is not rendered
+    std::optional<uint32_t> _retryAfter;
+    /// Pre-serialized "503 Service Unavailable" response
+    std::string _unavailableResponse;
+    /// Header lines added to every response (CORS, server name, etc)
+    std::string _commonHeaders;
+    /// Pre-rendered common header lines followed by persistent connection
+    /// headers, or by `connection: close` line
+    std::string _keepAliveHeaders
+              , _closeHeaders
+              ;
+    /// Renders pre-rendered header blocks and 503 response
+    void _render_header_blocks();
+    /// Concurrency limit of the route
+    struct RouteLimit {
+        const size_t max;
+        /// Number of requests being handled by route
+        std::atomic<size_t> n;
+        RouteLimit(size_t max_) : max(max_), n(0) {}
+    };
+    /// Concurrency limits of the routes; read-only while server runs
+    std::unordered_map<const iRoute *, std::unique_ptr<RouteLimit>> _routeLimits;
+    /// Compression settings of the route
+    struct RouteCompression {
+        /// Min length of (not streamed) content to be compressed
+        size_t minSize;
+        /// zlib compression level
+        int level;
+    };
+    /// Compression settings of the routes; read-only while server runs
+    std::unordered_map<const iRoute *, RouteCompression> _routeCompression;
+    /// Max representation size of the routes with immutable output;
+    /// read-only while server runs
+    std::unordered_map<const iRoute *, size_t> _immutableRoutes;
+    /// Cached representations of immutable routes
+    std::unique_ptr<RepresentationCache> _representations;
+    /// State version callbacks of the routes with cached output (empty one
+    /// stands for `iEndpoint::state_version()`); read-only while server runs
+    std::unordered_map<const iRoute *, StateVersion> _cachedRoutes;
+    /// Cached responses of the routes with versioned output
+    std::unique_ptr<ResponseCache> _responses;
 protected:
-    std::shared_ptr<RequestMsg> _receive(int clientFD, const char * clientIPStr);
-    void _dispatch(int clientFD, const char * clientIPStr, std::shared_ptr<ResponseMsg> );
+    /// Creates, binds and listens server socket
+    void _listen();
+    ///\brief Acquires lock wrt endpoint thread-safety level
+    ///
+    /// Returns empty lock object in single-threaded modes.
+    std::unique_lock<std::mutex> _lock_endpoint(const iEndpoint &);
+    /// Returns response object describing an error
+    static std::shared_ptr<ResponseMsg> _error_response(int statusCode, const char * what);
+    ///\brief Handles request received by connection with first matching route
+    ///
+    /// Returned result always bears response object: if no matching route is
+    /// found or route raised an error, response describes an error. Request
+    /// exceeding concurrency limit of the route is rejected by `_shed()`.
+    HandleResult _handle( Connection &, const Routes & );
+    /// Returns `304 Not Modified` response to conditional request
+    static std::shared_ptr<ResponseMsg> _not_modified( const RequestMsg &
+                                                     , std::string_view etag );
+    ///\brief Answers conditional GET request by `304 Not Modified`, if need
+    ///
+    /// Replaces successful response bearing `ETag` which matches request's
+    /// `If-None-Match` header.
+    static void _conditional(const RequestMsg &, std::shared_ptr<ResponseMsg> &);
+    ///\brief Answers range request by `206 Partial Content`, if need
+    ///
+    /// Applies to successful GET response with content that is not
+    /// streamed: advertises `Accept-Ranges` and, if request has `Range`
+    /// header (and its `If-Range` matches), replaces content with requested
+    /// slices -- single one or `multipart/byteranges` of several ones (see
+    /// `CompositeContent`). Unsatisfiable range results in `416 Range Not
+    /// Satisfiable` response.
+    static void _ranges(const RequestMsg &, std::shared_ptr<ResponseMsg> &);
+    ///\brief Compresses response content, if client accepts it
+    ///
+    /// Wraps content of the response with compressing one (see
+    /// `DeflateContent`) with respect to `Accept-Encoding` header of the
+    /// request. Content of non-textual type, content shorter than
+    /// `minSize` or content already encoded by endpoint is left intact.
+    void _compress(const RequestMsg &, ResponseMsg &, const RouteCompression &) const;
+    ///\brief Sets server-wide headers and finalizes response before dispatch
+    ///
+    /// HTTP version of the peer defines framing of streamed content.
+    void _prepare_response( ResponseMsg &, iJournal &
+                          , Msg::Version peer=Msg::HTTP_1_1 );
+    ///\brief Decides whether new connection has to be served
+    ///
+    /// Applies admission control watermarks to given number of pending
+    /// connections. Not thread-safe, supposed to be called by acceptor.
+    bool _admit(size_t nPending);
+    ///\brief Sends pre-serialized 503 response, does not close the socket
+    ///
+    /// Does not block; socket is shut down for writing and data sent by
+    /// client are drained, so closing socket does not reset connection
+    /// before client reads the response.
+    void _shed(int fd) const;
+    ///\brief Receives request by connection and handles it
+    ///
+    /// Returns `false` if request is not yet received entirely. Otherwise
+    /// sets `execFlags` wrt route handling and, unless
+    /// `kNoDispatchResponse` is set, supplies connection with response to be
+    /// sent.
+    bool _process(Connection &, const Routes &, uint16_t & execFlags);
+    ///\brief Serves connection with blocking socket
+    ///
+    /// Receives request, handles it, sends response and closes the socket
+    /// (unless `kKeepClientConnection` is set). Returns execution flags.
+    uint16_t _serve(Connection &, const Routes &);
+    ///\brief Returns current deadline of the connection
+    ///
+    /// Depends on connection state: idle connection expires after keep-alive
+    /// (or connection, for the first request) timeout, request must be
+    /// received and response data must be accepted by client within
+    /// connection timeout. Returns `time_point::max()` if no deadline is
+    /// set.
+    std::chrono::steady_clock::time_point _deadline(const Connection &) const;
+    ///\brief Handles connection which deadline is expired
+    ///
+    /// Accounts timeout in statistics. Returns `true` if client has to be
+    /// notified by 408 response (set to connection by this method), or
+    /// `false` if connection has to be closed.
+    bool _deadline_expired(Connection &);
+    ///\brief Waits for socket of the connection to become ready
+    ///
+    /// Returns `false` if connection deadline expires first.
+    bool _wait(const Connection &, short events) const;
+    /// Runs io_uring event loop, returns `false` if ring can not be set up
+    bool _run_io_uring(const Routes &, size_t maxConnections);
+    ///\brief Forwards connection with steering request to leader shard
+    ///
+    /// Received request (and pipelined data, if any) is sent along with
+    /// client socket descriptor. Data exceeding IO buffer size are written
+    /// to memory file passed along with socket instead, so request size is
+    /// not limited by hand over. Throws `GenericHTTPError` if connection
+    /// can not be handed over.
+    void _hand_over(Connection &);
+    ///\brief Returns connection handed over by follower shard, if any
+    ///
+    /// Used by leader shard, returns `nullptr` if no connection is pending.
+    Connection * _take_over();
+    /// Returns whether this is a follower shard of prefork mode
+    bool _is_follower() const { return _nShards && _nShard; }
 public:
     /// Initializes the socket structures, allocates buffers
     Server( const std::string & host_
@@ -452,8 +1138,171 @@ public:
     ~Server();
     /// Runs the server, forarding connection to corresponding route
     void run( const Routes & routes );
+    /**\brief Runs the server in event-driven mode
+     *
+     * Multiplexes client connections with `epoll(7)` on non-blocking sockets,
+     * so accepting, receiving and dispatching interleave across connections
+     * and slow client does not block the others. Route handling is still
+     * performed in the calling thread, one request at a time.
+     *
+     * Endpoints returning `kKeepClientConnection` take ownership over client
+     * socket which is then removed from polling set (note that socket remains
+     * in non-blocking mode).
+     * */
+    void run_epoll( const Routes & routes, size_t maxEvents=64 );
+    /**\brief Runs the server in multi-threaded mode
+     *
+     * Calling thread accepts connections and hands them to the fixed pool of
+     * `nWorkers` threads. Each worker owns its logging context, serving
+     * connection in blocking mode. Route matching and
+     * request handling are performed in parallel, subject to thread-safety
+     * level declared by endpoint (see `iEndpoint::thread_safety()`).
+     * */
+    void run_threaded( const Routes & routes, size_t nWorkers );
+    /**\brief Runs the server with io_uring IO backend
+     *
+     * Accepts, receives and sends are submitted to `io_uring(7)` in batches,
+     * one operation per connection is kept in flight. Receive buffers of the
+     * pool (one slot per connection, up to `maxConnections`) are registered
+     * within the ring. As for `run_epoll()`, route handling is performed in
+     * the calling thread.
+     *
+     * Backend is enabled at build time with `SYNC_HTTP_SRV_WITH_IO_URING`
+     * CMake option. Falls back to the blocking mode (`run()`) if backend is
+     * not built or ring can not be set up.
+     * */
+    void run_io_uring( const Routes & routes, size_t maxConnections=256 );
+    /**\brief Runs prefork server with `nShards` processes on the same port
+     *
+     * Forks `nShards - 1` follower processes, each binding its own socket
+     * with `SO_REUSEPORT`, so kernel balances connections among shards.
+     * Every shard (including the calling process that becomes leader)
+     * runs event-driven loop (see `run_epoll()`). If `pin` is set, shards
+     * are pinned to distinct CPUs.
+     *
+     * Routes, endpoints and data they refer to are created before fork and
+     * thus shared in read-only manner (copy-on-write). Changes made by
+     * shard are not visible to other shards, so endpoints keeping mutable
+     * shared state must declare requests changing or reading it as
+     * steering (see `iEndpoint::steering()`): followers hand over such
+     * connections to the leader shard. Request is passed along with the
+     * socket, large ones through anonymous memory file, so steering requests
+     * are subject to the same limits as other ones.
+     *
+     * Returns in leader process once it is stopped; followers are then
+     * terminated. Follower processes never return from this method.
+     * */
+    void run_prefork( const Routes & routes, size_t nShards, bool pin=false );
+    /// Returns server statistics
+    const Statistics & stats() const { return _stats; }
+    /**\brief Sets high-water mark of connection buffers pool
+     *
+     * Connection objects along with their IO and arena buffers are placed
+     * in blocks taken from the pool and returned once connection is closed;
+     * io_uring mode takes blocks for all its connection slots at once, as
+     * buffers are registered within the ring. Prefork leader receives data
+     * of connections handed over into pooled block too. Pool keeps up to
+     * `highWater` idle blocks (64 by default), the ones released beyond it
+     * are freed. Making it close to the expected number of simultaneous
+     * connections keeps memory footprint flat under sustained load.
+     * */
+    void buffer_pool(size_t highWater) { _connBuffers.high_water(highWater); }
+    /// Returns connection buffers pool, e.g. to inspect hit/miss counters
+    const util::BufferPool & buffer_pool() const { return _connBuffers; }
+    /**\brief Sets max length of request content
+     *
+     * Request declaring longer content, or which chunked content grows
+     * beyond it, is answered by `413 Payload Too Large` and its connection
+     * is closed. Content longer than max in-memory length is spilled to
+     * temporary file, so the limit bounds disk space taken by request too.
+     * 64 MiB by default.
+     * */
+    void max_content_length(size_t n) { _maxContentLen = n; }
+    /**\brief Configures admission control
+     *
+     * Once number of pending connections reaches `highWatermark`, new
+     * connections are answered by pre-serialized 503 response with
+     * `Retry-After` header and closed, until number of pending connections
+     * drops to `lowWatermark`. Pending connections are the ones waiting for
+     * worker in multi-threaded mode or being served in event-driven modes.
+     * Zero `highWatermark` disables admission control (default). Not
+     * applicable to blocking mode.
+     * */
+    void admission( size_t highWatermark, size_t lowWatermark
+                  , uint32_t retryAfter=1 );
+    ///\brief Limits number of requests handled by the route at once
+    ///
+    /// Request is in flight since it is handled by the route till response
+    /// is sent. Requests beyond the limit are answered with 503 response.
+    /// Zero removes the limit. Must not be called while server runs.
+    void route_limit(const iRoute &, size_t maxInFlight);
+    /**\brief Enables response compression for the route
+     *
+     * Responses of textual content types are compressed with gzip or
+     * deflate coding as negotiated by request's `Accept-Encoding` header.
+     * Compression is streamed while response is sent, so it applies to
+     * streamed (generator) content as well, which is then sent with chunked
+     * transfer coding. Content shorter than `minSize` is sent as is. `level`
+     * is zlib compression level, -1 stands for default one. Requires server
+     * to be built with zlib (`SYNC_HTTP_SRV_WITH_ZLIB`), otherwise warning
+     * is printed. Must not be called while server runs.
+     * */
+    void compression(const iRoute &, size_t minSize=1024, int level=-1);
+    /**\brief Declares output of the route to be immutable
+     *
+     * GET responses of the route (with `200 OK` status) are cached as
+     * representations keyed by URL parameters and query string (see
+     * `RepresentationCache`), along with their gzip-coded payload. The first
+     * request builds representation, the following ones are served from
+     * cache with no endpoint call. Representations larger than `maxSize`
+     * bytes are not cached. Must not be called while server runs.
+     * */
+    void immutable(const iRoute &, size_t maxSize=16*1024*1024);
+    ///\brief Returns cache of immutable representations
+    ///
+    /// Can be used to put representations at startup or to invalidate them
+    /// once routes are reconfigured.
+    RepresentationCache & representations() { return *_representations; }
+    /**\brief Enables caching of the route output
+     *
+     * GET responses of the route (with `200 OK` status) are cached in LRU
+     * cache (see `ResponseCache`) keyed by URL parameters, query string and
+     * version of the state returned by `stateVersion` callback, or by
+     * endpoint's `state_version()` if callback is not set. Requests of the
+     * same state version are served from cache with no endpoint call, along
+     * with gzip-coded payload if client accepts it. Version is obtained
+     * holding endpoint lock and also defines response `ETag`, thus cached
+     * and conditional requests are consistent. Responses of unversioned
+     * state (`iEndpoint::kUnversioned`) are not cached. Must not be called
+     * while server runs.
+     * */
+    void cache(const iRoute &, StateVersion stateVersion=nullptr);
+    ///\brief Returns cache of versioned responses
+    ///
+    /// Can be used to tune its limits and to get hit/miss metrics.
+    ResponseCache & response_cache() { return *_responses; }
     /// Can be called by one of the request handlers (routes) to stop the server
     void set_stop_flag() { _keepGoing = false; }
+    /**\brief Enables persistent (keep-alive) connections
+     *
+     * Connection is kept open if client asks for it (see
+     * `RequestMsg::keep_alive()`), for up to `maxRequests` requests, and
+     * closed once it stays idle for `idleTimeout` seconds. Pipelined requests
+     * are handled in order of arrival. Zero timeout disables keep-alive
+     * (default).
+     *
+     * \note In blocking and multi-threaded modes idle persistent connection
+     *       occupies the server (worker thread) until timeout expires.
+     * */
+    void keep_alive(uint32_t idleTimeout, size_t maxRequests=100);
+    ///\brief Adds header sent with every response
+    ///
+    /// Header lines are rendered once, along with pre-serialized 503
+    /// response of admission control; endpoints taking over connection get
+    /// them with `RequestMsg::common_headers()`. By default `Server` and
+    /// `Access-Control-Allow-Origin: *` headers are sent. Must not be
+    /// called while server runs.
+    void common_header(std::string_view name, std::string_view value);
 };  // class Server
 
 /// Static string route implementation
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "sync-http-srv/logging.hh"
+#include "sync-http-srv/server.hh"
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/**\brief Endpoint serving connections it takes over by a thread of its own
+ *
+ * Base of endpoints keeping long-lived connections (event stream
+ * subscribers, WebSocket sessions) out of the server's serving loop. Such
+ * endpoint answers request by taking over client socket (returns
+ * `kKeepClientConnection | kNoDispatchResponse`) and serves it by dedicated
+ * thread, started with the first connection taken over (so it is not lost
+ * by forked shards). Thread waits in `poll()` on connections' sockets and on
+ * wake-up descriptor, signalled when data are queued for dispatch.
+ *
+ * Subclass keeps its connections guarded by `_mtx` and implements
+ * `_visit()`, `_poll_set()` and `_on_ready()`, which are called by the
+ * thread with lock held. Connections are removed by the thread only and new
+ * ones are appended, so polled descriptors keep their order. Subclass
+ * destructor must call `_halt()` before its connections are destroyed.
+ * */
+class SessionEndpoint : public Server::iEndpoint {
+protected:
+    typedef std::chrono::steady_clock Clock;
+
+    iJournal & _L;
+    /// Name of the endpoint kind, for logging
+    const char * const _what;
+    /// Guards connections of subclass and its counters
+    mutable std::mutex _mtx;
+    /// Set to stop the thread
+    bool _stop;
+    /// Descriptor waking the thread up when data are queued
+    int _wakeFD;
+    std::thread _thread;
+
+    /// Wakes up the thread
+    void _wake();
+    /// Starts the thread unless it runs, and wakes it up; lock must be held
+    void _start();
+    /// Stops the thread (if it runs) and waits for it to finish
+    void _halt();
+    /// Serves connections till stopped
+    void _serve();
+    ///\brief Prepares socket taken over from server
+    ///
+    /// Makes socket non-blocking and disables Nagle's algorithm, as data
+    /// sent are small and must not be delayed. Returns peer IP address, for
+    /// logging.
+    static std::string _take_over(int clientFD);
+
+    ///\brief Writes queued data and drops connections, as needed
+    ///
+    /// Returns time by which connections have to be visited again,
+    /// `Clock::time_point::max()` if there is no such need. May release lock
+    /// meanwhile (e.g. to call callbacks).
+    virtual Clock::time_point _visit(std::unique_lock<std::mutex> &, Clock::time_point now) = 0;
+    /// Appends entries of connections to the poll set
+    virtual void _poll_set(std::vector<pollfd> &) const = 0;
+    ///\brief Handles polled connections
+    ///
+    /// Given entries are the ones appended by `_poll_set()`, in order.
+    virtual void _on_ready(const pollfd *, size_t n) = 0;
+public:
+    ///\brief Creates endpoint
+    ///
+    /// Throws `GenericRuntimeError` if wake-up descriptor can not be created.
+    SessionEndpoint(iJournal &, const char * what);
+    /// Stops the thread, if subclass did not
+    ~SessionEndpoint();
+
+    SessionEndpoint(const SessionEndpoint &) = delete;
+    SessionEndpoint & operator=(const SessionEndpoint &) = delete;
+};
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
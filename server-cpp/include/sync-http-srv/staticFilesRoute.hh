@@ -1,46 +1,89 @@
 #pragma once
 
-#if 0
-#include "na64util/http/server.hh"
+#include "sync-http-srv/server.hh"
 
-namespace na64dp {
+#include <string>
+#include <unordered_map>
+
+namespace sync_http_srv {
 namespace util {
 namespace http {
 
-///\brief Local file content
+/**\brief Local file content
+ *
+ * Keeps file open for the content lifetime, so file data are dispatched
+ * directly from page cache with `sendfile()`. Read-only, `append()` throws.
+ * */
 class LocalFileContent : public Msg::iContent {
 protected:
     std::string _filePath;
+    int _fd;
     size_t _fileSize;
 public:
-    LocalFileContent(const std::string &);
+    ///\brief Opens file, throws `GenericRuntimeError` on failure
+    ///
+    /// Unless `followSymlink` is set, file being a symlink is not opened.
+    LocalFileContent(const std::string &, bool followSymlink=true);
+    ~LocalFileContent();
+
+    LocalFileContent(const LocalFileContent &) = delete;
+    LocalFileContent & operator=(const LocalFileContent &) = delete;
+
+    const std::string & file_path() const { return _filePath; }
+
+    size_t size() const override { return _fileSize; }
+    void append(const char *, size_t) override;
+    size_t copy_to(char * dest, size_t maxLen, size_t from=0) const override;
+    size_t file_region(size_t from, int & fd, off_t & offset) const override;
 };
 
 /**\brief Static files route
  *
  * A simple route implementation serving static files from certain local
- * directory.
+ * directory. Acts as both, the route and its endpoint:
  *
- * \note This handler is NOT SECURE for general-purpose web as may allow
+ *      LocalDirRoute www("/var/www", "/static");
+ *      routes.push_back({&www, &www});
+ *
+ * Request path remainder after URL prefix is provided as `path` URL
+ * parameter. Directory requests are served with its `index.html`, if any.
+ * Requests of files which path (with `..` and symlinks resolved) is not
+ * within the served directory are answered by `403 Forbidden`; symlinks
+ * pointing within the served directory are followed.
+ *
+ * \note This handler is NOT SECURE for general-purpose web as it does not
+ * restrict hidden files.
  * */
-class LocalDirRoute : public Server::iRoute {
+class LocalDirRoute : public Server::iRoute
+                    , public Server::iEndpoint {
 protected:
     const std::string _localPath
                     , _urlPath
                     ;
     std::unordered_map<std::string, std::string> _contentTypes;
     // TODO: include/exclude patterns
+
+    /// Returns response with JSON error description
+    static std::shared_ptr<ResponseMsg> _error(Msg::StatusCode, const char *);
 public:
     LocalDirRoute( const std::string & localPath
                  , const std::string & urlPath
                  , bool defaultContentTypes=true
                  );
+    /// Sets content type for files with given extension (without dot)
     void add_file_type( const std::string & extension
                       , const std::string & contentType );
-    Server::HandleResult try_handle( std::shared_ptr<RequestMsg>, int ) override;
+
+    bool can_handle(const std::string & path, URLParameters &) const override;
+    std::string path_for(const URLParameters &) const override;
+
+    Server::HandleResult handle( const RequestMsg &
+                               , int clientFD
+                               , const URLParameters & ) override;
+    /// Serving files does not change any state
+    ThreadSafety thread_safety() const override { return kConcurrent; }
 };
 
-}  // namespace ::na64dp::util::http
-}  // namespace ::na64dp::util
-}  // namespace na64dp
-#endif
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
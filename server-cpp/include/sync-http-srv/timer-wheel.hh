@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace sync_http_srv {
+namespace util {
+
+/**\brief Hashed timer wheel keeping deadlines of many keys (descriptors)
+ *
+ * Deadlines are rounded up to the wheel resolution and put into the slot
+ * corresponding to their tick, so scheduling and expiration are O(1) per
+ * timer regardless of number of timers. Deadlines further than one wheel
+ * round stay in slot till their round comes.
+ *
+ * Every key has single entry linked into list of its slot; rescheduling
+ * and cancellation move or unlink the entry. Keys are expected to come
+ * from a bounded set (descriptors) -- their entries are retained once
+ * created, so neither scheduling nor expiration allocate afterwards.
+ * */
+class TimerWheel {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef uint64_t Tick;
+private:
+    /// Entry of the key in doubly-linked circular list of slot
+    struct Node {
+        int key;
+        /// Deadline in ticks, zero if timer is not set
+        Tick tick;
+        Node * prev, * next;
+    };
+
+    const Clock::duration _resolution;
+    const Clock::time_point _origin;
+    /// Last processed tick
+    Tick _current;
+    /// Entries of the keys
+    std::unordered_map<int, Node> _nodes;
+    /// Number of active timers
+    size_t _nActive;
+    /// Heads of slots' lists
+    std::vector<Node> _slots;
+    /// Head of list of entries being expired
+    Node _expiring;
+
+    Tick _floor_tick(Clock::time_point) const;
+    /// Makes empty list of the head
+    static void _init(Node & head) { head.prev = head.next = &head; }
+    /// Links node at the end of the list
+    static void _link(Node & head, Node & n)
+        { n.prev = head.prev; n.next = &head; head.prev->next = &n; head.prev = &n; }
+    /// Removes node from its list
+    static void _unlink(Node & n)
+        { n.prev->next = n.next; n.next->prev = n.prev; n.prev = n.next = &n; }
+public:
+    TimerWheel( Clock::duration resolution
+              , size_t nSlots
+              , Clock::time_point origin=Clock::now() );
+    /// Lists refer to heads kept by instance
+    TimerWheel(const TimerWheel &) = delete;
+    TimerWheel & operator=(const TimerWheel &) = delete;
+    ///\brief (Re)schedules deadline of the key
+    ///
+    /// `Clock::time_point::max()` cancels the timer. Deadline in the past
+    /// expires on the next tick.
+    void schedule(int key, Clock::time_point deadline);
+    /// Cancels timer of the key, if any
+    void cancel(int key);
+    /// Returns whether there are no active timers
+    bool empty() const { return !_nActive; }
+    /// Returns number of active timers
+    size_t size() const { return _nActive; }
+    /// Returns milliseconds till the next tick, or -1 if no timers are set
+    int timeout_ms(Clock::time_point now) const;
+    ///\brief Calls `f(key)` for each timer expired by given time and removes it
+    ///
+    /// `f` may schedule and cancel timers.
+    template<typename CallableT> void expire(Clock::time_point now, CallableT f);
+};
+
+template<typename CallableT> void
+TimerWheel::expire(Clock::time_point now, CallableT f) {
+    const Tick nowTick = _floor_tick(now);
+    if(nowTick <= _current) return;
+    // every slot is visited at most once
+    const Tick nTicks = std::min<Tick>(nowTick - _current, _slots.size());
+    for(Tick t = nowTick - nTicks + 1; t <= nowTick; ++t) {
+        Node & head = _slots[t % _slots.size()];
+        if(head.next == &head) continue;
+        // move slot's list aside, so `f()` is free to (re)schedule timers
+        _expiring.next = head.next;
+        _expiring.prev = head.prev;
+        _expiring.next->prev = _expiring.prev->next = &_expiring;
+        _init(head);
+        while(_expiring.next != &_expiring) {
+            Node & n = *_expiring.next;
+            _unlink(n);
+            if(n.tick > nowTick) {
+                _link(head, n);  // expires on one of the next rounds
+                continue;
+            }
+            n.tick = 0;
+            --_nActive;
+            f(n.key);
+        }
+    }
+    _current = nowTick;
+}
+
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,240 @@
+#pragma once
+
+#include "sync-http-srv/session-endpoint.hh"
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/**\brief WebSocket endpoint (RFC 6455)
+ *
+ * Keeps one long-lived connection per client carrying messages both ways:
+ * steering commands from client, data frames (geometry, etc) from server.
+ * Subclass implements `on_message()` and, optionally, `accept()`,
+ * `on_open()` and `on_close()`; messages are sent with `send()` and
+ * `broadcast()`:
+ *
+ *      struct Steering : public WebSocketEndpoint {
+ *          Steering(iJournal & L) : WebSocketEndpoint(L) {}
+ *          void on_message(SessionID id, Opcode, std::string_view cmd) override {
+ *              ...
+ *              send(id, geometryData, kBinary);
+ *          }
+ *      };
+ *
+ * GET request bearing `Upgrade: websocket` is answered with `101 Switching
+ * Protocols`: endpoint writes handshake response itself and takes ownership
+ * over client socket (returns `kKeepClientConnection |
+ * kNoDispatchResponse`), so server drops the connection from its serving
+ * loop. Sessions beyond `maxSessions` are answered by `503 Service
+ * Unavailable`.
+ *
+ * Sessions are served by the endpoint's thread (see `SessionEndpoint`). It
+ * reads and unmasks client frames, reassembles fragmented messages, answers
+ * pings, performs closing handshake and fails connection on protocol
+ * violation. Outgoing messages longer than `maxFrame` are fragmented, so
+ * control frames are interleaved with large data. Session staying silent
+ * for `pingInterval` is pinged and dropped if it does not answer within the
+ * same interval.
+ *
+ * Callbacks are called from the session thread with no lock held, so they
+ * may call `send()`, `broadcast()` and `close()`; `accept()` is called from
+ * the server's serving thread.
+ * */
+class WebSocketEndpoint : public SessionEndpoint {
+public:
+    /// Frame opcodes (RFC 6455, 5.2)
+    enum Opcode : uint8_t {
+        kContinuation = 0x0,
+        kText = 0x1,
+        kBinary = 0x2,
+        kClose = 0x8,
+        kPing = 0x9,
+        kPong = 0xa,
+    };
+    /// Close status codes used by endpoint (RFC 6455, 7.4.1)
+    static constexpr uint16_t kNormalClosure = 1000
+                            , kGoingAway = 1001
+                            , kProtocolError = 1002
+                            , kNoStatus = 1005
+                            , kInvalidPayload = 1007
+                            , kMessageTooBig = 1009
+                            ;
+    /// Session identifier, unique within endpoint
+    typedef uint64_t SessionID;
+protected:
+    /// Established connection
+    struct Session {
+        SessionID id;
+        int fd;
+        /// Remote address, for logging
+        std::string ipStr;
+        /// Received data and number of bytes of it parsed already
+        std::string in;
+        size_t nParsed;
+        /// Data message being reassembled and its opcode
+        /// (`kContinuation` if there is none)
+        std::string message;
+        Opcode messageOpcode;
+        /// Frames queued for dispatch, number of bytes of the front one
+        /// sent already and number of bytes queued
+        std::deque<std::string> out;
+        size_t nSent
+             , nQueued
+             ;
+        /// Number of leading frames data frames are queued after: handshake
+        /// response and control frames
+        size_t nUrgent;
+        /// Time of the last received data
+        Clock::time_point lastReceived;
+        /// Set once ping or close frame is sent
+        bool pingSent
+           , closeSent
+           ;
+        /// Set if session has to be dropped once queued frames are sent,
+        /// and close status to report
+        const char * dropReason;
+        /// Time session is dropped by if close handshake does not complete
+        /// (set once close frame is sent or drop is scheduled)
+        Clock::time_point closeDeadline;
+        uint16_t closeCode;
+        /// Set once `on_open()` is called
+        bool opened;
+    };
+    /// Callback to be called by the session thread with no lock held
+    struct Event {
+        enum { kOpen, kMessage, kClose } type;
+        SessionID id;
+        Opcode opcode;
+        uint16_t closeCode;
+        std::string payload;
+    };
+
+    const size_t _maxSessions
+               , _maxMessage
+               , _maxFrame
+               , _maxBacklog
+               ;
+    const std::chrono::milliseconds _pingInterval;
+
+    /// Sessions, guarded by `_mtx` along with counters
+    std::vector<Session> _sessions;
+    SessionID _lastID;
+    /// Number of messages received and sent
+    size_t _nReceived
+         , _nSent
+         ;
+    /// Callbacks pending, kept by the thread
+    std::vector<Event> _events;
+
+    ///\brief Pings silent sessions, writes queued frames and drops sessions
+    ///
+    /// Closing session is dropped if it is not done within ping interval.
+    /// Calls pending callbacks with lock released; sessions are visited
+    /// again with no wait then, as callbacks may queue messages.
+    Clock::time_point _visit(std::unique_lock<std::mutex> &, Clock::time_point) override;
+    /// Polls sessions for incoming frames and for writing queued ones
+    void _poll_set(std::vector<pollfd> &) const override;
+    /// Receives frames of polled sessions
+    void _on_ready(const pollfd *, size_t) override;
+    /// Returns session by ID, null if there is none; lock must be held
+    Session * _session(SessionID);
+    ///\brief Queues frame(s) of the message
+    ///
+    /// Data messages are fragmented wrt `maxFrame`. Control frames are put
+    /// ahead of data frames not being sent yet, yet after handshake response
+    /// and control frames queued before. Close frame discards data frames
+    /// not being sent yet (RFC 6455, 5.5.1). Lock must be held.
+    void _queue(Session &, Opcode, std::string_view payload);
+    ///\brief Queues close frame and schedules session to be dropped
+    ///
+    /// Lock must be held.
+    void _fail(Session &, uint16_t code, const char * reason);
+    ///\brief Reads and parses frames received by session
+    ///
+    /// Data received by session scheduled to be dropped are discarded.
+    /// Returns `false` if connection is closed by client or broken. Lock
+    /// must be held.
+    bool _receive(Session &, std::vector<Event> &);
+    /// Parses complete frames received, lock must be held
+    void _parse(Session &, std::vector<Event> &);
+    ///\brief Writes queued frames without blocking
+    ///
+    /// Returns `false` if connection is broken (`errno` is set). Lock must
+    /// be held.
+    bool _flush(Session &);
+    /// Closes connection and removes session, lock must be held
+    void _drop(size_t nSession, const char * reason, std::vector<Event> &);
+public:
+    ///\brief Creates endpoint
+    ///
+    /// Messages longer than `maxMessage` bytes make session to be closed
+    /// with `kMessageTooBig` status. Throws `GenericRuntimeError` if wake-up
+    /// descriptor can not be created.
+    WebSocketEndpoint( iJournal &
+                     , size_t maxSessions=64
+                     , size_t maxMessage=16*1024*1024
+                     , std::chrono::milliseconds pingInterval=std::chrono::seconds(30)
+                     , size_t maxFrame=64*1024
+                     , size_t maxBacklog=64*1024*1024 );
+    /// Stops the thread and closes connections
+    ~WebSocketEndpoint();
+
+    /// Returns `Sec-WebSocket-Accept` value for `Sec-WebSocket-Key` one
+    static std::string accept_key(std::string_view key);
+
+    ///\brief Performs opening handshake
+    ///
+    /// Request lacking upgrade headers or of unsupported protocol version
+    /// is answered by `426 Upgrade Required`, malformed one by `400 Bad
+    /// Request`, the one rejected by `accept()` by `403 Forbidden`.
+    Server::HandleResult handle( const RequestMsg &, int clientFD
+                               , const Server::iRoute::URLParameters & ) override;
+    /// Sessions are guarded by lock of its own
+    ThreadSafety thread_safety() const override { return kConcurrent; }
+    /// Sessions are served by the leader shard, which keeps steered state
+    bool steering(const RequestMsg &) const override { return true; }
+
+    ///\brief Decides whether to establish session for the request
+    ///
+    /// Called from the server's serving thread. Default accepts all.
+    virtual bool accept(const RequestMsg &, const Server::iRoute::URLParameters &)
+        { return true; }
+    /// Called once session is established
+    virtual void on_open(SessionID) {}
+    /// Called for every complete text or binary message received
+    virtual void on_message(SessionID, Opcode, std::string_view payload) = 0;
+    ///\brief Called once session is closed
+    ///
+    /// `code` is close status received from client, or `kNoStatus` if
+    /// connection is dropped with no closing handshake.
+    virtual void on_close(SessionID, uint16_t /*code*/) {}
+
+    ///\brief Sends message to the session
+    ///
+    /// Message is queued for dispatch, so call does not block. Returns
+    /// `false` if there is no such session or it is being closed.
+    /// Thread-safe.
+    bool send(SessionID, std::string_view payload, Opcode opcode=kBinary);
+    /// Sends message to all the sessions, message is framed once
+    void broadcast(std::string_view payload, Opcode opcode=kBinary);
+    /// Starts closing handshake of the session
+    void close(SessionID, uint16_t code=kNormalClosure);
+
+    /// Returns number of established sessions
+    size_t n_sessions() const;
+    /// Returns number of messages received
+    size_t n_received() const;
+    /// Returns number of messages sent
+    size_t n_sent() const;
+};
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
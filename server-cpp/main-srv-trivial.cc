@@ -1,7 +1,10 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <sstream>
+#include <cstring>
 
+#include "sync-http-srv/event-stream.hh"
 #include "sync-http-srv/logging.hh"
 #include "sync-http-srv/server.hh"
 namespace web = sync_http_srv::util::http;
@@ -86,8 +89,11 @@ ExampleSubjectState::to_json(std::ostream & os) {
 class ExampleEndpoint : public sync_http_srv::util::http::Server::iEndpoint {
 private:
     ExampleSubjectState & _state;
+    // subscribers of scene updates
+    web::EventStream & _events;
 public:
-    ExampleEndpoint(ExampleSubjectState & state) : _state(state) {}
+    ExampleEndpoint(ExampleSubjectState & state, web::EventStream & events)
+        : _state(state), _events(events) {}
 
     // Handle method supporting only GET and PATCH requests. GET response
     // provides the data of the "current" item, while PATCH will switch
@@ -97,24 +103,51 @@ public:
                 , const web::Server::iRoute::URLParameters & urlParams
                 ) override {
         if(rqMsg.method() == sync_http_srv::util::http::Msg::GET) {
-            // prepare response message
-            auto resp = std::make_shared<web::ResponseMsg>(web::Msg::Ok);
+            // prepare response message; it is allocated in request-scoped
+            // memory released at once after response is sent
+            auto resp = rqMsg.response(web::Msg::Ok);
             resp->set_header("Content-Type", "application/json");
-            // set response content
-            std::ostringstream oss;
-            _state.to_json(oss);
-            resp->content(std::make_shared<web::StringContent>(oss.str()));
+            // set response content, rendered while response is being sent;
+            // state is copied, so PATCH requests arriving meanwhile do not
+            // affect it
+            ExampleSubjectState state(_state);
+            resp->content(rqMsg.allocate<web::GeneratorContent>(
+                    [state](std::ostream & os) mutable {
+                        state.to_json(os);
+                        return false;  // whole scene is written at once
+                    }, rqMsg.memory_resource()));
             // return response
             return {0x0, resp};
         }
         if(rqMsg.method() == sync_http_srv::util::http::Msg::PATCH) {
-            auto resp = std::make_shared<web::ResponseMsg>(web::Msg::NoContent);
+            ++_state.nPage;
+            // push new scene to the viewers, so they do not have to poll
+            std::ostringstream os;
+            _state.to_json(os);
+            _events.publish(os.str(), "scene", std::to_string(_state.nPage));
+            auto resp = rqMsg.response(web::Msg::NoContent);
             // patch suceeded, no response content
             return {0x0, resp};
         }
-        auto resp = std::make_shared<web::ResponseMsg>(web::Msg::MethodNotAllowed);
+        auto resp = rqMsg.response(web::Msg::MethodNotAllowed);
         return {0x0, resp};
     }
+
+    // Scene changes only with the page number, so it versions GET
+    // responses: client polling the scene gets "304 Not Modified" unless
+    // PATCH request advanced the page.
+    uint64_t state_version( const web::RequestMsg &
+                          , const web::Server::iRoute::URLParameters & ) const override
+        { return _state.nPage; }
+
+    // Endpoint shares state object between GET and PATCH, so calls must be
+    // serialized in multi-threaded mode, yet they may run in parallel with
+    // other endpoints.
+    ThreadSafety thread_safety() const override { return kSerialized; }
+
+    // State object is modified by PATCH, so in prefork mode all the requests
+    // have to be served by the leader shard to be consistent.
+    bool steering(const web::RequestMsg &) const override { return true; }
 };
 
 // flag denoting whether server must be kept running
@@ -122,27 +155,60 @@ static bool gDoRunServer = true;
 
 int
 main(int argc, char * argv[]) {
+    sync_http_srv::ConsolePrintJournal log;
     ExampleSubjectState state;  // state to maintain
-    ExampleEndpoint ep(state);
-    web::StringRoute route("scene", "/scene");
+    // Server-Sent Events stream of the scene, up to 64 viewers
+    web::EventStream events(log, 64);
+    ExampleEndpoint ep(state, events);
+    web::StringRoute route("scene", "/scene")
+                   , eventsRoute("scene-events", "/scene/events");
 
     // list of pairs: {iRoute,iEndpoint}
 
     web::Server::Routes routes;
     routes.push_back({&route, &ep});
+    routes.push_back({&eventsRoute, &events});
     // ...
 
-    sync_http_srv::ConsolePrintJournal log;
     auto srv = new web::Server( "localhost"  // hostname to bind socket
             , 5500  // port to listen to
             , log  // logger instance in use
-            , 4  // backlog (max number of connections to maintain)
+            , 128  // backlog (max number of connections to maintain)
             , 60  // timeout
             , 5*1024  // response buffer size
             , 1024*1024  // maximum in-memory content length
             );
+    // `--epoll` makes server multiplex connections instead of serving them
+    // one by one, `--io-uring` does the same with io_uring backend,
+    // `--threads <N>` makes it to serve connections by N threads,
+    // `--prefork <N>` runs N processes sharing the port
+    const bool useEPoll = argc > 1 && !strcmp(argv[1], "--epoll")
+             , useIOURing = argc > 1 && !strcmp(argv[1], "--io-uring");
+    const size_t nThreads = (argc > 2 && !strcmp(argv[1], "--threads"))
+                          ? std::stoul(argv[2]) : 0
+               , nShards = (argc > 2 && !strcmp(argv[1], "--prefork"))
+                          ? std::stoul(argv[2]) : 0;
+    // keep persistent connections for 5 seconds while idle
+    srv->keep_alive(5);
+    // answer with 503 once 256 connections are pending, till their number
+    // drops to 192; at most 32 concurrent requests to the example endpoint
+    srv->admission(256, 192);
+    srv->route_limit(route, 32);
+    // compress scene JSON for clients accepting gzip/deflate
+    srv->compression(route, 512);
+    // viewers of the same page share single serialization of the scene
+    srv->cache(route);
     while(gDoRunServer) {
-        srv->run(routes);
+        if(useEPoll)
+            srv->run_epoll(routes);
+        else if(useIOURing)
+            srv->run_io_uring(routes);
+        else if(nThreads)
+            srv->run_threaded(routes, nThreads);
+        else if(nShards)
+            srv->run_prefork(routes, nShards);
+        else
+            srv->run(routes);
     }
 
     return 0;
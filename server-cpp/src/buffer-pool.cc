@@ -0,0 +1,81 @@
+#include "sync-http-srv/buffer-pool.hh"
+
+#include <cassert>
+
+namespace sync_http_srv {
+namespace util {
+
+BufferPool::BufferPool( size_t blockSize, size_t highWater )
+        : _blockSize(blockSize)
+        , _highWater(highWater)
+        , _nHits(0), _nMisses(0)
+        , _nInUse(0), _peakInUse(0)
+        {
+    assert(_blockSize);
+}
+
+BufferPool::~BufferPool() {
+    assert(!_nInUse);
+    for(char * block : _idle) delete [] block;
+}
+
+char *
+BufferPool::acquire() {
+    const size_t nInUse = ++_nInUse;
+    size_t peak = _peakInUse;
+    while(nInUse > peak && !_peakInUse.compare_exchange_weak(peak, nInUse)) {}
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if(!_idle.empty()) {
+            char * block = _idle.back();
+            _idle.pop_back();
+            ++_nHits;
+            return block;
+        }
+    }
+    ++_nMisses;
+    return new char [_blockSize];
+}
+
+void
+BufferPool::release(char * block) {
+    assert(block);
+    --_nInUse;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if(_idle.size() < _highWater) {
+            _idle.push_back(block);
+            return;
+        }
+    }
+    delete [] block;
+}
+
+size_t
+BufferPool::high_water() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _highWater;
+}
+
+void
+BufferPool::high_water(size_t n) {
+    std::vector<char *> excess;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _highWater = n;
+        if(_idle.size() > n) {
+            excess.assign(_idle.begin() + n, _idle.end());
+            _idle.resize(n);
+        }
+    }
+    for(char * block : excess) delete [] block;
+}
+
+size_t
+BufferPool::n_idle() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _idle.size();
+}
+
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,351 @@
+#include "sync-http-srv/compression.hh"
+#include "sync-http-srv/error.hh"
+#include "strutil.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+//                                                          ___________________
+// _______________________________________________________/ Coding negotiation
+
+namespace {
+/// Parses quality value ("0", "0.5", "1.000") into thousandths, returns
+/// 1000 if value is malformed
+int
+_parse_qvalue(std::string_view s) {
+    if(s.empty() || ('0' != s[0] && '1' != s[0])) return 1000;
+    int q = (s[0] - '0')*1000;
+    if(1 == s.size()) return q;
+    if('.' != s[1] || s.size() > 5) return 1000;
+    int scale = 100;
+    for(size_t i = 2; i < s.size(); ++i, scale /= 10) {
+        if(s[i] < '0' || s[i] > '9') return 1000;
+        q += (s[i] - '0')*scale;
+    }
+    return q > 1000 ? 1000 : q;
+}
+
+/// Returns quality value given by parameters of `Accept-Encoding` entry
+int
+_entry_qvalue(std::string_view params) {
+    while(!params.empty()) {
+        const size_t e = params.find(';');
+        std::string_view p = _trim(params.substr(0, e));
+        params.remove_prefix(std::string_view::npos == e ? params.size() : e + 1);
+        if(_istarts_with(p, "q=")) return _parse_qvalue(_trim(p.substr(2)));
+    }
+    return 1000;
+}
+}  // anonymous namespace
+
+const char *
+to_str(ContentCoding coding) {
+    switch(coding) {
+        case ContentCoding::kGzip: return "gzip";
+        case ContentCoding::kDeflate: return "deflate";
+        default: return "identity";
+    };
+}
+
+ContentCoding
+negotiate_coding(std::string_view acceptEncoding) {
+    // quality values in thousandths, -1 if coding is not listed
+    int qGzip = -1, qDeflate = -1, qAny = -1;
+    while(!acceptEncoding.empty()) {
+        const size_t e = acceptEncoding.find(',');
+        std::string_view entry = acceptEncoding.substr(0, e);
+        acceptEncoding.remove_prefix(std::string_view::npos == e
+                ? acceptEncoding.size() : e + 1);
+        const size_t sc = entry.find(';');
+        std::string_view name = _trim(entry.substr(0, sc));
+        const int q = std::string_view::npos == sc
+                    ? 1000 : _entry_qvalue(entry.substr(sc + 1));
+        if(_iequals("gzip", name) || _iequals("x-gzip", name)) qGzip = q;
+        else if(_iequals("deflate", name)) qDeflate = q;
+        else if("*" == name) qAny = q;
+    }
+    // wildcard applies to codings not listed explicitly
+    if(qGzip < 0) qGzip = qAny < 0 ? 0 : qAny;
+    if(qDeflate < 0) qDeflate = qAny < 0 ? 0 : qAny;
+    if(!qGzip && !qDeflate) return ContentCoding::kIdentity;
+    return qGzip >= qDeflate ? ContentCoding::kGzip : ContentCoding::kDeflate;
+}
+
+namespace {
+/// Returns opaque part of entity tag (without quotes and weakness prefix)
+/// with coding suffix dropped, empty view if tag is malformed
+std::string_view
+_etag_opaque(std::string_view tag) {
+    if(tag.size() > 2 && 'W' == tag[0] && '/' == tag[1]) tag.remove_prefix(2);
+    if(tag.size() < 2 || '"' != tag.front() || '"' != tag.back()) return {};
+    tag = tag.substr(1, tag.size() - 2);
+    for(auto c : {ContentCoding::kGzip, ContentCoding::kDeflate}) {
+        const std::string_view name = to_str(c);
+        if( tag.size() > name.size() + 1 && _iends_with(tag, name)
+         && '-' == tag[tag.size() - name.size() - 1] ) {
+            tag.remove_suffix(name.size() + 1);
+            break;
+        }
+    }
+    return tag;
+}
+}  // anonymous namespace
+
+std::string
+coded_etag(std::string_view etag, ContentCoding coding) {
+    if( ContentCoding::kIdentity == coding || etag.size() < 2
+     || '"' != etag.back() ) return std::string(etag);
+    std::string tag(etag.substr(0, etag.size() - 1));
+    tag.push_back('-');
+    tag.append(to_str(coding));
+    tag.push_back('"');
+    return tag;
+}
+
+bool
+etag_matches(std::string_view ifNoneMatch, std::string_view etag) {
+    const std::string_view opaque = _etag_opaque(etag);
+    if(opaque.empty()) return false;
+    while(!ifNoneMatch.empty()) {
+        const size_t e = ifNoneMatch.find(',');
+        std::string_view tag = _trim(ifNoneMatch.substr(0, e));
+        ifNoneMatch.remove_prefix(std::string_view::npos == e
+                ? ifNoneMatch.size() : e + 1);
+        if("*" == tag || opaque == _etag_opaque(tag)) return true;
+    }
+    return false;
+}
+
+bool
+compressible_type(std::string_view contentType) {
+    std::string_view t = _trim(contentType.substr(0, contentType.find(';')));
+    if(_istarts_with(t, "text/")) return true;
+    if(_iends_with(t, "+json") || _iends_with(t, "+xml")) return true;
+    for(const char * ct : { "application/json", "application/javascript"
+                          , "application/x-javascript", "application/xml"
+                          , "application/yaml", "application/x-yaml"
+                          , "application/wasm", "application/x-ndjson"
+                          }) {
+        if(_iequals(ct, t)) return true;
+    }
+    return false;
+}
+
+#if defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+//                                                           __________________
+// ________________________________________________________/ Deflated content
+
+namespace {
+/// Size of header prepended to blocks allocated for zlib, keeps block size
+constexpr size_t kZAllocHeader = alignof(std::max_align_t);
+}  // anonymous namespace
+
+void *
+DeflateContent::_zalloc(void * mr_, unsigned int nItems, unsigned int size) {
+    auto mr = static_cast<std::pmr::memory_resource *>(mr_);
+    const size_t n = kZAllocHeader + size_t(nItems)*size;
+    char * p;
+    try {
+        p = static_cast<char *>(mr->allocate(n, alignof(std::max_align_t)));
+    } catch( std::bad_alloc & ) {
+        return Z_NULL;
+    }
+    memcpy(p, &n, sizeof(n));
+    return p + kZAllocHeader;
+}
+
+void
+DeflateContent::_zfree(void * mr_, void * ptr) {
+    auto mr = static_cast<std::pmr::memory_resource *>(mr_);
+    char * p = static_cast<char *>(ptr) - kZAllocHeader;
+    size_t n;
+    memcpy(&n, p, sizeof(n));
+    mr->deallocate(p, n, alignof(std::max_align_t));
+}
+
+std::string
+compress(std::string_view data, ContentCoding coding, int level) {
+    assert(ContentCoding::kIdentity != coding);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    const int windowBits = ContentCoding::kGzip == coding ? 15 + 16 : 15;
+    int rc = deflateInit2(&zs, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    if(Z_OK != rc) {
+        throw errors::GenericRuntimeError(util::format("deflateInit2() error:"
+                    " %s", zs.msg ? zs.msg : zError(rc)).c_str());
+    }
+    // gzip wrapper is not accounted by `deflateBound()`
+    std::string out(deflateBound(&zs, data.size()) + 18, '\0');
+    zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    zs.avail_in = data.size();
+    zs.next_out = reinterpret_cast<Bytef *>(out.data());
+    zs.avail_out = out.size();
+    rc = deflate(&zs, Z_FINISH);
+    const size_t n = zs.total_out;
+    deflateEnd(&zs);
+    if(Z_STREAM_END != rc) {
+        throw errors::GenericRuntimeError(util::format("deflate() error: %s"
+                    , zError(rc)).c_str());
+    }
+    out.resize(n);
+    return out;
+}
+
+DeflateContent::DeflateContent( std::shared_ptr<Msg::iContent> src
+                              , ContentCoding coding
+                              , int level
+                              , std::pmr::memory_resource * mr
+                              )
+        : _src(src)
+        , _mr(mr)
+        , _in(nullptr)
+        , _srcRead(0)
+        , _size(0)
+        , _srcExhausted(false)
+        , _finished(false)
+        {
+    assert(_src);
+    assert(ContentCoding::kIdentity != coding);
+    memset(&_zs, 0, sizeof(_zs));
+    _zs.zalloc = _zalloc;
+    _zs.zfree = _zfree;
+    _zs.opaque = _mr;
+    // window bits offset by 16 makes zlib to write gzip wrapper, "deflate"
+    // coding stands for zlib format (RFC 9110, 8.4.1.2)
+    const int windowBits = ContentCoding::kGzip == coding ? 15 + 16 : 15;
+    const int rc = deflateInit2( &_zs, level, Z_DEFLATED, windowBits
+                               , 8, Z_DEFAULT_STRATEGY );
+    if(Z_OK != rc) {
+        throw errors::GenericRuntimeError(util::format("deflateInit2() error:"
+                    " %s", _zs.msg ? _zs.msg : zError(rc)).c_str());
+    }
+}
+
+DeflateContent::~DeflateContent() {
+    deflateEnd(&_zs);
+    if(_in) _mr->deallocate(_in, kInputBufferSize);
+}
+
+void
+DeflateContent::append(const char *, size_t) {
+    throw errors::GenericRuntimeError("Deflated content is read-only.");
+}
+
+size_t
+DeflateContent::copy_to(char *, size_t, size_t) const {
+    throw errors::GenericRuntimeError("Deflated content can not be copied.");
+}
+
+void
+DeflateContent::_feed() {
+    assert(!_zs.avail_in && !_srcExhausted);
+    const char * ptr = nullptr;
+    size_t n = 0;
+    if(_src->streamed()) {
+        if(!_in) _in = static_cast<char *>(_mr->allocate(kInputBufferSize));
+        n = _src->pull(_in, kInputBufferSize);
+        ptr = _in;
+    } else if(_srcRead < _src->size()) {
+        // in-memory data are deflated with no copy
+        n = _src->segment(_srcRead, ptr);
+        if(!n) {
+            if(!_in) _in = static_cast<char *>(_mr->allocate(kInputBufferSize));
+            n = _src->copy_to(_in, kInputBufferSize, _srcRead);
+            ptr = _in;
+        }
+    }
+    if(!n) {
+        _srcExhausted = true;
+        return;
+    }
+    // zlib counts input in `uInt`
+    n = std::min<size_t>(n, 1UL << 30);
+    _srcRead += n;
+    _zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(ptr));
+    _zs.avail_in = n;
+}
+
+size_t
+DeflateContent::pull(char * dest, size_t maxLen) {
+    if(_finished || !maxLen) return 0;
+    _zs.next_out = reinterpret_cast<Bytef *>(dest);
+    _zs.avail_out = maxLen;
+    // buffer is filled entirely unless compressed stream ends
+    while(_zs.avail_out) {
+        if(!_zs.avail_in && !_srcExhausted) _feed();
+        const int rc = deflate(&_zs, _srcExhausted ? Z_FINISH : Z_NO_FLUSH);
+        if(Z_STREAM_END == rc) {
+            _finished = true;
+            break;
+        }
+        if(Z_OK != rc && Z_BUF_ERROR != rc) {
+            throw errors::GenericRuntimeError(util::format("deflate() error:"
+                        " %s", _zs.msg ? _zs.msg : zError(rc)).c_str());
+        }
+    }
+    const size_t n = maxLen - _zs.avail_out;
+    _size += n;
+    return n;
+}
+#endif  // defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+
+//                                                       ______________________
+// ____________________________________________________/ Server-side settings
+
+void
+Server::compression(const iRoute & route, size_t minSize, int level) {
+    #if defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+    _routeCompression[&route] = RouteCompression{minSize, level};
+    #else
+    (void) minSize;
+    (void) level;
+    _L.warn(util::format("Server is built without zlib, responses of route"
+                " \"%s\" will not be compressed.", route.name.c_str()).c_str());
+    #endif
+}
+
+void
+Server::_compress( const RequestMsg & rq
+                 , ResponseMsg & rp
+                 , const RouteCompression & c ) const {
+    #if defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+    const int code = rp.status_code();
+    if( !rp.has_content() || code < 200
+     || Msg::NoContent == code || Msg::NotModified == code ) return;
+    // endpoint encoded content on its own
+    if(!rp.get_header_view("content-encoding").empty()) return;
+    if(!compressible_type(rp.get_header_view("content-type"))) return;
+    // representation depends on request header, caches must respect it
+    std::string_view vary = rp.get_header_view("vary");
+    if(vary.empty()) {
+        rp.set_header("vary", "Accept-Encoding");
+    } else if(!_icontains(vary, "accept-encoding")) {
+        rp.set_header("vary", std::string(vary) + ", Accept-Encoding");
+    }
+    auto content = rp.content();
+    if(!content->streamed() && content->size() < c.minSize) return;
+    const ContentCoding coding = negotiate_coding(rq.get_header_view("accept-encoding"));
+    if(ContentCoding::kIdentity == coding) return;
+    rp.content(rq.allocate<DeflateContent>( content, coding, c.level
+                                          , rq.memory_resource() ));
+    rp.set_header("content-encoding", to_str(coding));
+    std::string_view etag = rp.get_header_view("etag");
+    if(!etag.empty()) rp.set_header("etag", coded_etag(etag, coding));
+    // length of compressed content is not known in advance
+    rp.erase_header("content-length");
+    #else
+    (void) rq;
+    (void) rp;
+    (void) c;
+    #endif
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,305 @@
+#include "sync-http-srv/connection.hh"
+
+#include <cstring>
+#include <cassert>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+Connection::Connection( int fd
+                      , const sockaddr_in & clientAddr
+                      , iJournal & L
+                      , char * recvBuffer
+                      , char * respBuffer
+                      , char * arenaBuffer
+                      , size_t ioBufSize
+                      , size_t maxInMemContentLen
+                      )
+        : _fd(fd)
+        , _L(L)
+        , _recvBuffer(recvBuffer)
+        , _respBuffer(respBuffer)
+        , _ioBufSize(ioBufSize)
+        , _pool(nullptr)
+        , _maxInMemContentLen(maxInMemContentLen)
+        , _nInRecvBuf(0)
+        , _nBytesReceived(0)
+        , _handedFD(-1)
+        , _state(kReceiving)
+        , _execFlags(0x0)
+        , _keepAlive(false)
+        , _nServed(0)
+        , _idleSince(std::chrono::steady_clock::now())
+        , _requestSince(_idleSince)
+        , _lastSent(_idleSince)
+        , _inFlight(nullptr)
+        , _arena(arenaBuffer, kArenaBufferSize)
+        {
+    assert(_recvBuffer);
+    assert(_respBuffer);
+    assert(arenaBuffer);
+    struct in_addr ipAddr = clientAddr.sin_addr;
+    inet_ntop( AF_INET, &ipAddr, _ipStr, INET_ADDRSTRLEN );
+}
+
+Connection::Connection( int fd
+                      , const sockaddr_in & clientAddr
+                      , iJournal & L
+                      , util::BufferPool & pool
+                      , size_t ioBufSize
+                      , size_t maxInMemContentLen
+                      )
+        : _fd(fd)
+        , _L(L)
+        , _recvBuffer(pool.acquire() + kPooledObjectSize)
+        , _respBuffer(_recvBuffer + ioBufSize)
+        , _ioBufSize(ioBufSize)
+        , _pool(&pool)
+        , _maxInMemContentLen(maxInMemContentLen)
+        , _nInRecvBuf(0)
+        , _nBytesReceived(0)
+        , _handedFD(-1)
+        , _state(kReceiving)
+        , _execFlags(0x0)
+        , _keepAlive(false)
+        , _nServed(0)
+        , _idleSince(std::chrono::steady_clock::now())
+        , _requestSince(_idleSince)
+        , _lastSent(_idleSince)
+        , _inFlight(nullptr)
+        , _arena(_respBuffer + ioBufSize, kArenaBufferSize)
+        {
+    assert(pool.block_size() >= pooled_block_size(ioBufSize));
+    struct in_addr ipAddr = clientAddr.sin_addr;
+    inet_ntop( AF_INET, &ipAddr, _ipStr, INET_ADDRSTRLEN );
+}
+
+Connection::Connection( int fd
+                      , const sockaddr_in & clientAddr
+                      , iJournal & L
+                      , size_t ioBufSize
+                      , size_t maxInMemContentLen
+                      )
+        : _fd(fd)
+        , _L(L)
+        , _recvBuffer(new char [2*ioBufSize + kArenaBufferSize])
+        , _respBuffer(_recvBuffer + ioBufSize)
+        , _ioBufSize(ioBufSize)
+        , _ownBlock(_recvBuffer)
+        , _pool(nullptr)
+        , _maxInMemContentLen(maxInMemContentLen)
+        , _nInRecvBuf(0)
+        , _nBytesReceived(0)
+        , _handedFD(-1)
+        , _state(kReceiving)
+        , _execFlags(0x0)
+        , _keepAlive(false)
+        , _nServed(0)
+        , _idleSince(std::chrono::steady_clock::now())
+        , _requestSince(_idleSince)
+        , _lastSent(_idleSince)
+        , _inFlight(nullptr)
+        , _arena(_respBuffer + ioBufSize, kArenaBufferSize)
+        {
+    struct in_addr ipAddr = clientAddr.sin_addr;
+    inet_ntop( AF_INET, &ipAddr, _ipStr, INET_ADDRSTRLEN );
+}
+
+Connection::~Connection() {
+    if(_inFlight) --(*_inFlight);
+    if(_handedFD >= 0) ::close(_handedFD);
+    // arena objects are released before the arena
+    _sender.reset();
+    _parser.reset();
+    _rp.reset();
+    _rq.reset();
+    if(_pool) {
+        _arena.release();
+        _pool->release(_recvBuffer - kPooledObjectSize);
+    }
+}
+
+Connection *
+Connection::create( int fd
+                  , const sockaddr_in & clientAddr
+                  , iJournal & L
+                  , util::BufferPool & pool
+                  , size_t ioBufSize
+                  , size_t maxInMemContentLen
+                  ) {
+    static_assert(kBlockHeaderSize >= sizeof(util::BufferPool *)
+            && kBlockHeaderSize + sizeof(Connection) <= kPooledObjectSize
+            , "Connection object does not fit pooled block");
+    assert(pool.block_size() >= pooled_block_size(ioBufSize));
+    char * block = pool.acquire();
+    *reinterpret_cast<util::BufferPool **>(block) = &pool;
+    char * bufs = block + kPooledObjectSize;
+    try {
+        return ::new(block + kBlockHeaderSize) Connection( fd, clientAddr, L
+                , bufs, bufs + ioBufSize, bufs + 2*ioBufSize
+                , ioBufSize, maxInMemContentLen );
+    } catch(...) {
+        pool.release(block);
+        throw;
+    }
+}
+
+void *
+Connection::operator new(size_t n) {
+    char * block = static_cast<char *>(::operator new(kBlockHeaderSize + n));
+    *reinterpret_cast<util::BufferPool **>(block) = nullptr;
+    return block + kBlockHeaderSize;
+}
+
+void
+Connection::operator delete(void * p) {
+    if(!p) return;
+    char * block = static_cast<char *>(p) - kBlockHeaderSize;
+    util::BufferPool * pool = *reinterpret_cast<util::BufferPool **>(block);
+    if(pool) pool->release(block);
+    else ::operator delete(block);
+}
+
+ssize_t
+Connection::_recv(char * dest, size_t n) {
+    // never block, so caller may wait for data with respect to deadline
+    return ::recv(_fd, dest, n, MSG_DONTWAIT);
+}
+
+bool
+Connection::receive(size_t maxContentLen) {
+    assert(kReceiving == _state);
+    if(!_rq) {
+        _rq = std::allocate_shared<RequestMsg>(
+                std::pmr::polymorphic_allocator<RequestMsg>(&_arena), &_arena);
+        _rq->client_ip(_ipStr);
+        _parser.emplace(*_rq, _maxInMemContentLen, maxContentLen);
+    }
+    while(true) {
+        if(_nInRecvBuf) {
+            size_t used = _parser->feed(_recvBuffer, _nInRecvBuf, _L);
+            if(used) {
+                memmove(_recvBuffer, _recvBuffer + used, _nInRecvBuf - used);
+                _nInRecvBuf -= used;
+            }
+        }
+        if(_parser->done()) break;
+        if(_nInRecvBuf == _ioBufSize) {
+            // header line does not fit the buffer
+            throw errors::RequestHeaderIsTooLong();
+        }
+        ssize_t len;
+        if(_handedFD >= 0) {
+            // data handed over along with connection precede the ones
+            // arriving to socket
+            len = ::read(_handedFD, _recvBuffer + _nInRecvBuf, _ioBufSize - _nInRecvBuf);
+            if(0 == len) {
+                ::close(_handedFD);
+                _handedFD = -1;
+                continue;
+            }
+        } else {
+            len = _recv( _recvBuffer + _nInRecvBuf
+                       , _ioBufSize - _nInRecvBuf
+                       );
+        }
+        if(0 == len) {
+            if(0 == _nBytesReceived)
+                _L.debug( "Client closed connection with no data sent." );
+            throw errors::ClientClosedConnection();
+        } else if(len < 0) {
+            int en = errno;
+            if( en == EINTR ) continue;
+            if( en == EAGAIN || en == EWOULDBLOCK ) return false;
+            _L.warn(util::format("recv() error: %s", strerror(en)).c_str());
+            throw errors::ClientSocketError(strerror(en));
+        }
+        if(!_nBytesReceived) _requestSince = std::chrono::steady_clock::now();
+        _nInRecvBuf += len;
+        _nBytesReceived += len;
+    }
+    _parser.reset();
+    _state = kHandling;
+    return true;
+}
+
+void
+Connection::prefill(const char * data, size_t n) {
+    assert(kReceiving == _state);
+    if(_nInRecvBuf + n > _ioBufSize)
+        throw errors::RequestHeaderIsTooLong();
+    memcpy(_recvBuffer + _nInRecvBuf, data, n);
+    if(!_nBytesReceived) _requestSince = std::chrono::steady_clock::now();
+    _nInRecvBuf += n;
+    _nBytesReceived += n;
+}
+
+void
+Connection::prefill(int fd) {
+    assert(kReceiving == _state);
+    assert(_handedFD < 0);
+    _handedFD = fd;
+    if(!_nBytesReceived) _requestSince = std::chrono::steady_clock::now();
+}
+
+void
+Connection::respond(std::shared_ptr<ResponseMsg> rp) {
+    assert(rp);
+    _rp = rp;
+    _sender.emplace(*_rp, &_arena);
+    _lastSent = std::chrono::steady_clock::now();
+    _state = kSending;
+}
+
+bool
+Connection::send() {
+    assert(kSending == _state);
+    assert(_sender);
+    const size_t nSent = _sender->bytes_sent();
+    const bool done = _sender->send_some(_fd, _respBuffer, _ioBufSize, _L);
+    if(_sender->bytes_sent() != nSent) _lastSent = std::chrono::steady_clock::now();
+    if(!done) return false;
+    _state = kDone;
+    return true;
+}
+
+void
+Connection::reset() {
+    assert(kDone == _state || kHandling == _state);
+    _sender.reset();
+    _parser.reset();
+    _rp.reset();
+    _rq.reset();
+    _arena.release();
+    if(_inFlight) {
+        --(*_inFlight);
+        _inFlight = nullptr;
+    }
+    // data of pipelined request(s) are already received
+    _nBytesReceived = _nInRecvBuf;
+    _idleSince = _requestSince = std::chrono::steady_clock::now();
+    _execFlags = 0x0;
+    _keepAlive = false;
+    ++_nServed;
+    _state = kReceiving;
+}
+
+void
+Connection::hold(std::atomic<size_t> & inFlight) {
+    assert(!_inFlight);
+    _inFlight = &inFlight;
+}
+
+void
+Connection::sent(size_t n) {
+    assert(kSending == _state);
+    _sender->advance(n);
+    if(n) _lastSent = std::chrono::steady_clock::now();
+    if(_sender->done()) _state = kDone;
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
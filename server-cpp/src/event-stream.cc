@@ -0,0 +1,234 @@
+#include "sync-http-srv/event-stream.hh"
+#include "sync-http-srv/error.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+EventStream::EventStream( iJournal & L
+                        , size_t maxSubscribers
+                        , std::chrono::milliseconds heartbeat
+                        , size_t maxBacklog )
+        : SessionEndpoint(L, "event stream")
+        , _maxSubscribers(maxSubscribers)
+        , _maxBacklog(maxBacklog)
+        , _heartbeat(heartbeat)
+        , _nPublished(0)
+        , _nLagging(0)
+        {}
+
+EventStream::~EventStream() {
+    _halt();
+    for(const Subscriber & s : _subscribers) ::close(s.fd);
+}
+
+void
+EventStream::header(std::string_view name, std::string_view value) {
+    for(char c : name) _head.push_back(std::tolower(static_cast<unsigned char>(c)));
+    _head.append(": ").append(value).append("\r\n");
+}
+
+Server::HandleResult
+EventStream::handle( const RequestMsg & rq, int clientFD
+                   , const Server::iRoute::URLParameters & ) {
+    if(Msg::GET != rq.method()) {
+        auto rp = rq.response(Msg::MethodNotAllowed);
+        rp->set_header("allow", "GET");
+        rp->set_header("content-length", "0");
+        return {0x0, rp};
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_subscribers.size() >= _maxSubscribers) {
+        _L.warn(util::format("Event stream has %zu subscriber(s) already,"
+                    " subscription rejected.", _subscribers.size()).c_str());
+        auto rp = rq.response(Msg::ServiceUnvailable);
+        rp->set_header("content-type", "application/json");
+        rp->set_header("retry-after", "5");
+        rp->content(std::make_shared<StringContent>(
+                    "{\"errors\":[\"Too many event stream subscribers.\"]}"));
+        return {0x0, rp};
+    }
+    // socket is served by stream thread from now on
+    Subscriber s;
+    s.ipStr = _take_over(clientFD);
+    s.fd = clientFD;
+    s.nSent = 0;
+    s.lastSent = Clock::now();
+    s.dropReason = nullptr;
+    // response is delimited by closing connection
+    s.pending.append(Msg::status_line(Msg::Ok))
+             .append("content-type: text/event-stream\r\n"
+                     "cache-control: no-cache\r\n")
+             .append(rq.common_headers())
+             .append(_head)
+             .append("\r\n");
+    _L.debug(util::format("Client %s subscribed to event stream."
+                , s.ipStr.c_str()).c_str());
+    _subscribers.push_back(std::move(s));
+    _start();
+    return {Server::kKeepClientConnection | Server::kNoDispatchResponse, nullptr};
+}
+
+std::string
+EventStream::format( std::string_view data
+                   , std::string_view event
+                   , std::string_view id ) {
+    std::string out;
+    // fields can not span lines
+    id = id.substr(0, id.find_first_of("\r\n"));
+    event = event.substr(0, event.find_first_of("\r\n"));
+    if(!id.empty()) out.append("id: ").append(id).push_back('\n');
+    if(!event.empty()) out.append("event: ").append(event).push_back('\n');
+    do {
+        const size_t e = data.find('\n');
+        std::string_view line = data.substr(0, e);
+        if(!line.empty() && '\r' == line.back()) line.remove_suffix(1);
+        out.append("data: ").append(line).push_back('\n');
+        data.remove_prefix(std::string_view::npos == e ? data.size() : e + 1);
+    } while(!data.empty());
+    out.push_back('\n');
+    return out;
+}
+
+void
+EventStream::publish( std::string_view data
+                    , std::string_view event
+                    , std::string_view id ) {
+    const std::string ev = format(data, event, id);
+    std::lock_guard<std::mutex> lock(_mtx);
+    ++_nPublished;
+    if(_subscribers.empty()) return;
+    for(Subscriber & s : _subscribers) {
+        if(s.dropReason) continue;
+        if(s.pending.size() - s.nSent + ev.size() > _maxBacklog) {
+            s.dropReason = "client lags behind";
+            ++_nLagging;
+            continue;
+        }
+        s.pending.append(ev);
+    }
+    _wake();
+}
+
+void
+EventStream::close_all() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_subscribers.empty()) return;
+    for(Subscriber & s : _subscribers) {
+        if(!s.dropReason) s.dropReason = "stream closed";
+    }
+    _wake();
+}
+
+bool
+EventStream::_flush(Subscriber & s) {
+    while(s.nSent < s.pending.size()) {
+        const ssize_t n = ::send( s.fd, s.pending.data() + s.nSent
+                                , s.pending.size() - s.nSent
+                                , MSG_DONTWAIT | MSG_NOSIGNAL );
+        if(n < 0) {
+            if(EINTR == errno) continue;
+            if(EAGAIN != errno && EWOULDBLOCK != errno) return false;
+            // socket buffer is full, keep the rest
+            if(s.nSent > s.pending.size()/2) {
+                s.pending.erase(0, s.nSent);
+                s.nSent = 0;
+            }
+            return true;
+        }
+        s.nSent += n;
+        s.lastSent = Clock::now();
+    }
+    s.pending.clear();
+    s.nSent = 0;
+    return true;
+}
+
+void
+EventStream::_drop(size_t nSubscriber, const char * reason) {
+    assert(nSubscriber < _subscribers.size());
+    const Subscriber & s = _subscribers[nSubscriber];
+    _L.debug(util::format("Event stream subscriber %s dropped: %s."
+                , s.ipStr.c_str(), reason).c_str());
+    ::close(s.fd);
+    _subscribers.erase(_subscribers.begin() + nSubscriber);
+}
+
+EventStream::Clock::time_point
+EventStream::_visit(std::unique_lock<std::mutex> &, Clock::time_point now) {
+    Clock::time_point nextBeat = Clock::time_point::max();
+    for(size_t i = 0; i < _subscribers.size(); ) {
+        Subscriber & s = _subscribers[i];
+        if(s.dropReason) {
+            _drop(i, s.dropReason);
+            continue;
+        }
+        // comment line keeps silent stream alive
+        if(s.pending.empty() && now - s.lastSent >= _heartbeat)
+            s.pending.assign(":\n\n");
+        if(!_flush(s)) {
+            _drop(i, strerror(errno));
+            continue;
+        }
+        if(s.pending.empty())
+            nextBeat = std::min(nextBeat, s.lastSent + _heartbeat);
+        ++i;
+    }
+    return nextBeat;
+}
+
+void
+EventStream::_poll_set(std::vector<pollfd> & pfds) const {
+    for(const Subscriber & s : _subscribers) {
+        // client is not expected to send anything, readability means it
+        // has closed connection
+        pfds.push_back(pollfd{ s.fd
+                , static_cast<short>(POLLIN | (s.pending.empty() ? 0 : POLLOUT)), 0 });
+    }
+}
+
+void
+EventStream::_on_ready(const pollfd * pfds, size_t n) {
+    // reverse order keeps indices of polled subscribers valid on removal
+    for(size_t i = n; i-- > 0; ) {
+        if(!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        assert(_subscribers[i].fd == pfds[i].fd);
+        char bf[512];
+        ssize_t r;
+        while((r = ::recv(pfds[i].fd, bf, sizeof(bf), MSG_DONTWAIT)) > 0
+                || (r < 0 && EINTR == errno)) {}
+        if(0 == r || (EAGAIN != errno && EWOULDBLOCK != errno)
+                  || (pfds[i].revents & (POLLHUP | POLLERR))) {
+            _drop(i, "client closed connection");
+        }
+    }
+}
+
+size_t
+EventStream::n_subscribers() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _subscribers.size();
+}
+
+size_t
+EventStream::n_published() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nPublished;
+}
+
+size_t
+EventStream::n_lagging() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nLagging;
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -24,5 +24,30 @@ void ConsolePrintJournal::error(const char * msg) {
     std::cout << msg << std::endl;
 }
 
+bool PrefixedJournal::debug_enabled() const {
+    return _dest.debug_enabled();
+}
+
+void PrefixedJournal::debug(const char * msg) {
+    if(!_dest.debug_enabled()) return;
+    std::lock_guard<std::mutex> lock(_mtx);
+    _dest.debug((_prefix + msg).c_str());
+}
+
+void PrefixedJournal::info(const char * msg) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _dest.info((_prefix + msg).c_str());
+}
+
+void PrefixedJournal::warn(const char * msg) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _dest.warn((_prefix + msg).c_str());
+}
+
+void PrefixedJournal::error(const char * msg) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _dest.error((_prefix + msg).c_str());
+}
+
 }  // namespace sync_http_srv
 
@@ -0,0 +1,291 @@
+#include "sync-http-srv/ranges.hh"
+#include "sync-http-srv/error.hh"
+#include "strutil.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <charconv>
+#include <cstring>
+#include <limits>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+//                                                         ____________________
+// ______________________________________________________/ Range header parser
+
+namespace {
+/// Parses non-empty decimal number, returns `false` on failure or overflow
+bool
+_parse_size(std::string_view s, size_t & n) {
+    if(s.empty()) return false;
+    auto r = std::from_chars(s.data(), s.data() + s.size(), n);
+    return std::errc() == r.ec && r.ptr == s.data() + s.size();
+}
+}  // anonymous namespace
+
+RangesParse
+parse_ranges( std::string_view value, size_t contentSize
+            , std::pmr::vector<ByteRange> & ranges
+            , size_t maxRanges ) {
+    ranges.clear();
+    // ranges parsed before malformed specification are not kept
+    auto ignored = [&ranges]() {
+        ranges.clear();
+        return RangesParse::kIgnored;
+    };
+    value = _trim(value);
+    // range unit is case-insensitive
+    if(value.size() < 6 || !_istarts_with(value, "bytes")) return ignored();
+    value = _trim(value.substr(5));
+    if(value.empty() || '=' != value.front()) return ignored();
+    value.remove_prefix(1);
+    size_t nSpecs = 0;
+    while(!value.empty()) {
+        const size_t e = value.find(',');
+        std::string_view spec = _trim(value.substr(0, e));
+        value.remove_prefix(std::string_view::npos == e ? value.size() : e + 1);
+        if(spec.empty()) continue;  // empty list elements are allowed
+        if(++nSpecs > maxRanges) return ignored();
+        const size_t dash = spec.find('-');
+        if(std::string_view::npos == dash) return ignored();
+        size_t first, last;
+        if(0 == dash) {
+            // suffix range: last N bytes
+            size_t n;
+            if(!_parse_size(spec.substr(1), n)) return ignored();
+            if(!n || !contentSize) continue;
+            first = n < contentSize ? contentSize - n : 0;
+            last = contentSize - 1;
+        } else {
+            if(!_parse_size(spec.substr(0, dash), first)) return ignored();
+            if(dash + 1 == spec.size()) {
+                last = SIZE_MAX;
+            } else if( !_parse_size(spec.substr(dash + 1), last) || last < first ) {
+                return ignored();
+            }
+            if(first >= contentSize) continue;
+            last = std::min(last, contentSize - 1);
+        }
+        ranges.push_back(ByteRange{first, last});
+    }
+    if(!nSpecs) return ignored();
+    if(ranges.empty()) return RangesParse::kUnsatisfiable;
+    // coalesce overlapping and adjoining ranges
+    std::sort(ranges.begin(), ranges.end()
+             , [](const ByteRange & a, const ByteRange & b) { return a.first < b.first; });
+    size_t n = 0;
+    for(size_t i = 1; i < ranges.size(); ++i) {
+        if(ranges[i].first <= ranges[n].last + 1) {
+            ranges[n].last = std::max(ranges[n].last, ranges[i].last);
+        } else {
+            ranges[++n] = ranges[i];
+        }
+    }
+    ranges.resize(n + 1);
+    return RangesParse::kSatisfiable;
+}
+
+//                                                         ____________________
+// ______________________________________________________/ Composite content
+
+CompositeContent::CompositeContent(std::pmr::memory_resource * mr)
+        : _pieces(mr)
+        , _text(mr)
+        , _size(0)
+        {}
+
+void
+CompositeContent::add_slice( std::shared_ptr<Msg::iContent> src
+                           , size_t from, size_t length ) {
+    assert(src && !src->streamed());
+    assert(from + length <= src->size());
+    if(!length) return;
+    _pieces.push_back(Piece{src, from, _size, length});
+    _size += length;
+}
+
+void
+CompositeContent::add_text(std::string_view text) {
+    if(text.empty()) return;
+    // adjacent fragments are merged
+    if(!_pieces.empty() && !_pieces.back().src) {
+        _pieces.back().length += text.size();
+    } else {
+        _pieces.push_back(Piece{nullptr, _text.size(), _size, text.size()});
+    }
+    _text.append(text);
+    _size += text.size();
+}
+
+void
+CompositeContent::append(const char *, size_t) {
+    throw errors::GenericRuntimeError("Composite content can not be appended.");
+}
+
+const CompositeContent::Piece &
+CompositeContent::_piece(size_t from) const {
+    assert(from < _size);
+    auto it = std::upper_bound( _pieces.begin(), _pieces.end(), from
+                              , [](size_t o, const Piece & p) { return o < p.offset; } );
+    return *(it - 1);
+}
+
+size_t
+CompositeContent::copy_to(char * dest, size_t maxLen, size_t from) const {
+    if(from >= _size) {
+        throw errors::GenericRuntimeError(util::format("Can not copy up to %zu"
+                " bytes from composite content of length %zu from %zu-th byte."
+                , maxLen, _size, from).c_str());
+    }
+    const Piece & p = _piece(from);
+    const size_t inPiece = from - p.offset;
+    const size_t len = std::min(maxLen, p.length - inPiece);
+    if(!p.src) {
+        memcpy(dest, _text.data() + p.srcOffset + inPiece, len);
+        return len;
+    }
+    return p.src->copy_to(dest, len, p.srcOffset + inPiece);
+}
+
+size_t
+CompositeContent::segment(size_t from, const char *& ptr) const {
+    ptr = nullptr;
+    if(from >= _size) return 0;
+    const Piece & p = _piece(from);
+    const size_t inPiece = from - p.offset;
+    if(!p.src) {
+        ptr = _text.data() + p.srcOffset + inPiece;
+        return p.length - inPiece;
+    }
+    const size_t len = p.src->segment(p.srcOffset + inPiece, ptr);
+    return std::min(len, p.length - inPiece);
+}
+
+size_t
+CompositeContent::file_region(size_t from, int & fd, off_t & offset) const {
+    fd = -1;
+    offset = 0;
+    if(from >= _size) return 0;
+    const Piece & p = _piece(from);
+    if(!p.src) return 0;
+    const size_t inPiece = from - p.offset;
+    const size_t len = p.src->file_region(p.srcOffset + inPiece, fd, offset);
+    return std::min(len, p.length - inPiece);
+}
+
+//                                                     ________________________
+// __________________________________________________/ Server-side range stage
+
+namespace {
+/// Maximum number of decimal digits of size
+constexpr size_t kSizeDigits = std::numeric_limits<size_t>::digits10 + 1;
+/// Buffer for `Content-Range` value
+typedef char ContentRangeBuffer[sizeof("bytes -/") + 3*kSizeDigits];
+
+/// Formats `bytes first-last/size` (or `bytes */size` if range is null)
+std::string_view
+_content_range(ContentRangeBuffer & bf, const ByteRange * r, size_t size) {
+    // every number is given room of its own, so writes are in bounds
+    char * e = bf;
+    memcpy(e, "bytes ", 6);
+    e += 6;
+    if(r) {
+        e = std::to_chars(e, e + kSizeDigits, r->first).ptr;
+        *e++ = '-';
+        e = std::to_chars(e, e + kSizeDigits, r->last).ptr;
+    } else {
+        *e++ = '*';
+    }
+    *e++ = '/';
+    e = std::to_chars(e, e + kSizeDigits, size).ptr;
+    return std::string_view(bf, e - bf);
+}
+
+/// Returns whether `If-Range` value matches the response (RFC 9110, 13.1.5)
+bool
+_if_range_matches(std::string_view ifRange, const ResponseMsg & rp) {
+    ifRange = _trim(ifRange);
+    if(ifRange.empty()) return true;
+    if('"' == ifRange.front() || 0 == ifRange.find("W/")) {
+        // strong comparison: weak tags never match
+        std::string_view etag = rp.get_header_view("etag");
+        return '"' == ifRange.front() && ifRange == etag;
+    }
+    std::string_view lastModified = rp.get_header_view("last-modified");
+    return !lastModified.empty() && ifRange == lastModified;
+}
+}  // anonymous namespace
+
+void
+Server::_ranges(const RequestMsg & rq, std::shared_ptr<ResponseMsg> & rp) {
+    if( Msg::GET != rq.method() || Msg::Ok != rp->status_code()
+     || !rp->has_content() ) return;
+    const std::shared_ptr<Msg::iContent> content = rp->content();
+    if(content->streamed()) return;  // can not seek in streamed content
+    rp->set_header("accept-ranges", "bytes");
+    std::string_view rangeHeader = rq.get_header_view("range");
+    if(rangeHeader.empty()) return;
+    if(!_if_range_matches(rq.get_header_view("if-range"), *rp)) return;
+    const size_t size = content->size();
+    std::pmr::vector<ByteRange> ranges(rq.memory_resource());
+    ContentRangeBuffer bf;
+    switch(parse_ranges(rangeHeader, size, ranges)) {
+        case RangesParse::kIgnored:
+            return;
+        case RangesParse::kUnsatisfiable: {
+            auto nrp = rq.response(Msg::RangeNotSatisfiable);
+            nrp->set_header("content-range", _content_range(bf, nullptr, size));
+            // no content, yet it must be delimited for persistent connection
+            nrp->set_header("content-length", "0");
+            rp = nrp;
+            return;
+        }
+        case RangesParse::kSatisfiable:
+            break;
+    };
+    auto parts = rq.allocate<CompositeContent>(rq.memory_resource());
+    if(1 == ranges.size()) {
+        rp->set_header("content-range", _content_range(bf, &ranges[0], size));
+        parts->add_slice(content, ranges[0].first, ranges[0].length());
+    } else {
+        // boundary is unique enough to not be met in data of the parts
+        static std::atomic<uint64_t> gNBoundary(0);
+        char boundary[sizeof("sync-http-srv--") + 2*kSizeDigits], * e = boundary;
+        memcpy(e, "sync-http-srv-", 14);
+        e += 14;
+        e = std::to_chars(e, e + kSizeDigits
+                         , reinterpret_cast<uintptr_t>(parts.get())).ptr;
+        *e++ = '-';
+        e = std::to_chars(e, e + kSizeDigits, ++gNBoundary, 16).ptr;
+        const std::string_view boundaryView(boundary, e - boundary);
+        // parts are framed in request arena, as the content itself
+        const std::string_view contentType = rp->get_header_view("content-type");
+        std::pmr::string part(rq.memory_resource());
+        for(const ByteRange & r : ranges) {
+            part.clear();
+            if(!parts->size()) part.append("--");
+            else part.append("\r\n--");
+            part.append(boundaryView).append("\r\n");
+            if(!contentType.empty())
+                part.append("content-type: ").append(contentType).append("\r\n");
+            part.append("content-range: ").append(_content_range(bf, &r, size))
+                .append("\r\n\r\n");
+            parts->add_text(part);
+            parts->add_slice(content, r.first, r.length());
+        }
+        part.assign("\r\n--").append(boundaryView).append("--\r\n");
+        parts->add_text(part);
+        part.assign("multipart/byteranges; boundary=").append(boundaryView);
+        rp->set_header("content-type", part);
+    }
+    rp->status_code(Msg::PartialContent);
+    rp->erase_header("content-length");
+    rp->content(parts);
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,179 @@
+#include "sync-http-srv/representation-cache.hh"
+#include "sync-http-srv/compression.hh"
+#include "sync-http-srv/error.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+namespace {
+/// Reads content entirely
+std::string
+_read_content(Msg::iContent & c) {
+    std::string data;
+    if(c.streamed()) {
+        char bf[16*1024];
+        size_t n;
+        while((n = c.pull(bf, sizeof(bf)))) data.append(bf, n);
+        return data;
+    }
+    data.resize(c.size());
+    for(size_t from = 0; from < data.size(); ) {
+        const char * ptr;
+        size_t n = c.segment(from, ptr);
+        if(n) memcpy(data.data() + from, ptr, n);
+        else n = c.copy_to(data.data() + from, data.size() - from, from);
+        if(!n) {
+            throw errors::GenericRuntimeError(util::format("Content is"
+                        " truncated at %zu of %zu bytes.", from, data.size()).c_str());
+        }
+        from += n;
+    }
+    return data;
+}
+
+/// Returns whether header is set by server on dispatch
+bool
+_is_dispatch_header(std::string_view name) {
+    return "content-length" == name || "transfer-encoding" == name
+        || "connection" == name || "keep-alive" == name;
+}
+}  // anonymous namespace
+
+size_t
+RepresentationCache::Representation::n_bytes() const {
+    return identity->size() + (gzip ? gzip->size() : 0);
+}
+
+RepresentationCache::RepresentationCache() : _nBytes(0), _nHits(0), _nMisses(0) {}
+
+std::string
+RepresentationCache::key( const Server::iRoute::URLParameters & urlParams
+                        , std::string_view queryString ) {
+    // parameters are ordered, so key does not depend on the hashing
+    std::vector<const Server::iRoute::URLParameters::value_type *> params;
+    params.reserve(urlParams.size());
+    for(const auto & p : urlParams) params.push_back(&p);
+    std::sort(params.begin(), params.end()
+             , [](auto a, auto b) { return a->first < b->first; });
+    std::string k;
+    for(auto p : params) {
+        k.append(p->first).push_back('=');
+        k.append(p->second).push_back('\0');
+    }
+    k.push_back('?');
+    k.append(queryString);
+    return k;
+}
+
+std::string_view
+RepresentationCache::query_string(const RequestMsg & rq) {
+    std::string_view target = rq.str_uri();
+    const size_t qPos = target.find('?');
+    if(std::string_view::npos == qPos) return {};
+    target.remove_prefix(qPos + 1);
+    return target.substr(0, target.find('#'));
+}
+
+RepresentationCache::RepresentationPtr
+RepresentationCache::find(const Server::iRoute & route, const std::string & key) const {
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    auto it = _entries.find(Key(&route, key));
+    if(_entries.end() == it) {
+        ++_nMisses;
+        return nullptr;
+    }
+    ++_nHits;
+    return it->second;
+}
+
+RepresentationCache::RepresentationPtr
+RepresentationCache::represent(const ResponseMsg & rp) {
+    auto r = std::make_shared<Representation>();
+    std::string_view contentType;
+    for(const auto & h : rp.headers()) {
+        if(_is_dispatch_header(h.first)) continue;
+        if("content-type" == h.first) contentType = h.second;
+        r->headers.emplace_back(h.first, h.second);
+    }
+    std::string data;
+    if(rp.has_content()) data = _read_content(*rp.content());
+    #if defined(SYNC_HTTP_SRV_WITH_ZLIB) && SYNC_HTTP_SRV_WITH_ZLIB
+    if(data.size() > 256 && compressible_type(contentType)) {
+        std::string gz = compress(data, ContentCoding::kGzip);
+        if(gz.size() < data.size()) {
+            r->gzip = std::make_shared<StringContent>(std::move(gz));
+            auto it = std::find_if(r->headers.begin(), r->headers.end()
+                    , [](const auto & h) { return "vary" == h.first; });
+            if(r->headers.end() == it) r->headers.emplace_back("vary", "Accept-Encoding");
+            else it->second += ", Accept-Encoding";
+        }
+    }
+    #endif
+    r->identity = std::make_shared<StringContent>(std::move(data));
+    return r;
+}
+
+RepresentationCache::RepresentationPtr
+RepresentationCache::put( const Server::iRoute & route, const std::string & key
+                        , const ResponseMsg & rp, size_t maxSize ) {
+    RepresentationPtr r = represent(rp);
+    if(r->n_bytes() > maxSize) return r;
+    std::unique_lock<std::shared_mutex> lock(_mtx);
+    auto ir = _entries.emplace(Key(&route, key), r);
+    if(ir.second) _nBytes += r->n_bytes();
+    return ir.first->second;  // concurrently built one wins
+}
+
+std::shared_ptr<ResponseMsg>
+RepresentationCache::respond(const Representation & r, const RequestMsg & rq) {
+    auto rp = rq.response(Msg::Ok);
+    for(const auto & h : r.headers) rp->set_header(h.first, h.second);
+    if( r.gzip && ContentCoding::kGzip
+            == negotiate_coding(rq.get_header_view("accept-encoding")) ) {
+        rp->content(r.gzip);
+        rp->set_header("content-encoding", "gzip");
+        std::string_view etag = rp->get_header_view("etag");
+        if(!etag.empty()) rp->set_header("etag", coded_etag(etag, ContentCoding::kGzip));
+    } else {
+        rp->content(r.identity);
+    }
+    return rp;
+}
+
+void
+RepresentationCache::invalidate(const Server::iRoute & route) {
+    std::unique_lock<std::shared_mutex> lock(_mtx);
+    auto it = _entries.lower_bound(Key(&route, std::string()));
+    while(_entries.end() != it && &route == it->first.first) {
+        _nBytes -= it->second->n_bytes();
+        it = _entries.erase(it);
+    }
+}
+
+void
+RepresentationCache::invalidate() {
+    std::unique_lock<std::shared_mutex> lock(_mtx);
+    _entries.clear();
+    _nBytes = 0;
+}
+
+size_t
+RepresentationCache::size() const {
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    return _entries.size();
+}
+
+size_t
+RepresentationCache::n_bytes() const {
+    std::shared_lock<std::shared_mutex> lock(_mtx);
+    return _nBytes;
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -18,9 +18,28 @@ RESTTraits<JSON>::parse_request_body(const Msg::iContent & c) {
 void
 RESTTraits<JSON>::set_content(ResponseMsg & msg, const JSON & js) {
     assert(!msg.has_content());
-    std::ostringstream oss;
-    oss << js;
-    msg.content(std::make_shared<StringContent>(oss.str()));
+    msg.content(std::make_shared<StringContent>(js.dump()));
+}
+
+void
+RESTTraits<JSON>::set_content(ResponseMsg & msg, JSON && js) {
+    assert(!msg.has_content());
+    if(!js.is_structured() || js.empty()) {
+        msg.content(std::make_shared<StringContent>(js.dump()));
+        return;
+    }
+    auto doc = std::make_shared<JSON>(std::move(js));
+    msg.content(std::make_shared<GeneratorContent>(
+        [doc, it = doc->cbegin(), first = true](std::ostream & os) mutable {
+            if(first) os << (doc->is_array() ? '[' : '{');
+            else os << ',';
+            first = false;
+            if(doc->is_array()) os << *it;
+            else os << JSON(it.key()) << ':' << it.value();
+            if(++it != doc->cend()) return true;
+            os << (doc->is_array() ? ']' : '}');
+            return false;
+        }));
 }
 
 }  // namespace ::sync_http_srv::util::http
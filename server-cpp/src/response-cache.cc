@@ -0,0 +1,142 @@
+#include "sync-http-srv/response-cache.hh"
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+ResponseCache::ResponseCache(size_t maxBytes, size_t maxEntries)
+        : _maxBytes(maxBytes)
+        , _maxEntries(maxEntries)
+        , _nBytes(0)
+        , _nHits(0)
+        , _nMisses(0)
+        , _nEvictions(0)
+        {}
+
+void
+ResponseCache::_erase(Entries::iterator it) {
+    _nBytes -= it->repr->n_bytes();
+    _index.erase(it->indexIt);
+    _entries.erase(it);
+}
+
+void
+ResponseCache::_evict() {
+    while( !_entries.empty()
+        && (_entries.size() > _maxEntries || _nBytes > _maxBytes) ) {
+        _erase(std::prev(_entries.end()));
+        ++_nEvictions;
+    }
+}
+
+void
+ResponseCache::limits(size_t maxBytes, size_t maxEntries) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _maxBytes = maxBytes;
+    _maxEntries = maxEntries;
+    _evict();
+}
+
+size_t
+ResponseCache::max_bytes() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _maxBytes;
+}
+
+size_t
+ResponseCache::max_entries() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _maxEntries;
+}
+
+ResponseCache::RepresentationPtr
+ResponseCache::find( const Server::iRoute & route, const std::string & key
+                   , uint64_t version ) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    auto it = _index.find(Key(&route, key));
+    if(_index.end() == it) {
+        ++_nMisses;
+        return nullptr;
+    }
+    if(it->second->version != version) {
+        // state has changed, stale entry is of no use anymore
+        ++_nMisses;
+        _erase(it->second);
+        return nullptr;
+    }
+    // move to the head of recently used list
+    _entries.splice(_entries.begin(), _entries, it->second);
+    ++_nHits;
+    return it->second->repr;
+}
+
+ResponseCache::RepresentationPtr
+ResponseCache::put( const Server::iRoute & route, const std::string & key
+                  , uint64_t version, const ResponseMsg & rp ) {
+    // built out of lock, concurrent requests of the same state may build
+    // representation twice, the latter wins
+    RepresentationPtr r = RepresentationCache::represent(rp);
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(r->n_bytes() > _maxBytes || !_maxEntries) return r;
+    auto it = _index.find(Key(&route, key));
+    if(_index.end() != it) _erase(it->second);
+    it = _index.emplace(Key(&route, key), _entries.end()).first;
+    _entries.push_front(Entry{it, version, r});
+    it->second = _entries.begin();
+    _nBytes += r->n_bytes();
+    _evict();
+    return r;
+}
+
+void
+ResponseCache::invalidate(const Server::iRoute & route) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    auto it = _index.lower_bound(Key(&route, std::string()));
+    while(_index.end() != it && &route == it->first.first) {
+        auto next = std::next(it);
+        _erase(it->second);
+        it = next;
+    }
+}
+
+void
+ResponseCache::invalidate() {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _index.clear();
+    _entries.clear();
+    _nBytes = 0;
+}
+
+size_t
+ResponseCache::size() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _entries.size();
+}
+
+size_t
+ResponseCache::n_bytes() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nBytes;
+}
+
+size_t
+ResponseCache::n_hits() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nHits;
+}
+
+size_t
+ResponseCache::n_misses() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nMisses;
+}
+
+size_t
+ResponseCache::n_evictions() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nEvictions;
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,226 @@
+#include "sync-http-srv/server.hh"
+#include "sync-http-srv/connection.hh"
+#include "sync-http-srv/timer-wheel.hh"
+
+#include <cstring>
+#include <cassert>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+//                                                     ________________________
+// __________________________________________________/ Event-driven server mode
+
+namespace {
+/// Aux struct keeping index of polled connections
+struct EPollSet {
+    /// Polled connection entry
+    struct Entry {
+        std::unique_ptr<Connection> conn;
+        /// Current set of polled events
+        uint32_t events;
+    };
+    int epFD;
+    /// Recycles nodes of connections map
+    std::pmr::unsynchronized_pool_resource nodes;
+    std::pmr::unordered_map<int, Entry> connections;
+    /// Deadlines of connections
+    util::TimerWheel timers;
+
+    EPollSet() : epFD(-1), connections(&nodes)
+               , timers(std::chrono::milliseconds(100), 1024) {}
+
+    void watch(int fd, uint32_t events, int op) {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        if(epoll_ctl(epFD, op, fd, &ev) < 0) {
+            int en = errno;
+            throw errors::GenericSocketError(util::format("epoll_ctl() error"
+                        " on fd %d: %s", fd, strerror(en)).c_str());
+        }
+    }
+    /// Adds connection to the set
+    void add(Connection * conn) {
+        connections.emplace(conn->fd(), Entry{std::unique_ptr<Connection>(conn), EPOLLIN});
+        watch(conn->fd(), EPOLLIN, EPOLL_CTL_ADD);
+    }
+    /// Changes polled events for connection, if need
+    void interest(Entry & e, uint32_t events) {
+        if(e.events == events) return;
+        watch(e.conn->fd(), events, EPOLL_CTL_MOD);
+        e.events = events;
+    }
+    /// Removes connection from set, closes socket unless `keepSocket` is set
+    void drop(int fd, bool keepSocket=false) {
+        epoll_ctl(epFD, EPOLL_CTL_DEL, fd, nullptr);
+        if(!keepSocket) close(fd);
+        connections.erase(fd);
+        timers.cancel(fd);
+    }
+};
+}  // anonymous namespace
+
+void
+Server::run_epoll( const Routes & routes, size_t maxEvents ) {
+    EPollSet ps;
+    if((ps.epFD = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        int en = errno;
+        throw errors::GenericSocketError(util::format("epoll_create1() error: %s"
+                    , strerror(en)).c_str());
+    }
+    // listening socket must not block on `accept()`
+    const int sockFlags = fcntl(_sockFD, F_GETFL, 0);
+    fcntl(_sockFD, F_SETFL, sockFlags | O_NONBLOCK);
+    ps.watch(_sockFD, EPOLLIN, EPOLL_CTL_ADD);
+    // leader shard of prefork mode also serves connections handed over by
+    // followers
+    if(_nShards && !_nShard) ps.watch(_leaderFD, EPOLLIN, EPOLL_CTL_ADD);
+
+    _L.info(util::format("HTTP server \"%s:%d\" runs in event-driven mode."
+           , _host.c_str(), (int) _port).c_str() );
+
+    // advances connection state as far as socket allows
+    auto advance = [&](EPollSet::Entry & entry) {
+        Connection & conn = *entry.conn;
+        const int fd = conn.fd();
+        while(true) {
+            if(Connection::kReceiving == conn.state()) {
+                uint16_t execFlags = 0x0;
+                if(!_process(conn, routes, execFlags)) {
+                    ps.interest(entry, EPOLLIN);  // wait for data
+                    ps.timers.schedule(fd, _deadline(conn));
+                    break;
+                }
+                if(execFlags & kStop) _keepGoing = false;
+                if(execFlags & kNoDispatchResponse) {
+                    ps.drop(fd, execFlags & kKeepClientConnection);
+                    break;
+                }
+            }
+            if(Connection::kSending == conn.state()) {
+                bool sent = false;
+                try {
+                    sent = conn.send();
+                } catch( errors::ClientSocketError & e ) {
+                    _L.warn(util::format("Error dispatching response to %s: %s"
+                                , conn.ip_str(), e.what()).c_str());
+                    ps.drop(fd);
+                    break;
+                }
+                if(!sent) {
+                    // wait for socket to become writable
+                    ps.interest(entry, EPOLLOUT);
+                    ps.timers.schedule(fd, _deadline(conn));
+                    break;
+                }
+            }
+            assert(Connection::kDone == conn.state());
+            if(!(conn.keep_alive() && _keepGoing)) {
+                ps.drop(fd, conn.exec_flags() & kKeepClientConnection);
+                break;
+            }
+            // persistent connection, handle pipelined request(s), if any
+            conn.reset();
+        }
+    };
+
+    std::vector<epoll_event> events(maxEvents ? maxEvents : 1);
+    std::vector<int> expired;
+    while( _keepGoing ) {
+        // wake up on the next timer tick if there are deadlines set
+        int nEvents = epoll_wait( ps.epFD, events.data(), events.size()
+                , ps.timers.timeout_ms(std::chrono::steady_clock::now()) );
+        if(nEvents < 0) {
+            int en = errno;
+            if(EINTR == en) continue;
+            _L.error(util::format("epoll_wait() error: %s", strerror(en)).c_str());
+            break;
+        }
+        for(int i = 0; i < nEvents; ++i) {
+            const int fd = events[i].data.fd;
+            if(fd == _sockFD) {
+                // accept all pending connections
+                while(true) {
+                    sockaddr_in clientAddr;
+                    socklen_t clientSize = sizeof(clientAddr);
+                    int clientFD = accept4( _sockFD
+                                          , (sockaddr *)&clientAddr
+                                          , &clientSize
+                                          , SOCK_NONBLOCK | SOCK_CLOEXEC
+                                          );
+                    if(clientFD < 0) {
+                        int en = errno;
+                        if(EINTR == en) continue;
+                        if(EAGAIN != en && EWOULDBLOCK != en)
+                            _L.warn(util::format("accept4() error: %s"
+                                        , strerror(en)).c_str());
+                        break;
+                    }
+                    ++_stats.nConnections;
+                    if(!_admit(ps.connections.size())) {
+                        ++_stats.nShedConnections;
+                        _shed(clientFD);
+                        close(clientFD);
+                        continue;
+                    }
+                    Connection * conn = Connection::create( clientFD, clientAddr, _L
+                                         , _connBuffers, _ioBufSize
+                                         , _maxInMemContentLen );
+                    ps.add(conn);
+                    ps.timers.schedule(clientFD, _deadline(*conn));
+                }
+                continue;
+            }
+            if(fd == _leaderFD && _nShards && !_nShard) {
+                Connection * conn;
+                while((conn = _take_over())) {
+                    const int clientFD = conn->fd();
+                    ps.add(conn);
+                    advance(ps.connections[clientFD]);
+                }
+                continue;
+            }
+            auto it = ps.connections.find(fd);
+            if(ps.connections.end() == it) continue;  // dropped in this cycle
+            advance(it->second);
+        }
+        // handle connections which deadlines are expired
+        const auto now = std::chrono::steady_clock::now();
+        expired.clear();
+        ps.timers.expire(now, [&](int fd) { expired.push_back(fd); });
+        for(int fd : expired) {
+            auto it = ps.connections.find(fd);
+            if(ps.connections.end() == it) continue;
+            Connection & conn = *it->second.conn;
+            const auto deadline = _deadline(conn);
+            if(deadline > now) {
+                ps.timers.schedule(fd, deadline);
+                continue;
+            }
+            if(_deadline_expired(conn)) advance(it->second);  // send 408
+            else ps.drop(fd);
+        }
+    }  // server's "keepGoing"
+    // close pending connections
+    while(!ps.connections.empty()) {
+        ps.drop(ps.connections.begin()->first);
+    }
+    close(ps.epFD);
+    fcntl(_sockFD, F_SETFL, sockFlags);
+    _L.info("Server shutdown.");
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
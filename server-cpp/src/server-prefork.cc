@@ -0,0 +1,305 @@
+#include "sync-http-srv/server.hh"
+#include "sync-http-srv/connection.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <cassert>
+#include <csignal>
+#include <vector>
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+//                                                        _____________________
+// _____________________________________________________/ Prefork server mode
+
+namespace {
+/// Pins calling process to `n`-th CPU available to it (modulo number of CPUs)
+bool
+pin_to_cpu(size_t n) {
+    cpu_set_t available, cpu;
+    if(sched_getaffinity(0, sizeof(available), &available) < 0) return false;
+    const int nCPUs = CPU_COUNT(&available);
+    if(!nCPUs) return false;
+    n %= nCPUs;
+    for(int i = 0; i < CPU_SETSIZE; ++i) {
+        if(!CPU_ISSET(i, &available)) continue;
+        if(n--) continue;
+        CPU_ZERO(&cpu);
+        CPU_SET(i, &cpu);
+        return 0 == sched_setaffinity(0, sizeof(cpu), &cpu);
+    }
+    return false;
+}
+}  // anonymous namespace
+
+namespace {
+/// Block taken from the pool for the scope
+struct PooledBlock {
+    util::BufferPool & pool;
+    char * const ptr;
+    explicit PooledBlock(util::BufferPool & pool_) : pool(pool_), ptr(pool_.acquire()) {}
+    ~PooledBlock() { pool.release(ptr); }
+};
+
+/// Writes data to descriptor entirely
+void
+write_all(int fd, const char * data, size_t n) {
+    while(n) {
+        const ssize_t written = write(fd, data, n);
+        if(written < 0) {
+            int en = errno;
+            if(EINTR == en) continue;
+            throw errors::GenericHTTPError(util::format("Can not write data"
+                        " of request being handed over: %s", strerror(en)).c_str()
+                    , Msg::ServiceUnvailable);
+        }
+        data += written;
+        n -= written;
+    }
+}
+}  // anonymous namespace
+
+void
+Server::_hand_over( Connection & conn ) {
+    assert(_is_follower());
+    assert(conn.request());
+    const RequestMsg & rq = *conn.request();
+    // render request as it was received; content is already decoded, so
+    // its length is set explicitly
+    std::string data = util::format( "%s %s %s\r\n"
+                                   , Msg::to_str(rq.method())
+                                   , rq.str_uri().c_str()
+                                   , Msg::to_str(rq.version()) );
+    for(const auto & p : rq.headers()) {
+        if( p.first == "content-length" || p.first == "transfer-encoding" ) continue;
+        data.append(p.first).append(": ").append(p.second).append("\r\n");
+    }
+    const size_t contentSize = rq.has_content() ? rq.content()->size() : 0;
+    if(contentSize)
+        data += util::format("content-length: %zu\r\n", contentSize);
+    data += "\r\n";
+    // pipelined data, if any, are passed as well
+    const char * pipelined;
+    const size_t nPipelined = conn.buffered_data(pipelined);
+    // leader puts data sent inline into receive buffer of the same size,
+    // larger ones are written to memory file passed along with socket
+    int fds[2] = {conn.fd(), -1};
+    if(data.size() + contentSize + nPipelined <= _ioBufSize) {
+        if(contentSize) {
+            const size_t off = data.size();
+            data.resize(off + contentSize);
+            rq.content()->copy_to(&data[off], contentSize);
+        }
+        data.append(pipelined, nPipelined);
+    } else {
+        fds[1] = memfd_create("sync-http-srv-hand-over", MFD_CLOEXEC);
+        if(fds[1] < 0) {
+            int en = errno;
+            throw errors::GenericHTTPError(util::format("memfd_create() error: %s"
+                        , strerror(en)).c_str(), Msg::ServiceUnvailable);
+        }
+        try {
+            write_all(fds[1], data.data(), data.size());
+            for(size_t from = 0; from < contentSize; ) {
+                // in-memory and file content provide contiguous span,
+                // other content is copied by portions
+                const char * ptr;
+                size_t len = rq.content()->segment(from, ptr);
+                if(!len) {
+                    data.resize(_ioBufSize);
+                    len = rq.content()->copy_to(&data[0], data.size(), from);
+                    ptr = data.data();
+                }
+                write_all(fds[1], ptr, len);
+                from += len;
+            }
+            write_all(fds[1], pipelined, nPipelined);
+        } catch(...) {
+            close(fds[1]);
+            throw;
+        }
+        data.clear();
+    }
+
+    const size_t nFDs = fds[1] < 0 ? 1 : 2;
+    iovec iov;
+    iov.iov_base = &data[0];
+    iov.iov_len = data.size();
+    char ctrl[CMSG_SPACE(sizeof(fds))];
+    memset(ctrl, 0, sizeof(ctrl));
+    msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = CMSG_SPACE(nFDs*sizeof(int));
+    cmsghdr * cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(nFDs*sizeof(int));
+    memcpy(CMSG_DATA(cm), fds, nFDs*sizeof(int));
+    int rc;
+    while((rc = sendmsg(_leaderFD, &mh, MSG_NOSIGNAL)) < 0 && EINTR == errno) {}
+    const int en = errno;
+    // descriptor is duplicated by kernel for the leader
+    if(fds[1] >= 0) close(fds[1]);
+    if(rc < 0) {
+        throw errors::GenericHTTPError(util::format("sendmsg() error: %s"
+                    , strerror(en)).c_str(), Msg::ServiceUnvailable);
+    }
+}
+
+Connection *
+Server::_take_over() {
+    assert(_nShards && !_nShard);
+    // data are received into pooled block, then copied to connection's one
+    PooledBlock data(_connBuffers);
+    iovec iov;
+    iov.iov_base = data.ptr;
+    iov.iov_len = _ioBufSize;
+    // client socket, optionally followed by memory file with request data
+    char ctrl[CMSG_SPACE(2*sizeof(int))];
+    msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctrl;
+    mh.msg_controllen = sizeof(ctrl);
+    ssize_t n;
+    while((n = recvmsg(_leaderFD, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC)) < 0
+            && EINTR == errno) {}
+    if(n < 0) {
+        int en = errno;
+        if(EAGAIN != en && EWOULDBLOCK != en)
+            _L.error(util::format("recvmsg() error: %s", strerror(en)).c_str());
+        return nullptr;
+    }
+    cmsghdr * cm = CMSG_FIRSTHDR(&mh);
+    if(!cm || SOL_SOCKET != cm->cmsg_level || SCM_RIGHTS != cm->cmsg_type) {
+        if(0 == n) {
+            // all followers are gone, stop listening to them
+            _L.warn("Follower shards closed connection to the leader.");
+            close(_leaderFD);
+            _leaderFD = -1;
+        } else {
+            _L.error("Connection handed over by follower shard has no"
+                    " descriptor.");
+        }
+        return nullptr;
+    }
+    int fds[2] = {-1, -1};
+    const size_t nFDs = (cm->cmsg_len - CMSG_LEN(0))/sizeof(int);
+    memcpy(fds, CMSG_DATA(cm), std::min<size_t>(nFDs, 2)*sizeof(int));
+    if((mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || nFDs > 2) {
+        _L.error("Truncated data of connection handed over by follower shard.");
+        for(int fd : fds) if(fd >= 0) close(fd);
+        return nullptr;
+    }
+    const int clientFD = fds[0];
+    // socket status flags (`O_NONBLOCK`) are shared with the follower's
+    // descriptor, only peer address has to be retrieved
+    sockaddr_in clientAddr;
+    socklen_t addrLen = sizeof(clientAddr);
+    if(getpeername(clientFD, (sockaddr *) &clientAddr, &addrLen) < 0)
+        memset(&clientAddr, 0, sizeof(clientAddr));
+    Connection * conn = Connection::create( clientFD, clientAddr, _L
+                                          , _connBuffers, _ioBufSize
+                                          , _maxInMemContentLen );
+    if(fds[1] >= 0) {
+        // data are read from the beginning of memory file
+        lseek(fds[1], 0, SEEK_SET);
+        conn->prefill(fds[1]);
+    } else {
+        conn->prefill(data.ptr, n);
+    }
+    return conn;
+}
+
+void
+Server::run_prefork( const Routes & routes, size_t nShards, bool pin ) {
+    if(!nShards) {
+        throw errors::GenericRuntimeError("Zero number of shards"
+                " requested for prefork server mode.");
+    }
+    // followers hand over connections to leader by this socket pair
+    int sv[2];
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        int en = errno;
+        throw errors::GenericSocketError(util::format("socketpair() error: %s"
+                    , strerror(en)).c_str());
+    }
+    const pid_t leaderPID = getpid();
+    std::vector<pid_t> followers;
+    for(size_t nShard = 1; nShard < nShards; ++nShard) {
+        const pid_t pid = fork();
+        if(pid < 0) {
+            int en = errno;
+            _L.error(util::format("fork() error: %s, running with %zu shard(s)"
+                        , strerror(en), nShard).c_str());
+            break;
+        }
+        if(pid) {
+            followers.push_back(pid);
+            continue;
+        }
+        // follower shard: terminate together with leader
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        if(getppid() != leaderPID) _exit(0);
+        close(sv[0]);
+        _nShard = nShard;
+        _nShards = nShards;
+        _leaderFD = sv[1];
+        if(pin && !pin_to_cpu(nShard)) {
+            _L.warn(util::format("Failed to pin shard #%zu to CPU.", nShard).c_str());
+        }
+        int rc = 0;
+        try {
+            // own socket joins `SO_REUSEPORT` group, so kernel balances
+            // connections among shards
+            close(_sockFD);
+            _listen();
+            run_epoll(routes);
+        } catch( std::exception & e ) {
+            _L.error(util::format("Shard #%zu failed: %s", nShard, e.what()).c_str());
+            rc = 1;
+        }
+        _exit(rc);
+    }
+    close(sv[1]);
+    _nShard = 0;
+    _nShards = followers.size() + 1;
+    _leaderFD = sv[0];
+    if(pin && !pin_to_cpu(0)) {
+        _L.warn("Failed to pin leader shard to CPU.");
+    }
+    _L.info(util::format("HTTP server \"%s:%d\" runs in prefork mode with"
+                " %zu shard(s).", _host.c_str(), (int) _port, _nShards).c_str() );
+    try {
+        run_epoll(routes);
+    } catch(...) {
+        for(pid_t pid : followers) kill(pid, SIGTERM);
+        throw;
+    }
+    // stop followers
+    for(pid_t pid : followers) kill(pid, SIGTERM);
+    for(pid_t pid : followers) {
+        while(waitpid(pid, nullptr, 0) < 0 && EINTR == errno) {}
+    }
+    if(_leaderFD >= 0) close(_leaderFD);
+    _leaderFD = -1;
+    _nShards = 0;
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
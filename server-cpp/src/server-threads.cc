@@ -0,0 +1,152 @@
+#include "sync-http-srv/server.hh"
+#include "sync-http-srv/connection.hh"
+
+#include <cstring>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+//                                                 ____________________________
+// ______________________________________________/ Multi-threaded server mode
+
+namespace {
+/// Queue of accepted connections awaiting for a worker
+struct PendingConnections {
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::pair<int, sockaddr_in>> queue;
+    /// Set by acceptor once no more connections will be queued
+    bool closed;
+
+    PendingConnections() : closed(false) {}
+};
+}  // anonymous namespace
+
+void
+Server::run_threaded( const Routes & routes, size_t nWorkers ) {
+    if(!nWorkers) {
+        throw errors::GenericRuntimeError("Zero number of worker threads"
+                " requested for multi-threaded server mode.");
+    }
+    // Create locks for serialized endpoints; dictionary is read-only since
+    // workers start
+    _endpointLocks.clear();
+    for(const auto & route : routes) {
+        if( iEndpoint::kSerialized != route.second->thread_safety()
+         || _endpointLocks.count(route.second) ) continue;
+        _endpointLocks.emplace(route.second, new std::mutex());
+    }
+    // Used by workers to interrupt acceptor
+    int wakeFD = eventfd(0, EFD_CLOEXEC);
+    if(wakeFD < 0) {
+        int en = errno;
+        throw errors::GenericSocketError(util::format("eventfd() error: %s"
+                    , strerror(en)).c_str());
+    }
+
+    std::mutex logMtx;
+    PrefixedJournal acceptorL(_L, logMtx, "[acceptor] ");
+    PendingConnections pending;
+
+    auto worker = [&](size_t nWorker) {
+        PrefixedJournal L(_L, logMtx, util::format("[worker #%zu] ", nWorker));
+        while(true) {
+            std::pair<int, sockaddr_in> item;
+            {
+                std::unique_lock<std::mutex> lock(pending.mtx);
+                pending.cv.wait(lock, [&]{
+                        return pending.closed || !pending.queue.empty(); });
+                if(pending.queue.empty()) break;
+                item = pending.queue.front();
+                pending.queue.pop_front();
+            }
+            Connection conn( item.first, item.second, L
+                           , _connBuffers, _ioBufSize, _maxInMemContentLen );
+            if( _serve(conn, routes) & kStop ) _keepGoing = false;
+            if(!_keepGoing) {
+                const uint64_t one = 1;
+                if(write(wakeFD, &one, sizeof(one)) < 0) {
+                    L.warn("Failed to interrupt acceptor thread.");
+                }
+            }
+        }
+    };
+
+    _nWorkers = nWorkers;
+    std::vector<std::thread> workers;
+    workers.reserve(nWorkers);
+    for(size_t i = 0; i < nWorkers; ++i) {
+        workers.emplace_back(worker, i);
+    }
+    acceptorL.info(util::format("HTTP server \"%s:%d\" runs with %zu worker"
+                " threads.", _host.c_str(), (int) _port, nWorkers).c_str() );
+
+    // accept new connections and distribute them among workers
+    pollfd pfds[2];
+    pfds[0].fd = _sockFD;
+    pfds[0].events = POLLIN;
+    pfds[1].fd = wakeFD;
+    pfds[1].events = POLLIN;
+    while( _keepGoing ) {
+        if(poll(pfds, 2, -1) < 0) {
+            int en = errno;
+            if(EINTR == en) continue;
+            acceptorL.error(util::format("poll() error: %s", strerror(en)).c_str());
+            break;
+        }
+        if(pfds[1].revents) break;  // interrupted by worker
+        if(!(pfds[0].revents & POLLIN)) continue;
+        sockaddr_in clientAddr;
+        socklen_t clientSize = sizeof(clientAddr);
+        int clientFD = accept4( _sockFD
+                              , (sockaddr *)&clientAddr
+                              , &clientSize
+                              , SOCK_CLOEXEC
+                              );
+        if( clientFD < 0 ) {
+            int en = errno;
+            acceptorL.warn(util::format("accept4() error: %s", strerror(en)).c_str());
+            continue;
+        }
+        ++_stats.nConnections;
+        {
+            std::unique_lock<std::mutex> lock(pending.mtx);
+            const size_t nPending = pending.queue.size();
+            lock.unlock();
+            if(!_admit(nPending)) {
+                // connections waiting for worker would likely time out
+                ++_stats.nShedConnections;
+                _shed(clientFD);
+                close(clientFD);
+                continue;
+            }
+            lock.lock();
+            pending.queue.emplace_back(clientFD, clientAddr);
+        }
+        pending.cv.notify_one();
+    }  // server's "keepGoing"
+    {
+        std::lock_guard<std::mutex> lock(pending.mtx);
+        pending.closed = true;
+    }
+    pending.cv.notify_all();
+    for(auto & w : workers) w.join();
+    _nWorkers = 0;
+    _endpointLocks.clear();
+    close(wakeFD);
+    _L.info("Server shutdown.");
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
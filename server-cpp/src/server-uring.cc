@@ -0,0 +1,493 @@
+#include "sync-http-srv/server.hh"
+#include "sync-http-srv/connection.hh"
+#include "sync-http-srv/timer-wheel.hh"
+
+#if defined(SYNC_HTTP_SRV_WITH_IO_URING) && SYNC_HTTP_SRV_WITH_IO_URING
+
+#include <cstring>
+#include <cassert>
+#include <memory>
+#include <memory_resource>
+#include <unordered_map>
+#include <vector>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+//                                                        _____________________
+// _____________________________________________________/ io_uring server mode
+
+namespace {
+
+/// Minimalistic io_uring instance (no liburing dependency)
+///
+/// Submission entries are queued with `get_sqe()` and submitted in batch
+/// by `submit()` which also waits for completions.
+class URing {
+private:
+    int _fd;
+    io_uring_params _params;
+    void * _sqPtr, * _cqPtr;
+    size_t _sqSize, _cqSize;
+    io_uring_sqe * _sqes;
+    unsigned * _sqHead, * _sqTail, * _sqMask, * _sqArray;
+    unsigned * _cqHead, * _cqTail, * _cqMask;
+    io_uring_cqe * _cqes;
+    /// Local (not yet published) SQ tail
+    unsigned _sqTailLocal;
+public:
+    URing() : _fd(-1), _sqPtr(MAP_FAILED), _cqPtr(MAP_FAILED), _sqes(nullptr) {}
+    ~URing() { close(); }
+    /// Unmaps and closes the ring, cancelling operations in flight
+    void close();
+    /// Sets up the ring, returns `-errno` on failure
+    int init(unsigned entries);
+    int fd() const { return _fd; }
+    /// Returns number of submission queue entries
+    unsigned sq_entries() const { return _params.sq_entries; }
+    /// Returns free SQE (submits queued ones if SQ is full)
+    io_uring_sqe * get_sqe();
+    /// Submits queued entries, waits for at least `waitNr` completions
+    int submit(unsigned waitNr);
+    /// Calls given function for each of the pending completions
+    template<typename CallableT> void for_each_cqe(CallableT f);
+};
+
+void
+URing::close() {
+    if(_sqes) munmap(_sqes, _params.sq_entries*sizeof(io_uring_sqe));
+    if(_cqPtr != MAP_FAILED && _cqPtr != _sqPtr) munmap(_cqPtr, _cqSize);
+    if(_sqPtr != MAP_FAILED) munmap(_sqPtr, _sqSize);
+    if(_fd >= 0) ::close(_fd);
+    _fd = -1;
+    _sqPtr = _cqPtr = MAP_FAILED;
+    _sqes = nullptr;
+}
+
+int
+URing::init(unsigned entries) {
+    memset(&_params, 0, sizeof(_params));
+    _fd = (int) syscall(__NR_io_uring_setup, entries, &_params);
+    if(_fd < 0) return -errno;
+    _sqSize = _params.sq_off.array + _params.sq_entries*sizeof(unsigned);
+    _cqSize = _params.cq_off.cqes + _params.cq_entries*sizeof(io_uring_cqe);
+    if(_params.features & IORING_FEAT_SINGLE_MMAP) {
+        _sqSize = _cqSize = std::max(_sqSize, _cqSize);
+    }
+    _sqPtr = mmap( nullptr, _sqSize, PROT_READ | PROT_WRITE
+                 , MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING );
+    if(MAP_FAILED == _sqPtr) return -errno;
+    if(_params.features & IORING_FEAT_SINGLE_MMAP) {
+        _cqPtr = _sqPtr;
+    } else {
+        _cqPtr = mmap( nullptr, _cqSize, PROT_READ | PROT_WRITE
+                     , MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING );
+        if(MAP_FAILED == _cqPtr) return -errno;
+    }
+    void * sqes = mmap( nullptr, _params.sq_entries*sizeof(io_uring_sqe)
+                      , PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE
+                      , _fd, IORING_OFF_SQES );
+    if(MAP_FAILED == sqes) return -errno;
+    _sqes = static_cast<io_uring_sqe *>(sqes);
+
+    char * sq = static_cast<char *>(_sqPtr)
+       , * cq = static_cast<char *>(_cqPtr)
+       ;
+    _sqHead  = reinterpret_cast<unsigned *>(sq + _params.sq_off.head);
+    _sqTail  = reinterpret_cast<unsigned *>(sq + _params.sq_off.tail);
+    _sqMask  = reinterpret_cast<unsigned *>(sq + _params.sq_off.ring_mask);
+    _sqArray = reinterpret_cast<unsigned *>(sq + _params.sq_off.array);
+    _cqHead  = reinterpret_cast<unsigned *>(cq + _params.cq_off.head);
+    _cqTail  = reinterpret_cast<unsigned *>(cq + _params.cq_off.tail);
+    _cqMask  = reinterpret_cast<unsigned *>(cq + _params.cq_off.ring_mask);
+    _cqes    = reinterpret_cast<io_uring_cqe *>(cq + _params.cq_off.cqes);
+    _sqTailLocal = *_sqTail;
+    return 0;
+}
+
+io_uring_sqe *
+URing::get_sqe() {
+    unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    if(_sqTailLocal - head >= _params.sq_entries) {
+        // SQ is full, flush it without waiting
+        if(submit(0) < 0) return nullptr;
+        head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+        if(_sqTailLocal - head >= _params.sq_entries) return nullptr;
+    }
+    const unsigned idx = _sqTailLocal & *_sqMask;
+    _sqArray[idx] = idx;
+    ++_sqTailLocal;
+    io_uring_sqe * sqe = _sqes + idx;
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    return sqe;
+}
+
+int
+URing::submit(unsigned waitNr) {
+    const unsigned toSubmit = _sqTailLocal - *_sqTail;
+    __atomic_store_n(_sqTail, _sqTailLocal, __ATOMIC_RELEASE);
+    while(true) {
+        int rc = (int) syscall( __NR_io_uring_enter, _fd, toSubmit, waitNr
+                              , waitNr ? IORING_ENTER_GETEVENTS : 0
+                              , nullptr, 0 );
+        if(rc < 0 && EINTR == errno) {
+            if(!waitNr) return 0;
+            continue;
+        }
+        return rc < 0 ? -errno : rc;
+    }
+}
+
+template<typename CallableT> void
+URing::for_each_cqe(CallableT f) {
+    unsigned head = *_cqHead;
+    while(true) {
+        const unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        if(head == tail) break;
+        const io_uring_cqe cqe = _cqes[head & *_cqMask];
+        ++head;
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+        f(cqe);
+    }
+}
+
+/// Operation kinds encoded in user data of submission entries
+enum URingOp : uint64_t { kAcceptOp = 0, kRecvOp = 1, kSendOp = 2, kTimeoutOp = 3 };
+
+/// Connection which data are received by io_uring
+///
+/// Received data are placed to `recv_window()` by the ring; `pending()`
+/// then makes `receive()` to consider them instead of reading the socket.
+class URingConnection : public Connection {
+private:
+    /// Result of the last read completion, negative if none
+    ssize_t _pendingRead;
+protected:
+    ssize_t _recv(char *, size_t) override {
+        if(_pendingRead < 0) {
+            errno = EAGAIN;
+            return -1;
+        }
+        ssize_t r = _pendingRead;
+        _pendingRead = -1;
+        return r;
+    }
+public:
+    /// Index of the IO buffers slot in use
+    const size_t nSlot;
+    /// Set once connection deadline expired while operation was in flight
+    bool expired;
+    /// Gathered response data of send operation in flight
+    iovec iov[MsgSender::kMaxSegments];
+    msghdr mh;
+
+    URingConnection( int fd, const sockaddr_in & addr, iJournal & L
+                   , char * recvBuffer, char * respBuffer, char * arenaBuffer
+                   , size_t ioBufSize, size_t maxInMemContentLen
+                   , size_t nSlot_
+                   ) : Connection( fd, addr, L, recvBuffer, respBuffer, arenaBuffer
+                                 , ioBufSize, maxInMemContentLen )
+                     , _pendingRead(-1)
+                     , nSlot(nSlot_)
+                     , expired(false)
+                     {
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+    }
+    /// Sets number of bytes read into `recv_window()` (zero for EOF)
+    void pending(ssize_t n) { _pendingRead = n; }
+};
+static_assert( sizeof(URingConnection) <= Connection::kPooledObjectSize
+             , "io_uring connection object does not fit pooled block" );
+
+/// Pooled blocks of connection slots, kept for the ring lifetime
+struct SlotBlocks {
+    util::BufferPool & pool;
+    std::vector<char *> blocks;
+    SlotBlocks(util::BufferPool & pool_, size_t n) : pool(pool_) {
+        blocks.reserve(n);
+        while(blocks.size() < n) blocks.push_back(pool.acquire());
+    }
+    ~SlotBlocks() { for(char * block : blocks) pool.release(block); }
+};
+
+}  // anonymous namespace
+
+bool
+Server::_run_io_uring( const Routes & routes, size_t maxConnections ) {
+    // connection slots are taken from the pool at once: each block keeps
+    // connection object, receive, response and arena buffers; receive
+    // buffers are registered within the ring, so slots are declared before
+    // the ring to outlive it (the pool frees blocks beyond its high-water
+    // mark).
+    SlotBlocks slots(_connBuffers, maxConnections);
+    std::vector<iovec> iovs(maxConnections);
+    for(size_t i = 0; i < maxConnections; ++i) {
+        iovs[i].iov_base = slots.blocks[i] + Connection::kPooledObjectSize;
+        iovs[i].iov_len = _ioBufSize;
+    }
+    URing ring;
+    // one operation is in flight per connection, plus accept and timer
+    int rc = ring.init(maxConnections + 2);
+    if(rc < 0) {
+        _L.warn(util::format("io_uring_setup() failed: %s", strerror(-rc)).c_str());
+        return false;
+    }
+    const bool fixedBuffers = 0 <= syscall( __NR_io_uring_register, ring.fd()
+                                          , IORING_REGISTER_BUFFERS
+                                          , iovs.data(), (unsigned) iovs.size() );
+    if(!fixedBuffers) {
+        int en = errno;
+        _L.warn(util::format("Failed to register IO buffers for io_uring (%s),"
+                    " unregistered buffers will be used.", strerror(en)).c_str());
+    }
+    std::vector<size_t> freeSlots;
+    freeSlots.reserve(maxConnections);
+    for(size_t i = maxConnections; i > 0; --i) freeSlots.push_back(i - 1);
+    // connection objects are placed in their slots, map nodes are recycled
+    std::pmr::unsynchronized_pool_resource nodes;
+    std::pmr::unordered_map<int, URingConnection *> connections(&nodes);
+    util::TimerWheel timers(std::chrono::milliseconds(100), 1024);
+
+    // timeout operation waking the loop on the next tick of timer wheel;
+    // it is armed only while there are deadlines set
+    __kernel_timespec tick;
+    bool tickArmed = false;
+    auto arm_timeout = [&]() {
+        int ms = timers.timeout_ms(std::chrono::steady_clock::now());
+        if(tickArmed || ms < 0) return;
+        tick.tv_sec = ms/1000;
+        tick.tv_nsec = (ms%1000)*1000000L;
+        tickArmed = true;
+        io_uring_sqe * sqe = ring.get_sqe();
+        assert(sqe);
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = reinterpret_cast<uint64_t>(&tick);
+        sqe->len = 1;
+        sqe->user_data = kTimeoutOp;
+    };
+
+    sockaddr_in acceptAddr;
+    socklen_t acceptAddrLen;
+    // Queues submission entries for connection operations. Failure to get
+    // an SQE is not expected as ring has entry for every connection.
+    auto arm_accept = [&]() {
+        io_uring_sqe * sqe = ring.get_sqe();
+        assert(sqe);
+        acceptAddrLen = sizeof(acceptAddr);
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->fd = _sockFD;
+        sqe->addr = reinterpret_cast<uint64_t>(&acceptAddr);
+        sqe->addr2 = reinterpret_cast<uint64_t>(&acceptAddrLen);
+        sqe->accept_flags = SOCK_CLOEXEC;
+        sqe->user_data = (static_cast<uint64_t>(_sockFD) << 2) | kAcceptOp;
+    };
+    auto arm_recv = [&](URingConnection & conn) {
+        io_uring_sqe * sqe = ring.get_sqe();
+        assert(sqe);
+        auto w = conn.recv_window();
+        sqe->opcode = fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+        sqe->fd = conn.fd();
+        sqe->addr = reinterpret_cast<uint64_t>(w.first);
+        sqe->len = w.second;
+        if(fixedBuffers) sqe->buf_index = conn.nSlot;
+        sqe->user_data = (static_cast<uint64_t>(conn.fd()) << 2) | kRecvOp;
+        timers.schedule(conn.fd(), _deadline(conn));
+        arm_timeout();
+    };
+    auto arm_send = [&](URingConnection & conn) {
+        io_uring_sqe * sqe = ring.get_sqe();
+        assert(sqe);
+        // IO vector must stay valid till completion, so it is kept by
+        // connection
+        conn.mh.msg_iovlen = conn.outgoing(conn.iov, MsgSender::kMaxSegments);
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = conn.fd();
+        sqe->addr = reinterpret_cast<uint64_t>(&conn.mh);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = (static_cast<uint64_t>(conn.fd()) << 2) | kSendOp;
+        timers.schedule(conn.fd(), _deadline(conn));
+        arm_timeout();
+    };
+    auto drop = [&](int fd, bool keepSocket) {
+        auto it = connections.find(fd);
+        assert(connections.end() != it);
+        freeSlots.push_back(it->second->nSlot);
+        it->second->~URingConnection();
+        connections.erase(it);
+        timers.cancel(fd);
+        if(!keepSocket) close(fd);
+    };
+
+    _L.info(util::format("HTTP server \"%s:%d\" runs in io_uring mode."
+           , _host.c_str(), (int) _port).c_str() );
+
+    // handles request (partially) received by connection
+    auto on_received = [&](URingConnection & conn) {
+        uint16_t execFlags = 0x0;
+        if(!_process(conn, routes, execFlags)) {
+            arm_recv(conn);  // need more data
+            return;
+        }
+        if(execFlags & kStop) _keepGoing = false;
+        if(execFlags & kNoDispatchResponse) {
+            drop(conn.fd(), execFlags & kKeepClientConnection);
+            return;
+        }
+        arm_send(conn);
+    };
+
+    arm_accept();
+    while( _keepGoing ) {
+        // submit all queued operations in batch, wait for completion(s)
+        rc = ring.submit(1);
+        if(rc < 0) {
+            _L.error(util::format("io_uring_enter() error: %s", strerror(-rc)).c_str());
+            break;
+        }
+        ring.for_each_cqe([&](const io_uring_cqe & cqe) {
+            const int fd = static_cast<int>(cqe.user_data >> 2);
+            const uint64_t op = cqe.user_data & 0x3;
+            if(kAcceptOp == op) {
+                const sockaddr_in clientAddr = acceptAddr;
+                if(_keepGoing) arm_accept();
+                if(cqe.res < 0) {
+                    _L.warn(util::format("accept() error: %s"
+                                , strerror(-cqe.res)).c_str());
+                    return;
+                }
+                ++_stats.nConnections;
+                if(!_admit(connections.size()) || freeSlots.empty()) {
+                    ++_stats.nShedConnections;
+                    if(!_unavailableResponse.empty()) {
+                        _shed(cqe.res);
+                    } else {
+                        _L.warn("Max number of connections reached, closing"
+                                " new connection.");
+                    }
+                    close(cqe.res);
+                    return;
+                }
+                size_t nSlot = freeSlots.back();
+                freeSlots.pop_back();
+                char * block = slots.blocks[nSlot]
+                   , * bufs = block + Connection::kPooledObjectSize;
+                auto ir = connections.emplace(cqe.res, ::new(block) URingConnection(
+                            cqe.res, clientAddr, _L
+                          , bufs, bufs + _ioBufSize, bufs + 2*_ioBufSize
+                          , _ioBufSize, _maxInMemContentLen, nSlot ));
+                arm_recv(*ir.first->second);
+                return;
+            }
+            if(kTimeoutOp == op) {
+                tickArmed = false;
+                // Shut down connections which deadlines are expired, so
+                // operations in flight complete. Connection that did not
+                // receive request in time is responded with 408 then.
+                const auto now = std::chrono::steady_clock::now();
+                timers.expire(now, [&](int cfd) {
+                    auto it = connections.find(cfd);
+                    if(connections.end() == it) return;
+                    URingConnection & conn = *it->second;
+                    const auto deadline = _deadline(conn);
+                    if(deadline > now) {
+                        timers.schedule(cfd, deadline);
+                        return;
+                    }
+                    conn.expired = true;
+                    shutdown(cfd, Connection::kReceiving == conn.state() && !conn.idle()
+                                ? SHUT_RD : SHUT_RDWR );
+                });
+                arm_timeout();
+                return;
+            }
+            auto it = connections.find(fd);
+            if(connections.end() == it) return;
+            URingConnection & conn = *it->second;
+            if(kRecvOp == op) {
+                if(conn.expired) {
+                    conn.expired = false;
+                    if(_deadline_expired(conn)) arm_send(conn);  // send 408
+                    else drop(fd, false);
+                    return;
+                }
+                // zero means closed connection, that `receive()` recognizes
+                if(cqe.res < 0) {
+                    _L.warn(util::format("recv() error for %s: %s"
+                                , conn.ip_str(), strerror(-cqe.res)).c_str());
+                    drop(fd, false);
+                    return;
+                }
+                conn.pending(cqe.res);
+                on_received(conn);
+            } else {
+                assert(kSendOp == op);
+                if(conn.expired) {
+                    _deadline_expired(conn);
+                    drop(fd, false);
+                    return;
+                }
+                if(cqe.res < 0) {
+                    _L.warn(util::format("Error dispatching response to %s: %s"
+                                , conn.ip_str(), strerror(-cqe.res)).c_str());
+                    drop(fd, false);
+                    return;
+                }
+                conn.sent(cqe.res);
+                if(Connection::kDone != conn.state()) {
+                    arm_send(conn);
+                    return;
+                }
+                if(!(conn.keep_alive() && _keepGoing)) {
+                    drop(fd, conn.exec_flags() & kKeepClientConnection);
+                    return;
+                }
+                // persistent connection, handle pipelined request, if any,
+                // or wait for the next one
+                conn.reset();
+                on_received(conn);
+            }
+        });
+    }  // server's "keepGoing"
+    // cancel operations in flight before their connections (referred by
+    // send operations) and slots (read into by the kernel) are released
+    ring.close();
+    for(auto & p : connections) {
+        p.second->~URingConnection();
+        close(p.first);
+    }
+    _L.info("Server shutdown.");
+    return true;
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
+
+#endif  // defined(SYNC_HTTP_SRV_WITH_IO_URING) && SYNC_HTTP_SRV_WITH_IO_URING
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+void
+Server::run_io_uring( const Routes & routes, size_t maxConnections ) {
+    #if defined(SYNC_HTTP_SRV_WITH_IO_URING) && SYNC_HTTP_SRV_WITH_IO_URING
+    if(_run_io_uring(routes, maxConnections)) return;
+    #endif
+    _L.warn("io_uring backend is not available, falling back to blocking mode.");
+    run(routes);
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
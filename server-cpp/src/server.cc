@@ -1,13 +1,31 @@
 #include "sync-http-srv/error.hh"
 #include "sync-http-srv/logging.hh"
 #include "sync-http-srv/server.hh"
+#include "sync-http-srv/connection.hh"
+#include "sync-http-srv/representation-cache.hh"
+#include "sync-http-srv/response-cache.hh"
+#include "sync-http-srv/compression.hh"
+#include "strutil.hh"
 //#include "sync-http-srv/processes-resource.hh"
 
+#include <algorithm>
+#include <charconv>
+#include <climits>
 #include <cstring>
 #include <unordered_map>
 #include <unistd.h>
+#include <poll.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <cassert>
 
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
+
 namespace sync_http_srv {
 namespace util {
 namespace http {
@@ -15,171 +33,309 @@ namespace http {
 //                                                                _____________
 // _____________________________________________________________/ HTTP Message
 
-static std::unordered_map<std::string, Msg::Method> _mtdStr2Code;
-static std::unordered_map<Msg::Method, std::string> _mtdCode2Str;
-
-static std::unordered_map<std::string, Msg::Version> _verStr2Code;
-static std::unordered_map<Msg::Version, std::string> _verCode2Str;
-
-static std::unordered_map<std::string, Msg::StatusCode> _scStr2Code;
-static std::unordered_map<Msg::StatusCode, std::string> _scCode2Str;
-static std::unordered_map<Msg::StatusCode, std::string> _scCode2Vrb;
-
-static void _fill_dicts() {
-    if(!_mtdCode2Str.empty()) return;
-    #define M_add_method(name)                                  \
-    {                                                           \
-        std::string nm = #name;                                 \
-        _mtdCode2Str.emplace(Msg:: name, nm);               \
-        std::transform(nm.begin(), nm.end(), nm.begin(),        \
-                [](unsigned char c){ return std::tolower(c); });\
-        _mtdStr2Code.emplace(nm, Msg:: name);               \
-    }
-    M_na64sw_for_every_http_method(M_add_method);
-    #undef M_add_method
-
-    #define M_add_version(name, code)                           \
-    {                                                           \
-        std::string nm = #name;                                 \
-        std::transform(nm.begin(), nm.end(), nm.begin(),        \
-                [](unsigned char c){ return std::tolower(c); });\
-        _verStr2Code.emplace(nm, Msg:: name);               \
-    }
-    M_na64sw_for_every_http_version(M_add_version);
-    #undef M_add_version
-    _verStr2Code.emplace( "HTTP/0.9", Msg::HTTP_0_9 );
-    _verStr2Code.emplace( "HTTP/1.0", Msg::HTTP_1_0 );
-    _verStr2Code.emplace( "HTTP/1.1", Msg::HTTP_1_1 );
-    _verStr2Code.emplace( "HTTP/2",   Msg::HTTP_2_0 );
-    _verStr2Code.emplace( "HTTP/2.0", Msg::HTTP_2_0 );
-    _verCode2Str.emplace( Msg::HTTP_0_9, "HTTP/0.9" );
-    _verCode2Str.emplace( Msg::HTTP_1_0, "HTTP/1.1" );
-    _verCode2Str.emplace( Msg::HTTP_1_1, "HTTP/1.1" );
-    _verCode2Str.emplace( Msg::HTTP_2_0, "HTTP/2.0" );
-
-    #define M_add_status_code(name, code, verb)                 \
-    {                                                           \
-        std::string nm = #name;                                 \
-        _scCode2Str.emplace(Msg:: name, nm);                \
-        _scCode2Vrb.emplace(Msg:: name, verb);              \
-        std::transform(nm.begin(), nm.end(), nm.begin(),        \
-                [](unsigned char c){ return std::tolower(c); });\
-        _scStr2Code.emplace(nm, Msg:: name );               \
-        std::string v = verb;                                   \
-        std::transform(v.begin(), v.end(), v.begin(),           \
-                [](unsigned char c){ return std::tolower(c); });\
-        _scStr2Code.emplace(v, Msg:: name );                \
-    }
-    M_na64sw_for_every_http_status_code(M_add_status_code);
-    #undef M_add_status_code
-}
-
+namespace {
+/// Compile-time table of method names generated from the X-macro
+constexpr struct { std::string_view name; Msg::Method code; } _gMethods[] = {
+    #define M_method_entry(name) { #name, Msg:: name },
+    M_na64sw_for_every_http_method(M_method_entry)
+    #undef M_method_entry
+};
+
+/// Renders version code (`major*10 + minor`) as "HTTP/<major>.<minor>"
+struct VersionStr {
+    char s[9];
+    constexpr VersionStr(int code) : s{ 'H', 'T', 'T', 'P', '/'
+                                      , char('0' + code/10), '.'
+                                      , char('0' + code%10), '\0' } {}
+};
+}  // anonymous namespace
 
 Msg::Method
-Msg::method_from_str(const std::string & s_) {
-    _fill_dicts();
-    auto s = s_;
-    std::transform(s.begin(), s.end(), s.begin(),
-        [](unsigned char c){ return std::tolower(c); });
-    auto it = _mtdStr2Code.find(s);
-    if(_mtdStr2Code.end() == it) {
-        char errBf[128];
-        snprintf( errBf, sizeof(errBf)
-                , "Method \"%s\" is not supported by server API."
-                , s_.data());
-        throw errors::HTTPUnsupportedMethod(errBf);
-    }
-    return it->second;
+Msg::method_from_str(std::string_view s) {
+    // methods are compared case-insensitively
+    for(const auto & m : _gMethods) {
+        if(m.name.size() != s.size()) continue;
+        size_t i = 0;
+        while(i < s.size() && m.name[i] == std::toupper(static_cast<unsigned char>(s[i]))) ++i;
+        if(i == s.size()) return m.code;
+    }
+    char errBf[128];
+    snprintf( errBf, sizeof(errBf)
+            , "Method \"%.*s\" is not supported by server API."
+            , (int) std::min<size_t>(s.size(), 64), s.data());
+    throw errors::HTTPUnsupportedMethod(errBf);
 }
 
-std::string
+const char *
 Msg::to_str(Method m) {
-    _fill_dicts();
-    auto it = _mtdCode2Str.find(m);
-    assert(_mtdCode2Str.end() != it);
-    return it->second;
+    switch(m) {
+        #define M_method_case(name) case Msg:: name : return #name;
+        M_na64sw_for_every_http_method(M_method_case)
+        #undef M_method_case
+    };
+    assert(false);
+    return "";
 }
 
 Msg::Version
-Msg::version_from_str(const std::string & s) {
-    _fill_dicts();
-    //auto s = s_;
-    //std::transform(s.begin(), s.end(), s.begin(),
-    //    [](unsigned char c){ return std::tolower(c); });
-    auto it = _verStr2Code.find(s);
-    if(_verStr2Code.end() == it) {
-        char errBf[128];
-        snprintf( errBf, sizeof(errBf)
-                , "HTTP version \"%s\" is not supported by server API."
-                , s.data());
-        throw errors::HTTPUnsupportedVersion(errBf);
-    }
-    return it->second;    
+Msg::version_from_str(std::string_view s) {
+    // "HTTP/<major>[.<minor>]" to code of `major*10 + minor`
+    int code = -1;
+    if( s.size() > 5 && !s.compare(0, 5, "HTTP/")
+     && std::isdigit(static_cast<unsigned char>(s[5])) ) {
+        if(6 == s.size()) {
+            code = (s[5] - '0')*10;
+        } else if( 8 == s.size() && '.' == s[6]
+                && std::isdigit(static_cast<unsigned char>(s[7])) ) {
+            code = (s[5] - '0')*10 + (s[7] - '0');
+        }
+    }
+    switch(code) {
+        #define M_version_case(name, code) case code : return Msg:: name;
+        M_na64sw_for_every_http_version(M_version_case)
+        #undef M_version_case
+    };
+    char errBf[128];
+    snprintf( errBf, sizeof(errBf)
+            , "HTTP version \"%.*s\" is not supported by server API."
+            , (int) std::min<size_t>(s.size(), 64), s.data());
+    throw errors::HTTPUnsupportedVersion(errBf);
 }
 
-std::string
+const char *
 Msg::to_str(Version v) {
-    _fill_dicts();
-    auto it = _verCode2Str.find(v);
-    assert(_verCode2Str.end() != it);
-    return it->second;
+    switch(v) {
+        #define M_version_case(name, code)                      \
+            case Msg:: name : {                                 \
+                static constexpr VersionStr str(code);          \
+                return str.s;                                   \
+            }
+        M_na64sw_for_every_http_version(M_version_case)
+        #undef M_version_case
+    };
+    assert(false);
+    return "";
 }
 
-
-std::string
+const char *
 Msg::to_str(StatusCode sc) {
-    _fill_dicts();
-    auto it = _scCode2Vrb.find(sc);
-    assert(_scCode2Str.end() != it);
-    return it->second;
-}
-
-static const std::regex
-    _rxHdrLine(R"~(^\s*([a-zA-Z0-9\-_]+)\s*:\s*([A-Za-z0-9_ :;.,\\/"'?!(){}\[\]@<>=\-+*#$&`|~^%]+)\s*$)~"),
-    //                  ^^^^^^^^^^^^^^^         ^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^
-    //                  Key                     Value
-    _rxRqLine(R"~(^\s*([A-Z]+)\s+([^\s]+)\s+(HTTP[^s]+\s*)$)~"),
-    //                 ^^^^^^     ^^^^^^     ^^^^^^^^^
-    //                 GET        /path/to   HTTP ver.
-    _rxRpLine(R"~(^\s*(HTTP[^s]+)\s+(\d+)\s+(.+)\s*$)~")
-    //                 ^^^^^^^^^^     ^^^    ^^
-    //                 HTTP ver       NSC    Verbose name
-    ;
-
-void
-Msg::_consider_header_line(const std::string & line) {
-    std::smatch m;
-    if(std::regex_match(line, m, _rxHdrLine )) {
-        // This is header "key:value" line
-        std::vector<std::string> groups(m.begin(), m.end());
-        const std::string & key = groups[1]
-                        , & value = groups[2]
-                        ;
+    switch(sc) {
+        #define M_status_case(name, code, verb) case Msg:: name : return verb;
+        M_na64sw_for_every_http_status_code(M_status_case)
+        #undef M_status_case
+    };
+    throw errors::HTTPUnknownStatusCode(util::format("Unknown HTTP status"
+                " code %d", (int) sc).c_str());
+}
+
+std::string_view
+Msg::status_line(StatusCode sc) {
+    switch(sc) {
+        #define M_status_case(name, code, verb) \
+            case Msg:: name : return "HTTP/1.1 " #code " " verb "\r\n";
+        M_na64sw_for_every_http_status_code(M_status_case)
+        #undef M_status_case
+    };
+    throw errors::HTTPUnknownStatusCode(util::format("Unknown HTTP status"
+                " code %d", (int) sc).c_str());
+}
+
+//                                                      _______________________
+// ___________________________________________________/ Header lines scanning
+
+namespace {
+
+/// Table of `tchar` (RFC 9110, 5.6.2) -- chars permitted in tokens
+struct TokenChars {
+    bool is[256];
+    constexpr TokenChars() : is{} {
+        for(int c = '0'; c <= '9'; ++c) is[c] = true;
+        for(int c = 'a'; c <= 'z'; ++c) is[c] = is[c - 'a' + 'A'] = true;
+        for(const char * c = "!#$%&'*+-.^_`|~"; *c; ++c) is[(unsigned char) *c] = true;
+    }
+};
+constexpr TokenChars _gTChars;
+
+/// Returns pointer to first non-`tchar` in `[b, e)`
+inline const char *
+_scan_token(const char * b, const char * e) {
+    while(b != e && _gTChars.is[(unsigned char) *b]) ++b;
+    return b;
+}
+
+///\brief Returns pointer to first control char in `[b, e)`
+///
+/// With `kStopAtSpace` set, the space and horizontal tab are considered
+/// as terminators too (request target), otherwise horizontal tab is
+/// permitted (field value, reason phrase). Bytes above 0x7f (`obs-text`)
+/// are passed. Buffer is scanned by 16 bytes with SSE2, if available.
+template<bool kStopAtSpace> const char *
+_scan_ctl(const char * b, const char * e) {
+    #ifdef __SSE2__
+    const __m128i lim = _mm_set1_epi8(kStopAtSpace ? 0x20 : 0x1f)
+                , tab = _mm_set1_epi8('\t')
+                , del = _mm_set1_epi8(0x7f)
+                ;
+    for(; e - b >= 16; b += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+        // unsigned `v <= lim` as there is no unsigned comparison in SSE2
+        __m128i bad = _mm_cmpeq_epi8(_mm_min_epu8(v, lim), v);
+        if(!kStopAtSpace) bad = _mm_andnot_si128(_mm_cmpeq_epi8(v, tab), bad);
+        bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, del));
+        if(const int mask = _mm_movemask_epi8(bad))
+            return b + __builtin_ctz(mask);
+    }
+    #endif
+    for(; b != e; ++b) {
+        const unsigned char c = *b;
+        if(0x7f == c) break;
+        if(c < 0x20 && (kStopAtSpace || '\t' != c)) break;
+        if(kStopAtSpace && ' ' == c) break;
+    }
+    return b;
+}
+
+///\brief Returns pointer to line feed in `[b, e)`, `nullptr` if there is none
+///
+/// Sets `colon` to the first colon preceding line feed (`nullptr` if there
+/// is none), so header line is delimited and split in a single pass. Buffer
+/// is scanned by 16 bytes with SSE2, if available.
+inline const char *
+_scan_line(const char * b, const char * e, const char *& colon) {
+    colon = nullptr;
+    #ifdef __SSE2__
+    const __m128i lf = _mm_set1_epi8('\n')
+                , cl = _mm_set1_epi8(':')
+                ;
+    for(; e - b >= 16; b += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+        const unsigned lfMask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        if(!colon) {
+            // colons past line feed belong to the next line
+            unsigned clMask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, cl));
+            if(lfMask) clMask &= (lfMask & -lfMask) - 1;
+            if(clMask) colon = b + __builtin_ctz(clMask);
+        }
+        if(lfMask) return b + __builtin_ctz(lfMask);
+    }
+    #endif
+    for(; b != e; ++b) {
+        if('\n' == *b) return b;
+        if(':' == *b && !colon) colon = b;
+    }
+    return nullptr;
+}
+
+/// Skips spaces and horizontal tabs
+inline const char *
+_skip_ows(const char * b, const char * e) {
+    while(b != e && (' ' == *b || '\t' == *b)) ++b;
+    return b;
+}
+
+/// Returns end of `HTTP/<digits>[.<digits>]` version at the beginning of
+/// span, or `b` if span does not start with protocol version
+inline const char *
+_scan_version(const char * b, const char * e) {
+    if(e - b < 6 || memcmp(b, "HTTP/", 5)) return b;
+    const char * c = b + 5;
+    while(c != e && std::isdigit((unsigned char) *c)) ++c;
+    if(c == b + 5) return b;
+    if(c == e || '.' != *c) return c;
+    const char * m = ++c;
+    while(c != e && std::isdigit((unsigned char) *c)) ++c;
+    return c == m ? b : c;
+}
+
+[[noreturn]] void
+_bad_header_line(const char * b, const char * e, const char * what) {
+    char errbf[256];
+    snprintf(errbf, sizeof(errbf), "%s: \"%.*s\"", what
+            , (int) std::min<ptrdiff_t>(e - b, 128), b);
+    throw errors::RequestError(errbf);
+}
+
+}  // anonymous namespace
+
+void
+Msg::_consider_header_line( const char * lb, const char * le, bool startLine
+                          , const char * colon ) {
+    if(!startLine) {
+        // This is header "key:value" line; no whitespace permitted between
+        // the name and colon
+        if(!colon) colon = static_cast<const char *>(memchr(lb, ':', le - lb));
+        if(!colon || colon == lb || colon == le || _scan_token(lb, colon) != colon)
+            _bad_header_line(lb, le, "Bad header field name");
+        const char * c = colon;
+        const char * vb = _skip_ows(c + 1, le)
+                 , * ve = le
+                 ;
+        while(ve != vb && (' ' == *(ve-1) || '\t' == *(ve-1))) --ve;
+        if(_scan_ctl<false>(vb, ve) != ve)
+            _bad_header_line(lb, le, "Bad header field value");
+        const std::string_view key(lb, c - lb), value(vb, ve - vb);
+        const bool length = _iequals("content-length", key);
+        std::string_view prev;
+        if((length || _iequals("transfer-encoding", key)) && _headers.get(key, prev)) {
+            // Repeated framing fields must not make peers disagree on
+            // message length (RFC 9112, 6.3): Content-Length values must be
+            // the same, Transfer-Encoding lists are combined (RFC 9110, 5.3)
+            if(length) {
+                if(prev != value)
+                    _bad_header_line(lb, le, "Conflicting Content-Length values");
+                return;
+            }
+            std::pmr::string list(prev, _mr);
+            list.append(", ", 2).append(value);
+            set_header(key, list);
+            return;
+        }
         set_header(key, value);
-    } else if(std::regex_match(line, m, _rxRqLine)) {
-        // This is 1st line in request
-        std::vector<std::string> groups(m.begin(), m.end());
-        _consider_request_header(groups);
-    } else if(std::regex_match(line, m, _rxRpLine)) {
-        // This is 1st line in response
-        std::vector<std::string> groups(m.begin(), m.end());
-        _consider_response_header(groups);
-    } else {
-        char errbf[256];
-        snprintf(errbf, sizeof(errbf), "Header line does not match any"
-                " of expected patterns: \"%s\"", line.c_str());
-        throw errors::RequestError(errbf);
+        return;
+    }
+    if(const char * ve = _scan_version(lb, le); ve != lb) {
+        // This is 1st line in response: version, status code and
+        // (possibly empty) reason phrase
+        if(ve == le || ' ' != *ve) _bad_header_line(lb, le, "Bad status line");
+        const char * cb = _skip_ows(ve, le)
+                 , * ce = cb
+                 ;
+        while(ce != le && ce - cb < 3 && std::isdigit((unsigned char) *ce)) ++ce;
+        if(ce - cb != 3 || (ce != le && ' ' != *ce))
+            _bad_header_line(lb, le, "Bad status code");
+        const char * rb = _skip_ows(ce, le);
+        if(_scan_ctl<false>(rb, le) != le)
+            _bad_header_line(lb, le, "Bad reason phrase");
+        _consider_response_header( std::string_view(lb, ve - lb)
+                                 , std::string_view(cb, ce - cb)
+                                 , std::string_view(rb, le - rb) );
+        return;
     }
+    // This is 1st line in request: method, request target and version
+    const char * me = _scan_token(lb, le);
+    if(me == lb || me == le || ' ' != *me)
+        _bad_header_line(lb, le, "Bad request method");
+    const char * tb = _skip_ows(me, le)
+             , * te = _scan_ctl<true>(tb, le)
+             ;
+    if(te == tb || te == le || (' ' != *te && '\t' != *te))
+        _bad_header_line(lb, le, "Bad request target");
+    const char * vb = _skip_ows(te, le);
+    if(vb == le || _scan_version(vb, le) != le)
+        _bad_header_line(lb, le, "Bad request protocol version");
+    _consider_request_header( std::string_view(lb, me - lb)
+                            , std::string_view(tb, te - tb)
+                            , std::string_view(vb, le - vb) );
 }
 
 void
-Msg::_consider_request_header(const std::vector<std::string> &) {
+Msg::_consider_request_header(std::string_view, std::string_view, std::string_view) {
     throw errors::GenericHTTPError("Call to request header 1st line's treatment for"
             " non-request message");
 }
 
 void
-Msg::_consider_response_header(const std::vector<std::string> &) {
+Msg::_consider_response_header(std::string_view, std::string_view, std::string_view) {
     throw errors::GenericHTTPError("Call to response header 1st line's treatment for"
             " non-response message");
 }
@@ -204,20 +360,89 @@ Msg::has_content() const {
     return _content != nullptr;
 }
 
+const Msg::Headers::Span *
+Msg::Headers::_find(std::string_view key) const {
+    for(const Span & s : _spans) {
+        if( s.keyLen == key.size()
+         && _iequals(std::string_view(_block.data() + s.keyOffset, s.keyLen), key) )
+            return &s;
+    }
+    return nullptr;
+}
+
+void
+Msg::Headers::set(std::string_view key, std::string_view value) {
+    if(_spans.empty()) {
+        // typical header block fits without reallocation
+        _block.reserve(512);
+        _spans.reserve(16);
+    }
+    Span * s = const_cast<Span *>(_find(key));
+    if(!s) {
+        _spans.push_back(Span{ (uint32_t) _block.size(), (uint32_t) key.size(), 0, 0 });
+        s = &_spans.back();
+        for(char c : key) _block.push_back(_lower(c));
+    }
+    // replaced value remains in block till message is destroyed
+    s->valueOffset = _block.size();
+    s->valueLen = value.size();
+    _block.append(value.data(), value.size());
+}
+
+void
+Msg::Headers::erase(std::string_view key) {
+    const Span * s = _find(key);
+    if(s) _spans.erase(_spans.begin() + (s - _spans.data()));
+}
+
+bool
+Msg::Headers::get(std::string_view key, std::string_view & value) const {
+    const Span * s = _find(key);
+    if(!s) return false;
+    value = std::string_view(_block.data() + s->valueOffset, s->valueLen);
+    return true;
+}
+
+void
+Msg::set_header(std::string_view key, std::string_view value) {
+    _headers.set(key, value);
+    // cache values considered by message parsing and dispatch
+    if(_iequals("content-length", key)) {
+        size_t len = 0;
+        auto r = std::from_chars(value.data(), value.data() + value.size(), len);
+        if(value.empty() || r.ec != std::errc() || r.ptr != value.data() + value.size())
+            throw errors::RequestError("Bad Content-Length header value.");
+        _contentLength = len;
+    } else if(_iequals("transfer-encoding", key)) {
+        // "chunked" must be the final transfer coding
+        while(!value.empty() && (' ' == value.back() || '\t' == value.back()))
+            value.remove_suffix(1);
+        _chunked = value.size() >= 7
+                && _iequals("chunked", value.substr(value.size() - 7))
+                && ( 7 == value.size()
+                  || ',' == value[value.size() - 8]
+                  || std::isspace(static_cast<unsigned char>(value[value.size() - 8])) );
+    }
+}
+
 void
-Msg::set_header(std::string key, const std::string &value) {
-    std::transform(key.begin(), key.end(), key.begin(),
-        [](unsigned char c){ return std::tolower(c); });
-    _headers[key] = value;
+Msg::erase_header(std::string_view key) {
+    _headers.erase(key);
+    if(_iequals("content-length", key)) _contentLength = kNoContentLength;
+    else if(_iequals("transfer-encoding", key)) _chunked = false;
 }
 
 std::string
-Msg::get_header(std::string key, const std::string & dftVal) const {
-    std::transform(key.begin(), key.end(), key.begin(),
-        [](unsigned char c){ return std::tolower(c); });
-    auto it = _headers.find(key);
-    if(_headers.end() == it) return dftVal;
-    return it->second;
+Msg::get_header(std::string_view key, const std::string & dftVal) const {
+    std::string_view value;
+    if(!_headers.get(key, value)) return dftVal;
+    return std::string(value);
+}
+
+std::string_view
+Msg::get_header_view(std::string_view key, std::string_view dftVal) const {
+    std::string_view value;
+    return _headers.get(key, value) ? value : dftVal;
 }
 
 void
@@ -227,28 +452,50 @@ Msg::append_content_data( const char * data
                         ) {
     if(0 == n) return;
     if(!_content) {
-        size_t len = std::stoul(get_header("Content-Length", "0"));
-        if(0 == len) {
+        // length of chunked content is not known in advance, it is kept in
+        // memory till it exceeds the limit
+        const bool isChunked = chunked();
+        size_t len = isChunked || kNoContentLength == _contentLength
+                   ? 0 : _contentLength;
+        if(0 == len && !isChunked) {
             throw errors::RequestError("Content is not expected for this"
                     " response");
         }
         if(len > maxInMemContentLen) {
-            throw std::runtime_error("TODO: tmp-file request content");  // TODO
+            _content = std::make_shared<TmpFileContent>();
         } else {
             _content = std::make_shared<StringContent>();
         }
+    } else if( _content->size() + n > maxInMemContentLen
+            && std::dynamic_pointer_cast<StringContent>(_content) ) {
+        // move chunked content to file
+        auto fileContent = std::make_shared<TmpFileContent>();
+        const char * ptr;
+        size_t len = _content->segment(0, ptr);
+        if(len) fileContent->append(ptr, len);
+        _content = fileContent;
     }
     _content->append(data, n);
 }
 
+void
+Msg::_write_fields(std::pmr::string & out) const {
+    for(const auto & p : headers()) {
+        out.append(p.first).append(": ", 2).append(p.second).append("\r\n", 2);
+    }
+    out.append(_headerBlock).append("\r\n", 2);
+}
+
+void
+Msg::write_header(std::pmr::string & out) const {
+    _write_fields(out);
+}
+
 std::string
 Msg::header() const {
-    std::ostringstream oss;
-    for (const auto & p : headers()) {
-        oss << p.first << ": " << p.second << "\r\n";
-    }
-    oss << "\r\n";
-    return oss.str();
+    std::pmr::string hdr;
+    write_header(hdr);
+    return std::string(hdr);
 }
 
 void
@@ -256,150 +503,68 @@ Msg::receive( int clientFD
             , char * buffer, size_t bufLen
             , size_t maxInMemContentLen
             , iJournal & L
+            , uint32_t timeout
             ) {
-    bool reading = true
-       , headersReceived = false  // set to `true' once all the headers are recieved
-       ;
-    char * recvBf = buffer;
-    size_t expectedLength = 0
-         , receivedContentLength = 0
-         , totalBytesSent = 0
+    MsgParser parser(*this, maxInMemContentLen);
+    size_t nInBuf = 0  // number of bytes kept in buffer
+         , totalBytesReceived = 0
          ;
-    while(reading) {
+    const auto deadline = std::chrono::steady_clock::now()
+                        + std::chrono::seconds(timeout);
+    while(!parser.done()) {
+        if(nInBuf == bufLen) {
+            // header line does not fit the buffer
+            throw errors::RequestHeaderIsTooLong();
+        }
         // recieve HTTP data from request
         ssize_t len = recv( clientFD
-                          , recvBf
-                          , bufLen - (recvBf - buffer)
+                          , buffer + nInBuf
+                          , bufLen - nInBuf
                           , 0
                           );
-        if(0 == len && 0 == totalBytesSent) {
-            L.debug( "Client closed connection with no data sent." );
+        if(0 == len) {
+            if(0 == totalBytesReceived)
+                L.debug( "Client closed connection with no data sent." );
             throw errors::ClientClosedConnection();
         } else if(len < 0) {
             int en = errno;
-            if( errno == EAGAIN || errno == EWOULDBLOCK) {  // retry
-                L.debug( "client's socket recv() returned"
-                         " with EAGAIN/EWOULDBLOCK" );
+            if( en == EINTR ) continue;
+            if( en == EAGAIN || en == EWOULDBLOCK ) {
+                // wait for data instead of spinning on non-blocking socket
+                int timeoutMs = -1;
+                if(timeout) {
+                    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                            deadline - std::chrono::steady_clock::now()).count();
+                    if(left <= 0) throw errors::RequestTimeout();
+                    timeoutMs = (int) left;
+                }
+                pollfd pfd;
+                pfd.fd = clientFD;
+                pfd.events = POLLIN;
+                if(0 == poll(&pfd, 1, timeoutMs)) throw errors::RequestTimeout();
                 continue;
             } else {  // other error
                 L.warn(util::format("recv() error: %s", strerror(en)).c_str());
                 throw errors::ClientSocketError(strerror(en));
             }
         }
-        totalBytesSent += len;
-        if(!headersReceived) {
-            const char * lastBgn = buffer;
-            if( L.debug_enabled() ) {
-                std::ostringstream ossd;
-                ossd << "Message in buffer: \"";
-                if(buffer != recvBf) {
-                    ossd << "[" << std::string(buffer, recvBf) << "]";
-                }
-                ossd << std::string(recvBf, recvBf + len) << "\"";
-                L.debug(ossd.str().c_str());
-            } // (dbg) httpServer.messageParsing
-            for(const char * c = buffer; c != recvBf + len; ++c) {
-                if(*c != '\n') continue;
-                if(c == buffer) continue;
-                // It may denote end of some header line OR end of header
-                // lines. Depending on whether rewquest is using CRLF or just
-                // LF, latter case can be recognized by difference from
-                // `lastBgn': 
-                //      "...blah\r\n\r\n"
-                //                 ^   ^ => (2 == c - lastBgn && *(c-1) == '\r' )
-                //      "...blah\n\n"
-                //               ^ ^ => (1 == c - lastBgn)
-                if( ((c-buffer > 2) && (*c == '\n' && *(c-1) == '\r' && *(c-2) == '\n' ))  // sic!
-                 || ((c-buffer > 0) && (*c == '\n' && *(c-1) == '\n'))
-                  ) {  // we're done with headers
-                    lastBgn = c+1;
-                    // ^^^ shal guarantee that `lastBgn' will point on the
-                    //     pl beginning
-                    L.debug("Request headers parsed.");
-                    headersReceived = true;
-                    break;
-                }
-                std::string hdrLine = std::string(lastBgn, c);
-                lastBgn = c;
-
-                //trim(hdrLine);
-                hdrLine.erase(hdrLine.begin(), std::find_if(hdrLine.begin(), hdrLine.end(), [](unsigned char ch) {
-                    return !std::isspace(ch);
-                }));
-                hdrLine.erase(std::find_if(hdrLine.rbegin(), hdrLine.rend(), [](unsigned char ch) {
-                    return !std::isspace(ch);
-                }).base(), hdrLine.end());
-
-                if(hdrLine.empty()) continue;
-                _consider_header_line(hdrLine);
-                if( L.debug_enabled() ) {
-                    L.debug(util::format("header line \"%s\" considered"
-                                , hdrLine.c_str() ).c_str());
-                }
+        if( L.debug_enabled() ) {
+            std::ostringstream ossd;
+            ossd << "Message in buffer: \"";
+            if(nInBuf) {
+                ossd << "[" << std::string(buffer, buffer + nInBuf) << "]";
             }
-            if(lastBgn == buffer) {
-                throw errors::RequestHeaderIsTooLong();
-            }
-            // Now `lastBgn' points on the end of last portion of data being
-            // parsed:
-            //  1. It may point on the remanant of header(s) -- we keep this
-            //     data piece in the read buffer and continue receiving.
-            //  2. It may point at the beginning of the content -- we shall
-            //     start to fill request content.
-            //  3. It may point to the very end of the message received
-            ssize_t tailLength = len - (lastBgn - recvBf);
-            assert(tailLength >= 0);
-            if( tailLength > 0 ) {
-                memmove( buffer, lastBgn, tailLength );
-                recvBf = buffer + tailLength;
-                len = tailLength;
-            } else if( tailLength == 0 ) {
-                recvBf = buffer;
-                len = 0;
-            }
-            expectedLength = std::stoul(get_header("Content-Length", "0"));
-            if(len == 0 && expectedLength) continue;
-        }
-        if(headersReceived) {
-            // TODO: If `Transfer-Encoding' header is given and has other than
-            // "identity" value,  then the transfer-length is defined by use of
-            // the "chunked" transfer-coding (section 3.6), unless the message
-            // is terminated by closing the connection.
-            if(0 != len) {
-                if( L.debug_enabled() ) {
-                    std::ostringstream ossd;
-                    ossd << "Appending to pl " << len << "b: ";
-                    for(const char * c = buffer; c - buffer != len; ++c ) {
-                        if(!std::isspace(*c)) {
-                            ossd << "'" << *c << "'";
-                        } else {
-                            ossd << "' '";
-                        }
-                        ossd << " (" << (int) *c << "), ";
-                    }
-                    L.debug(ossd.str().c_str());
-                }  // (dbg) httpServer.messageParsing
-                append_content_data(buffer, len, maxInMemContentLen);
-                receivedContentLength += len;
-                recvBf = buffer;
-            }
-            // 0 bytes recvd
-            if(expectedLength == receivedContentLength) {
-                // got all the data
-                return;
-            } 
-            //else {
-            //    if(0 == len) {
-            //        throw errors::RequestError("Insufficient request body length.");
-            //    }
-            //}
+            ossd << std::string(buffer + nInBuf, buffer + nInBuf + len) << "\"";
+            L.debug(ossd.str().c_str());
+        } // (dbg) httpServer.messageParsing
+        nInBuf += len;
+        totalBytesReceived += len;
+        size_t used = parser.feed(buffer, nInBuf, L);
+        if(used) {
+            memmove(buffer, buffer + used, nInBuf - used);
+            nInBuf -= used;
         }
-    }  // while(reading)
-    //_L << log4cpp::Priority::DEBUG << "Received from " << clientIPStr
-    //    << ": \"\"\""
-    //    << std::string(buffer.data(), nReceived)
-    //    << "\"\"\"";
-    throw std::logic_error("Prohibited loop exit of socket listening routine.");
+    }
 }
 
 void
@@ -407,77 +572,402 @@ Msg::dispatch( int clientFD
              , char * buffer
              , size_t bufSize
              , iJournal & L
+             , uint32_t timeout
              ) const {
     if(0 >= bufSize) throw std::runtime_error("Bad buffer length");
     if(!buffer) throw std::runtime_error("Null pointer provided for dispatch buffer");
     if(!clientFD) throw std::runtime_error("Null FD for destination socket");
-    std::string hdrsStr = header();  // used to keep only response headers
-    // Dispatch headers; we don't use dispatch buffer here as they're already
-    // in memory
-    bool sending = true;
-    ssize_t sent;
-    while(sending) {
-        sent = send(clientFD, hdrsStr.c_str(), hdrsStr.size(), 0x0);
-        if(sent == -1) {
-            int en = errno;
-            if( en == EAGAIN || en == EWOULDBLOCK ) continue;
-            L.warn(util::format("Error dispatching response headers:"
-                        " %s, giving up", strerror(en)).c_str());
-            return;
-        } else if( sent != (ssize_t) hdrsStr.size() ) {
-            // this must be highly improbable error, according to the specs
-            L.error("send() have sent less bytes that was ordered to; giving up.");
-            return;
+    MsgSender sender(*this);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+    try {
+        size_t nSent = 0;
+        while(!sender.send_some(clientFD, buffer, bufSize, L)) {
+            // client must accept data with no longer pauses than timeout
+            if(sender.bytes_sent() != nSent) {
+                nSent = sender.bytes_sent();
+                deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+            }
+            // wait for socket to become writable
+            int timeoutMs = -1;
+            if(timeout) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                if(left <= 0) throw errors::RequestTimeout();
+                timeoutMs = (int) left;
+            }
+            pollfd pfd;
+            pfd.fd = clientFD;
+            pfd.events = POLLOUT;
+            if(0 == poll(&pfd, 1, timeoutMs)) throw errors::RequestTimeout();
         }
-        break;
+    } catch( errors::ClientSocketError & e ) {
+        L.warn(util::format("Error dispatching message: %s, giving up"
+                    , e.what()).c_str());
+        return;
     }
     if(!(has_content() && content()->size())) {
         L.debug("Sent response with empty body.");
+    }
+}
+
+//                                                      _______________________
+// ___________________________________________________/ Incremental Parse/Send
+
+MsgParser::MsgParser(Msg & msg, size_t maxInMemContentLen, size_t maxContentLen)
+        : _msg(msg)
+        , _maxInMemContentLen(maxInMemContentLen)
+        , _maxContentLen(maxContentLen)
+        , _state(kHeaders)
+        , _nLines(0)
+        , _expectedLength(0)
+        , _receivedLength(0)
+        {}
+
+void
+MsgParser::_headers_done(iJournal & L) {
+    L.debug("Request headers parsed.");
+    // If `Transfer-Encoding' header is given and has other than "identity"
+    // codings, then the transfer-length is defined by use of the "chunked"
+    // transfer-coding. No other coding is supported, so codings applied
+    // before "chunked" can not be decoded.
+    std::string_view te = _msg.get_header_view("transfer-encoding");
+    // Message with `Content-Length` as well may be an attempt of request
+    // smuggling (RFC 9112, 6.1), so it is rejected rather than the length
+    // being ignored
+    if(!te.empty() && Msg::kNoContentLength != _msg.content_length()) {
+        throw errors::RequestError("Both Transfer-Encoding and Content-Length"
+                " are given.");
+    }
+    bool identity = true;
+    while(!te.empty()) {
+        const size_t e = te.find(',');
+        std::string_view coding = te.substr(0, e);
+        te.remove_prefix(std::string_view::npos == e ? te.size() : e + 1);
+        // transfer parameters are not considered
+        coding = _trim(coding.substr(0, coding.find(';')));
+        if(coding.empty() || _iequals("identity", coding)) continue;
+        // "chunked" must be applied once, as the final coding
+        if(!identity || !_iequals("chunked", coding) || !_msg.chunked()) {
+            throw errors::RequestError("Unsupported transfer coding."
+                    , Msg::NotImplemented);
+        }
+        identity = false;
+    }
+    if(!identity) {
+        _state = kChunkSize;
         return;
     }
-    sending = true;
-    size_t sentContentBytes = 0;
-    while(sending) {
-        size_t toSend
-            = content()->copy_to(buffer, bufSize, sentContentBytes);
-        assert(0 != toSend);  // we're done
-        sent = send( clientFD  // TODO: server can get SIGPIPE here
-                   , buffer
-                   , toSend
-                   , 0x0
-                   );
-        if(sent == -1) {
-            int en = errno;
-            if( en == EAGAIN || en == EWOULDBLOCK ) continue;
-            L.warn(util::format("Error dispatching response body: %s, giving"
-                        " up.", strerror(en)).c_str());
+    // `Content-Length` value is validated once header is set
+    _expectedLength = Msg::kNoContentLength == _msg.content_length()
+                    ? 0 : _msg.content_length();
+    if(_expectedLength > _maxContentLen) {
+        throw errors::RequestError("Request content is too large."
+                , Msg::PayloadTooLarge);
+    }
+    _state = _expectedLength ? kContent : kDone;
+}
+
+void
+MsgParser::_chunk_line(const char * lb, const char * le, iJournal & L) {
+    switch(_state) {
+    case kChunkEnd:
+        if(lb != le) throw errors::RequestError("Bad chunk terminator.");
+        _state = kChunkSize;
+        return;
+    case kChunkSize: {
+        // chunk extensions (after `;`) are ignored
+        size_t size = 0;
+        const char * c = lb;
+        for(; c != le && std::isxdigit(static_cast<unsigned char>(*c)); ++c) {
+            if(size >> (sizeof(size_t)*8 - 4))
+                throw errors::RequestError("Chunk size is too large.");
+            const int ch = std::tolower(static_cast<unsigned char>(*c));
+            size = size*16 + (std::isdigit(ch) ? ch - '0' : ch - 'a' + 10);
+        }
+        if( c == lb || (c != le && ';' != *c
+                    && !std::isspace(static_cast<unsigned char>(*c))) ) {
+            throw errors::RequestError("Bad chunk size line.");
+        }
+        if( L.debug_enabled() ) {
+            L.debug(util::format("Chunk of %zub expected", size).c_str());
+        }  // (dbg) httpServer.messageParsing
+        if(!size) {
+            _state = kTrailers;  // last chunk
             return;
-        } else if(sent > 0) {
-            sentContentBytes += sent;
+        }
+        // chunks received so far are appended to content already
+        const size_t received = _msg.has_content() ? _msg.content()->size() : 0;
+        if(size > _maxContentLen - received) {
+            throw errors::RequestError("Request content is too large."
+                    , Msg::PayloadTooLarge);
+        }
+        _expectedLength = size;
+        _receivedLength = 0;
+        _state = kChunkData;
+        return;
+    }
+    case kTrailers:
+        // trailer fields are not considered, blank line ends the message
+        if(lb == le) _state = kDone;
+        return;
+    default:
+        assert(false);
+    };
+}
+
+size_t
+MsgParser::feed(const char * data, size_t n, iJournal & L) {
+    const char * c = data
+             , * const end = data + n
+             ;
+    while(kHeaders == _state && c != end) {
+        const char * colon;
+        const char * nl = _scan_line(c, end, colon);
+        if(!nl) break;  // incomplete line, wait for more data
+        // trim trailing whitespace, including CR of CRLF
+        const char * lb = c, * le = nl;
+        c = nl + 1;
+        while(le != lb && std::isspace(static_cast<unsigned char>(*(le-1)))) --le;
+        if(lb == le) {
+            // Blank line denotes end of headers; leading blank lines
+            // preceding 1st line are tolerated
+            if(!_nLines) continue;
+            _headers_done(L);
+            break;
+        }
+        // leading whitespace is an obsolete line folding (RFC 9112, 5.2)
+        if(' ' == *lb || '\t' == *lb)
+            throw errors::RequestError("Obsolete line folding is not supported.");
+        // colon found within trimmed whitespace is no delimiter
+        _msg._consider_header_line(lb, le, !_nLines, colon && colon < le ? colon : le);
+        ++_nLines;
+        if( L.debug_enabled() ) {
+            L.debug(util::format("header line \"%.*s\" considered"
+                        , (int) (le - lb), lb ).c_str());
+        }
+    }
+    while(kHeaders != _state && kDone != _state && c != end) {
+        if(kContent == _state || kChunkData == _state) {
+            size_t len = std::min<size_t>(end - c, _expectedLength - _receivedLength);
+            if( L.debug_enabled() ) {
+                L.debug(util::format("Appending to pl %zub", len).c_str());
+            }  // (dbg) httpServer.messageParsing
+            _msg.append_content_data(c, len, _maxInMemContentLen);
+            _receivedLength += len;
+            c += len;
+            if(_receivedLength == _expectedLength)
+                _state = kContent == _state ? kDone : kChunkEnd;
+            continue;
+        }
+        // chunk size line, chunk terminator or trailer line
+        const char * nl = static_cast<const char *>(memchr(c, '\n', end - c));
+        if(!nl) {
+            // size line is short, do not wait for endless one
+            if(kTrailers != _state && end - c > 1024)
+                throw errors::RequestError("Chunk size line is too long.");
+            break;  // incomplete line, wait for more data
+        }
+        const char * lb = c, * le = nl;
+        c = nl + 1;
+        while(lb != le && std::isspace(static_cast<unsigned char>(*lb))) ++lb;
+        while(le != lb && std::isspace(static_cast<unsigned char>(*(le-1)))) --le;
+        _chunk_line(lb, le, L);
+    }
+    return c - data;
+}
+
+MsgSender::MsgSender(const Msg & msg, std::pmr::memory_resource * mr)
+        : _msg(msg)
+        , _header(mr)
+        , _headerSent(0)
+        , _contentSent(0)
+        , _contentSize(msg.has_content() && !msg.content()->streamed()
+                      ? msg.content()->size() : 0)
+        , _streamed(msg.has_content() && msg.content()->streamed())
+        , _chunked(_streamed && msg.chunked())
+        , _stagedBegin(0)
+        , _stagedEnd(0)
+        , _exhausted(!_streamed)
+        {
+    // typical response header fits without reallocation
+    _header.reserve(512);
+    msg.write_header(_header);
+}
+
+size_t
+MsgSender::_pull(char * dest, size_t maxLen) {
+    try {
+        return _msg.content()->pull(dest, maxLen);
+    } catch( std::exception & e ) {
+        // header is already sent, so the only option is to abort dispatch
+        throw errors::ClientSocketError(util::format("error producing message"
+                    " content: %s", e.what()).c_str());
+    }
+}
+
+void
+MsgSender::_stage(char * buffer, size_t bufSize) {
+    assert(_stagedBegin == _stagedEnd && !_exhausted);
+    _stagedBegin = _stagedEnd = 0;
+    if(!_chunked) {
+        _stagedEnd = _pull(buffer, bufSize);
+        if(!_stagedEnd) _exhausted = true;
+        return;
+    }
+    // chunk is framed in place: data are pulled leaving room for the size
+    // line in front of them and for line break after them
+    const size_t kSizeLineLen = 2*sizeof(size_t) + 2;
+    if(bufSize <= kSizeLineLen + 2) {
+        throw errors::GenericRuntimeError("Dispatch buffer is too small for"
+                " chunked transfer coding.");
+    }
+    size_t len = _pull(buffer + kSizeLineLen, bufSize - kSizeLineLen - 2);
+    if(!len) {
+        // last chunk with no trailer
+        memcpy(buffer, "0\r\n\r\n", 5);
+        _stagedEnd = 5;
+        _exhausted = true;
+        return;
+    }
+    char sizeLine[kSizeLineLen + 1];
+    const int n = snprintf(sizeLine, sizeof(sizeLine), "%zx\r\n", len);
+    _stagedBegin = kSizeLineLen - n;
+    memcpy(buffer + _stagedBegin, sizeLine, n);
+    memcpy(buffer + kSizeLineLen + len, "\r\n", 2);
+    _stagedEnd = kSizeLineLen + len + 2;
+}
+
+bool
+MsgSender::done() const {
+    return _headerSent == _header.size()
+        && (_streamed || _contentSent == _contentSize)
+        && _exhausted && _stagedBegin == _stagedEnd;
+}
+
+size_t
+MsgSender::next_segments( iovec * iov, size_t maxSegments
+                        , char * buffer, size_t bufSize
+                        , bool stageFiles ) {
+    size_t n = 0;
+    // we don't use dispatch buffer for headers as they're already in memory
+    if(n < maxSegments && _headerSent < _header.size()) {
+        iov[n].iov_base = const_cast<char *>(_header.data() + _headerSent);
+        iov[n].iov_len = _header.size() - _headerSent;
+        ++n;
+    }
+    if(_streamed) {
+        if(n == maxSegments) return n;
+        if(_stagedBegin == _stagedEnd && !_exhausted) _stage(buffer, bufSize);
+        if(_stagedBegin != _stagedEnd) {
+            iov[n].iov_base = buffer + _stagedBegin;
+            iov[n].iov_len = _stagedEnd - _stagedBegin;
+            ++n;
+        }
+        return n;
+    }
+    size_t from = _contentSent;
+    while(n < maxSegments && from < _contentSize) {
+        const char * ptr;
+        size_t len = _msg.content()->segment(from, ptr);
+        if(!len) {
+            int fd;
+            off_t offset;
+            if(!stageFiles && _msg.content()->file_region(from, fd, offset))
+                break;  // to be sent with `sendfile()`
+            // content is staged in buffer, data past it are gathered on
+            // the next call once buffer is sent
+            len = _msg.content()->copy_to(buffer, bufSize, from);
+            assert(0 != len);
+            ptr = buffer;
+            maxSegments = n + 1;
+        }
+        iov[n].iov_base = const_cast<char *>(ptr);
+        iov[n].iov_len = len;
+        ++n;
+        from += len;
+    }
+    return n;
+}
+
+size_t
+MsgSender::next_file_region(int & fd, off_t & offset) const {
+    if( _headerSent < _header.size() || _contentSent == _contentSize
+     || _streamed ) return 0;
+    return _msg.content()->file_region(_contentSent, fd, offset);
+}
+
+void
+MsgSender::advance(size_t n) {
+    if(_headerSent < _header.size()) {
+        const size_t nHeader = std::min(n, _header.size() - _headerSent);
+        _headerSent += nHeader;
+        n -= nHeader;
+    }
+    _contentSent += n;
+    if(_streamed) {
+        _stagedBegin += n;
+        assert(_stagedBegin <= _stagedEnd);
+        return;
+    }
+    assert(_contentSent <= _contentSize);
+}
+
+bool
+MsgSender::send_some(int fd, char * buffer, size_t bufSize, iJournal & /*L*/) {
+    iovec iov[kMaxSegments];
+    msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = iov;
+    while(!done()) {
+        ssize_t sent;
+        int fileFD;
+        off_t offset;
+        size_t len = next_file_region(fileFD, offset);
+        if(len) {
+            // file data go from page cache to socket with no copy to user
+            // space; `sendfile()` takes no flags, so blocking socket is
+            // temporarily switched to non-blocking mode
+            const int sockFlags = fcntl(fd, F_GETFL, 0);
+            if(!(sockFlags & O_NONBLOCK)) fcntl(fd, F_SETFL, sockFlags | O_NONBLOCK);
+            sent = sendfile(fd, fileFD, &offset, len);
+            const int en = errno;
+            if(!(sockFlags & O_NONBLOCK)) fcntl(fd, F_SETFL, sockFlags);
+            errno = en;
+            if(0 == sent) {
+                throw errors::ClientSocketError("error dispatching message:"
+                        " file content is truncated");
+            }
         } else {
-            throw std::logic_error("Unspecified return value send()");
-        }
-        assert(sentContentBytes <= content()->size());
-        if(sentContentBytes == content()->size()) {
-            //L << log4cpp::Priority::INFO
-            //  << Msg::to_str(status_code()) << " (" << (int) status_code() 
-            //  << "), body of "
-            //  << sentContentBytes
-            //  << " bytes.";
-            return;
+            // partially sent staging buffer is re-filled from the same
+            // offset
+            mh.msg_iovlen = next_segments(iov, kMaxSegments, buffer, bufSize, false);
+            if(!mh.msg_iovlen) continue;  // streamed content is exhausted
+            int flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+            // header followed by file data shall not be sent in own segment
+            if(_headerSent + iov[0].iov_len == _header.size()
+                    && 1 == mh.msg_iovlen && _contentSent < _contentSize)
+                flags |= MSG_MORE;
+            sent = sendmsg( fd, &mh, flags );
+        }
+        if(sent < 0) {
+            int en = errno;
+            if( en == EINTR ) continue;
+            if( en == EAGAIN || en == EWOULDBLOCK ) return false;
+            throw errors::ClientSocketError(util::format("error dispatching"
+                        " message: %s", strerror(en)).c_str());
         }
+        advance(sent);
     }
+    return true;
 }
 
 //                                                          ___________________
 // _______________________________________________________/ Request / Response
 
 void
-RequestMsg::_consider_request_header(const std::vector<std::string> & groups) {
-    const std::string & method_ = groups[1]
-                    , & path = groups[2]
-                    , & protocol = groups[3]
-                    ;
+RequestMsg::_consider_request_header( std::string_view method_
+                                    , std::string_view path
+                                    , std::string_view protocol ) {
     _method = method_from_str(method_);
     _strURI = path;
     _uri = URI(_strURI);
@@ -485,15 +975,25 @@ RequestMsg::_consider_request_header(const std::vector<std::string> & groups) {
 }
 
 
-std::string
-RequestMsg::header() const {
-    std::ostringstream oss;
-    oss << Msg::to_str(method())  << " "
-        << uri().path() << " "
-        << Msg::to_str(version())
-        << "\r\n";
-    oss << Msg::header();
-    return oss.str();
+bool
+RequestMsg::keep_alive() const {
+    const std::string_view c = get_header_view("connection");
+    if(_icontains(c, "close")) return false;
+    if(version() >= HTTP_1_1) return true;
+    return _icontains(c, "keep-alive");
+}
+
+void
+RequestMsg::write_header(std::pmr::string & out) const {
+    out.append(Msg::to_str(method())).append(1, ' ')
+       .append(uri().path()).append(1, ' ')
+       .append(Msg::to_str(version())).append("\r\n", 2);
+    _write_fields(out);
+}
+
+std::shared_ptr<ResponseMsg>
+RequestMsg::response(StatusCode code) const {
+    return allocate<ResponseMsg>(code, memory_resource());
 }
 
 void
@@ -509,32 +1009,38 @@ RequestMsg::uri(const std::string & uri_) {
 }
 
 void
-ResponseMsg::_consider_response_header(const std::vector<std::string> & groups) {
-    const std::string & protocol = groups[1]
-                    , & numErrCode = groups[2]
-                    //, & verbErr = groups[3]
-                    ;
+ResponseMsg::_consider_response_header( std::string_view protocol
+                                      , std::string_view numErrCode
+                                      , std::string_view ) {
     _version = version_from_str(protocol);
-    _code = (StatusCode) std::stoi(numErrCode);  // todo: validate?
+    // status code is validated to be of three digits by line scanner
+    _code = (StatusCode) ( (numErrCode[0] - '0')*100
+                         + (numErrCode[1] - '0')*10
+                         + (numErrCode[2] - '0') );  // todo: validate?
     // verbErr ?
 }
 
-std::string
-ResponseMsg::header() const {
-    std::ostringstream oss;
-    oss << Msg::to_str(version()) << ' ';
-    oss << static_cast<int>(status_code()) << ' ';
-    oss << Msg::to_str(status_code()) << "\r\n";
-    oss << Msg::header();
-    return oss.str();
+void
+ResponseMsg::write_header(std::pmr::string & out) const {
+    std::string_view statusLine = status_line(status_code());
+    if(HTTP_1_1 != version()) {
+        // substitute protocol version of pre-serialized status line
+        out.append(Msg::to_str(version()));
+        statusLine.remove_prefix(sizeof("HTTP/1.1") - 1);
+    }
+    out.append(statusLine);
+    _write_fields(out);
 }
 
 void
-ResponseMsg::finalize() {
-    if(has_content()) {
-        char bf[64];
-        snprintf(bf, sizeof(bf), "%zu", content()->size());
-        set_header("content-length", bf);
+ResponseMsg::finalize(Version peer) {
+    if(has_content() && content()->streamed()) {
+        // HTTP/1.0 peer reads streamed content till connection is closed
+        if(peer >= HTTP_1_1) set_header("transfer-encoding", "chunked");
+    } else if(has_content()) {
+        char bf[24];
+        auto r = std::to_chars(bf, bf + sizeof(bf), content()->size());
+        set_header("content-length", std::string_view(bf, r.ptr - bf));
     }
     //std::transform( hdrName.begin(), hdrName.end(), hdrName.begin()
     //              , [](){} );
@@ -562,6 +1068,158 @@ StringContent::copy_to( char * dest
     return copied;
 }
 
+size_t
+StringContent::segment(size_t from, const char *& ptr) const {
+    if(from >= _content.size()) {
+        ptr = nullptr;
+        return 0;
+    }
+    ptr = _content.data() + from;
+    return _content.size() - from;
+}
+
+//                                                      _______________________
+// ___________________________________________________/ Generator content type
+
+GeneratorContent::GeneratorContent( Producer producer
+                                  , std::pmr::memory_resource * mr )
+        : _producer(std::move(producer))
+        , _portion(mr)
+        , _portionPulled(0)
+        , _buf(_portion)
+        , _os(&_buf)
+        , _size(0)
+        , _finished(false)
+        {}
+
+void
+GeneratorContent::append(const char *, size_t) {
+    throw errors::GenericRuntimeError("Generator content is read-only.");
+}
+
+size_t
+GeneratorContent::copy_to(char *, size_t, size_t) const {
+    throw errors::GenericRuntimeError("Generator content can not be copied.");
+}
+
+size_t
+GeneratorContent::pull(char * dest, size_t maxLen) {
+    size_t n = 0;
+    // buffer is filled entirely unless content ends, so chunks are not
+    // fragmented by portions
+    while(n < maxLen) {
+        if(_portionPulled == _portion.size()) {
+            if(_finished) break;
+            _portion.clear();
+            _os.clear();
+            _finished = !_producer(_os);
+            _portionPulled = 0;
+            continue;
+        }
+        const size_t len = std::min(maxLen - n, _portion.size() - _portionPulled);
+        memcpy(dest + n, _portion.data() + _portionPulled, len);
+        _portionPulled += len;
+        n += len;
+    }
+    _size += n;
+    return n;
+}
+
+//                                                     ________________________
+// __________________________________________________/ Temporary file content
+
+TmpFileContent::TmpFileContent(const char * dir)
+        : _fd(-1)
+        , _size(0)
+        , _map(nullptr)
+        , _mapLen(0)
+        {
+    if(!dir) dir = getenv("TMPDIR");
+    if(!dir || '\0' == *dir) dir = "/tmp";
+    #ifdef O_TMPFILE
+    _fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    #endif
+    if(_fd < 0) {
+        // file system does not support `O_TMPFILE`
+        std::string tmpl = std::string(dir) + "/sync-http-srv-XXXXXX";
+        if((_fd = mkostemp(&tmpl[0], O_CLOEXEC)) >= 0) unlink(tmpl.c_str());
+    }
+    if(_fd < 0) {
+        int en = errno;
+        throw errors::GenericRuntimeError(util::format("Can not create"
+                    " temporary file in \"%s\": %s", dir, strerror(en)).c_str());
+    }
+}
+
+TmpFileContent::~TmpFileContent() {
+    _unmap();
+    if(_fd >= 0) close(_fd);
+}
+
+void
+TmpFileContent::_unmap() const {
+    if(!_map) return;
+    munmap(_map, _mapLen);
+    _map = nullptr;
+    _mapLen = 0;
+}
+
+void
+TmpFileContent::append(const char * data, size_t n) {
+    _unmap();  // mapping does not cover new data
+    while(n) {
+        ssize_t written = write(_fd, data, n);
+        if(written < 0) {
+            int en = errno;
+            if(EINTR == en) continue;
+            throw errors::GenericRuntimeError(util::format("Can not write"
+                        " temporary file: %s", strerror(en)).c_str());
+        }
+        data += written;
+        n -= written;
+        _size += written;
+    }
+}
+
+size_t
+TmpFileContent::copy_to(char * dest, size_t maxLen, size_t from) const {
+    if(from >= _size) {
+        throw errors::GenericSocketError(util::format("Can not copy up to %zu bytes from content"
+                " of length %zu from %zu-th byte."
+                , maxLen, _size, from ).c_str());
+    }
+    const char * ptr;
+    size_t len = segment(from, ptr);
+    if(len > maxLen) len = maxLen;
+    memcpy(dest, ptr, len);
+    return len;
+}
+
+size_t
+TmpFileContent::segment(size_t from, const char *& ptr) const {
+    ptr = nullptr;
+    if(from >= _size) return 0;
+    if(!_map) {
+        void * p = mmap(nullptr, _size, PROT_READ, MAP_SHARED, _fd, 0);
+        if(MAP_FAILED == p) {
+            int en = errno;
+            throw errors::GenericRuntimeError(util::format("Can not map"
+                        " temporary file: %s", strerror(en)).c_str());
+        }
+        _map = static_cast<char *>(p);
+        _mapLen = _size;
+    }
+    ptr = _map + from;
+    return _size - from;
+}
+
+size_t
+TmpFileContent::file_region(size_t from, int & fd, off_t & offset) const {
+    fd = _fd;
+    offset = from;
+    return from < _size ? _size - from : 0;
+}
+
 //                                                                      _______
 // ___________________________________________________________________/ Server
 
@@ -579,12 +1237,39 @@ Server::Server( const std::string & host_
         , _backlog(backlog)
         , _connectionTimeout(connectionTimeout)
         , _sockFD(-1)
-        , _recvBuffer(nullptr)
-        , _respBuffer(nullptr)
         , _ioBufSize(ioBufSize)
+        , _connBuffers(Connection::pooled_block_size(ioBufSize), 64)
         , _maxInMemContentLen(maxInMemContentLen)
+        , _maxContentLen(64*1024*1024)
         , _keepGoing(true)
+        , _keepAliveTimeout(0)
+        , _keepAliveMaxRequests(0)
+        , _nWorkers(0)
+        , _nShard(0)
+        , _nShards(0)
+        , _leaderFD(-1)
+        , _highWatermark(0)
+        , _lowWatermark(0)
+        , _shedding(false)
+        , _representations(new RepresentationCache())
+        , _responses(new ResponseCache())
         {
+    _srvAddr.sin_family = AF_INET;
+    _srvAddr.sin_addr.s_addr = INADDR_ANY;
+    inet_pton(AF_INET, _host.c_str(), &(_srvAddr.sin_addr.s_addr));
+    _srvAddr.sin_port = _port ? htons(_port) : 0;
+
+    _listen();
+
+    common_header("Server", "sync-http-srv");
+    common_header("Access-Control-Allow-Origin", "*");  // TODO: configurable
+
+    _L.info(util::format("HTTP server \"%s:%d\" created."
+           , _host.c_str(), (int) _port).c_str() );
+}
+
+void
+Server::_listen() {
     if((_sockFD = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
         int en_ = errno;
         throw errors::GenericSocketError(util::format("socket() error: %s"
@@ -592,27 +1277,24 @@ Server::Server( const std::string & host_
     }
 
     int opt = 1;
-
-    if(setsockopt(_sockFD, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
+    // options are set one by one, `SO_REUSEPORT` lets shards of prefork
+    // mode to bind same port
+    if( setsockopt(_sockFD, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0
+     || setsockopt(_sockFD, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0 ) {
         int en_ = errno;
-        errors::GenericSocketError(util::format("setsockopt() error: %s"
+        throw errors::GenericSocketError(util::format("setsockopt() error: %s"
                     , strerror(en_)).c_str());
     }
 
-    _srvAddr.sin_family = AF_INET;
-    _srvAddr.sin_addr.s_addr = INADDR_ANY;
-    inet_pton(AF_INET, _host.c_str(), &(_srvAddr.sin_addr.s_addr));
-    _srvAddr.sin_port = _port ? htons(_port) : 0;
-
     if(bind(_sockFD, (sockaddr *)&_srvAddr, sizeof(_srvAddr)) < 0) {
         int en_ = errno;
-        errors::GenericSocketError(util::format("bind() error: %s"
+        throw errors::GenericSocketError(util::format("bind() error: %s"
                     , strerror(en_)).c_str());
     }
 
     if(listen(_sockFD, _backlog) < 0) {
         int en_ = errno;
-        errors::GenericSocketError(util::format("listen() error: %s"
+        throw errors::GenericSocketError(util::format("listen() error: %s"
                     , strerror(en_)).c_str());
     }
 
@@ -624,38 +1306,512 @@ Server::Server( const std::string & host_
                    );
         _port = ntohs(_srvAddr.sin_port);
     }
-
-    _recvBuffer = new char [_ioBufSize];
-    _respBuffer = new char [_ioBufSize];
-
-    _L.info(util::format("HTTP server \"%s:%d\" created."
-           , _host.c_str(), (int) _port).c_str() );
 }
 
 Server::~Server() {
     if(_sockFD > -1) {
         close(_sockFD);
     }
-    if(_recvBuffer) delete [] _recvBuffer;
-    if(_respBuffer) delete [] _respBuffer;
 }
 
-std::shared_ptr<RequestMsg>
-Server::_receive(int clientFD, const char * clientIPStr) {
-    auto rq = std::make_shared<RequestMsg>();
-    rq->receive(clientFD, _recvBuffer, _ioBufSize, _maxInMemContentLen, _L);
-    return rq;
+std::shared_ptr<ResponseMsg>
+Server::_error_response(int statusCode, const char * what) {
+    char errBf[512];
+    snprintf( errBf, sizeof(errBf)
+            , "{\"errors\":[\"%s\"]}"
+            , what );
+    auto respPtr = std::make_shared<ResponseMsg>(
+            statusCode ? (Msg::StatusCode) statusCode : Msg::BadRequest );
+    respPtr->content(std::make_shared<StringContent>(errBf));
+    respPtr->set_header("Content-Type", "application/json");
+    return respPtr;
+}
+
+std::unique_lock<std::mutex>
+Server::_lock_endpoint(const iEndpoint & ep) {
+    if(!_nWorkers) return std::unique_lock<std::mutex>();
+    switch(ep.thread_safety()) {
+        case iEndpoint::kConcurrent:
+            return std::unique_lock<std::mutex>();
+        case iEndpoint::kSerialized: {
+            auto it = _endpointLocks.find(&ep);
+            assert(_endpointLocks.end() != it);
+            return std::unique_lock<std::mutex>(*it->second);
+        }
+        default:
+            return std::unique_lock<std::mutex>(_exclusiveLock);
+    };
 }
 
 void
-Server::_dispatch( int clientFD
-                 , const char * clientIPStr
-                 , std::shared_ptr<ResponseMsg> rp ) {
-    rp->finalize();
-    if(rp->has_content() && rp->get_header("content-type", "").empty()) {
-        _L.warn("Response has no Content-Type header.");
+Server::_render_header_blocks() {
+    _closeHeaders = _commonHeaders + "connection: close\r\n";
+    char bf[24];
+    auto r = std::to_chars(bf, bf + sizeof(bf), _keepAliveTimeout);
+    _keepAliveHeaders = _commonHeaders;
+    _keepAliveHeaders.append("connection: keep-alive\r\nkeep-alive: timeout=")
+                     .append(bf, r.ptr - bf).append("\r\n");
+    if(!_retryAfter) return;  // admission control was not configured
+    // 503 response is rendered once, so rejection costs single `send()`
+    const std::string_view content = "{\"errors\":[\"Server is overloaded, retry later.\"]}";
+    _unavailableResponse = Msg::status_line(Msg::ServiceUnvailable);
+    _unavailableResponse += util::format(
+                "content-type: application/json\r\n"
+                "content-length: %zu\r\n"
+                "retry-after: %u\r\n", content.size(), (unsigned) *_retryAfter );
+    _unavailableResponse.append(_closeHeaders).append("\r\n").append(content);
+}
+
+void
+Server::keep_alive(uint32_t idleTimeout, size_t maxRequests) {
+    _keepAliveTimeout = idleTimeout;
+    _keepAliveMaxRequests = maxRequests;
+    _render_header_blocks();
+}
+
+void
+Server::common_header(std::string_view name, std::string_view value) {
+    for(char c : name) {
+        _commonHeaders.push_back(std::tolower(static_cast<unsigned char>(c)));
+    }
+    _commonHeaders.append(": ").append(value).append("\r\n");
+    _render_header_blocks();
+}
+
+void
+Server::admission( size_t highWatermark, size_t lowWatermark
+                 , uint32_t retryAfter ) {
+    if(lowWatermark > highWatermark) {
+        throw errors::GenericRuntimeError("Low watermark of admission control"
+                " exceeds the high one.");
+    }
+    _highWatermark = highWatermark;
+    _lowWatermark = lowWatermark;
+    _shedding = false;
+    _retryAfter = retryAfter;
+    _render_header_blocks();
+}
+
+void
+Server::immutable(const iRoute & route, size_t maxSize) {
+    _immutableRoutes[&route] = maxSize;
+}
+
+void
+Server::cache(const iRoute & route, StateVersion stateVersion) {
+    _cachedRoutes[&route] = stateVersion;
+}
+
+void
+Server::route_limit(const iRoute & route, size_t maxInFlight) {
+    if(!maxInFlight) {
+        _routeLimits.erase(&route);
+        return;
+    }
+    _routeLimits[&route].reset(new RouteLimit(maxInFlight));
+    // routes may be limited without enabling admission control
+    if(_unavailableResponse.empty()) admission(0, 0);
+}
+
+bool
+Server::_admit(size_t nPending) {
+    if(!_highWatermark) return true;
+    if(_shedding && nPending <= _lowWatermark) {
+        _shedding = false;
+        _L.info(util::format("%zu pending connection(s), admission resumed."
+                    , nPending).c_str());
+    } else if(!_shedding && nPending >= _highWatermark) {
+        _shedding = true;
+        _L.warn(util::format("%zu pending connection(s), new connections"
+                    " are rejected.", nPending).c_str());
+    }
+    return !_shedding;
+}
+
+void
+Server::_shed(int fd) const {
+    assert(!_unavailableResponse.empty());
+    // fresh socket buffer always accommodates response; partial write is
+    // not retried, client sees truncated response in the worst case
+    ssize_t n;
+    while((n = ::send( fd, _unavailableResponse.data(), _unavailableResponse.size()
+                     , MSG_DONTWAIT | MSG_NOSIGNAL )) < 0 && EINTR == errno) {}
+    // closing socket with unread data resets connection, so discard
+    // request data (if any) arrived so far
+    shutdown(fd, SHUT_WR);
+    char bf[512];
+    while((n = ::recv(fd, bf, sizeof(bf), MSG_DONTWAIT)) > 0
+           || (n < 0 && EINTR == errno)) {}
+}
+
+Server::HandleResult
+Server::_handle( Connection & conn, const Routes & routes ) {
+    RequestMsg & rq = *conn.request();
+    rq.common_headers(_commonHeaders);
+    const int clientFD = conn.fd();
+    const char * clientIPStr = conn.ip_str();
+    iJournal & L = conn.journal();
+    std::shared_ptr<ResponseMsg> respPtr = nullptr;
+    uint16_t execFlags = 0x0;
+    // handle with first matching route
+    iRoute::URLParameters urlParams;
+    for( auto routeIt = routes.begin(); routes.end() != routeIt; ++routeIt ) {
+        if( !routeIt->first->can_handle(rq.uri().path(), urlParams) ) continue;
+        if( _is_follower() && routeIt->second->steering(rq) )
+            return {kHandOver, nullptr};  // to be served by leader shard
+        // immutable output is served from cache, if built already
+        auto immIt = Msg::GET == rq.method()
+                   ? _immutableRoutes.find(routeIt->first) : _immutableRoutes.end();
+        std::string reprKey;
+        if(_immutableRoutes.end() != immIt) {
+            reprKey = RepresentationCache::key(urlParams
+                    , RepresentationCache::query_string(rq));
+            auto repr = _representations->find(*routeIt->first, reprKey);
+            if(repr) return {0x0, RepresentationCache::respond(*repr, rq)};
+        }
+        // versioned output is served from cache, if state has not changed
+        auto cacheIt = Msg::GET == rq.method() && _immutableRoutes.end() == immIt
+                     ? _cachedRoutes.find(routeIt->first) : _cachedRoutes.end();
+        auto limitIt = _routeLimits.find(routeIt->first);
+        if(_routeLimits.end() != limitIt) {
+            RouteLimit & limit = *limitIt->second;
+            if(limit.n.fetch_add(1) >= limit.max) {
+                --limit.n;
+                ++_stats.nShedRequests;
+                L.warn(util::format("Route \"%s\" is at its concurrency"
+                            " limit, request from %s rejected."
+                            , routeIt->first->name.c_str(), clientIPStr).c_str());
+                _shed(clientFD);
+                return {kNoDispatchResponse, nullptr};
+            }
+            conn.hold(limit.n);
+        }
+        // strong entity tag derived from state version (if any)
+        char etagBf[24];
+        std::string_view etag;
+        uint64_t version = iEndpoint::kUnversioned;
+        try {
+            auto lock = _lock_endpoint(*routeIt->second);
+            if(Msg::GET == rq.method()) {
+                version = _cachedRoutes.end() != cacheIt && cacheIt->second
+                        ? cacheIt->second(rq, urlParams)
+                        : routeIt->second->state_version(rq, urlParams);
+            }
+            if(iEndpoint::kUnversioned != version) {
+                etagBf[0] = '"';
+                char * e = std::to_chars(etagBf + 1, etagBf + sizeof(etagBf) - 1
+                        , version, 16).ptr;
+                *e++ = '"';
+                etag = std::string_view(etagBf, e - etagBf);
+                // client has current representation, nothing to serialize
+                if(etag_matches(rq.get_header_view("if-none-match"), etag))
+                    return {0x0, _not_modified(rq, etag)};
+                if(_cachedRoutes.end() != cacheIt) {
+                    reprKey = RepresentationCache::key(urlParams
+                            , RepresentationCache::query_string(rq));
+                    auto repr = _responses->find(*routeIt->first, reprKey, version);
+                    if(repr) return {0x0, RepresentationCache::respond(*repr, rq)};
+                }
+            }
+            auto r = routeIt->second->handle(rq, clientFD, urlParams);
+            respPtr = r.second;
+            execFlags = r.first;
+        } catch( std::exception & e ) {
+            L.error(util::format("Error on route \"%s\" while"
+                " handling request from %s: \"%s\""
+                , routeIt->first->name.c_str()
+                , clientIPStr
+                , e.what() ).c_str());
+            // respond with error
+            return {0x0, _error_response(Msg::BadRequest, e.what())};
+        }
+        if( !etag.empty() && respPtr && Msg::Ok == respPtr->status_code()
+         && respPtr->get_header_view("etag").empty() ) {
+            respPtr->set_header("etag", etag);
+        }
+        // cacheable output is replaced by its representation
+        const bool versioned = _cachedRoutes.end() != cacheIt
+                            && iEndpoint::kUnversioned != version;
+        const size_t maxReprSize = versioned ? _responses->max_bytes()
+                : (_immutableRoutes.end() != immIt ? immIt->second : 0);
+        if( (versioned || _immutableRoutes.end() != immIt) && respPtr && !execFlags
+         && Msg::Ok == respPtr->status_code()
+         && respPtr->get_header_view("content-encoding").empty()
+         && ( !respPtr->has_content() || respPtr->content()->streamed()
+           || respPtr->content()->size() <= maxReprSize ) ) {
+            try {
+                auto repr = versioned
+                          ? _responses->put(*routeIt->first, reprKey, version, *respPtr)
+                          : _representations->put( *routeIt->first, reprKey
+                                                 , *respPtr, immIt->second );
+                respPtr = RepresentationCache::respond(*repr, rq);
+            } catch( std::exception & e ) {
+                L.error(util::format("Failed to build representation of route"
+                            " \"%s\": %s", routeIt->first->name.c_str()
+                            , e.what()).c_str());
+                return {0x0, _error_response(Msg::InternalServerError, e.what())};
+            }
+        }
+        if( respPtr && !(execFlags & kNoDispatchResponse) ) {
+            auto compIt = _routeCompression.find(routeIt->first);
+            if(_routeCompression.end() != compIt) {
+                try {
+                    _compress(rq, *respPtr, compIt->second);
+                } catch( std::exception & e ) {
+                    L.warn(util::format("Failed to compress response of route"
+                                " \"%s\", sending it as is: %s"
+                                , routeIt->first->name.c_str(), e.what()).c_str());
+                }
+            }
+        }
+        if( respPtr || (execFlags & kNoDispatchResponse) )
+            return {execFlags, respPtr};  // request handled
+        L.warn(util::format("Route \"%s\" promised to handle path %s"
+                " from %s but did not return"
+                " response object."
+                , routeIt->first->name.c_str()
+                , rq.uri().path().c_str()
+                , clientIPStr
+                ).c_str());
+    }
+    // TODO: check for server-wide OPTIONS request (may be addressed
+    //       to '*'), need to return methods, content type, etc
+    L.warn(util::format("No matching route for request from %s with URI %s"
+        , clientIPStr
+        , rq.str_uri().c_str() ).c_str());
+    // no matching routes, respond with error
+    return {0x0, _error_response(Msg::NotFound, "Invalid path, no matching route.")};
+}
+
+std::shared_ptr<ResponseMsg>
+Server::_not_modified(const RequestMsg & rq, std::string_view etag) {
+    auto rp = rq.response(Msg::NotModified);
+    rp->set_header("etag", etag);
+    return rp;
+}
+
+void
+Server::_conditional(const RequestMsg & rq, std::shared_ptr<ResponseMsg> & rp) {
+    if(Msg::GET != rq.method() || Msg::Ok != rp->status_code()) return;
+    std::string_view etag = rp->get_header_view("etag");
+    if(etag.empty() || !etag_matches(rq.get_header_view("if-none-match"), etag))
+        return;
+    auto nm = _not_modified(rq, etag);
+    // headers 200 response would bear for caches to update (RFC 9110, 15.4.5)
+    for(const char * name : {"cache-control", "expires", "vary", "content-location"}) {
+        std::string_view value = rp->get_header_view(name);
+        if(!value.empty()) nm->set_header(name, value);
+    }
+    rp = nm;
+}
+
+void
+Server::_prepare_response(ResponseMsg & rp, iJournal & L, Msg::Version peer) {
+    rp.finalize(peer);
+    if(rp.has_content() && rp.get_header_view("content-type").empty()) {
+        L.warn("Response has no Content-Type header.");
+    }
+}
+
+bool
+Server::_process( Connection & conn
+                , const Routes & routes
+                , uint16_t & execFlags ) {
+    iJournal & L = conn.journal();
+    // try to parse request, return "Bad Request"/400 on parsing failure
+    std::shared_ptr<ResponseMsg> respPtr = nullptr;
+    execFlags = 0x0;
+    try {
+        if(!conn.receive(_maxContentLen)) return false;
+        ++_stats.nRequests;
+    } catch( errors::ClientClosedConnection & e ) {
+        if(conn.n_served() && conn.idle()) {
+            L.debug(util::format("Client %s closed persistent connection."
+                        , conn.ip_str()).c_str());
+        } else {
+            L.info(util::format("Client closed connection, abort request handling for %s"
+                        , conn.ip_str()).c_str());
+        }
+        execFlags = kNoDispatchResponse;
+        return true;
+    } catch( errors::ClientSocketError & e ) {
+        L.error(util::format("Client socket error: %s, abort request handling for %s"
+                , e.what(), conn.ip_str()).c_str());
+        execFlags = kNoDispatchResponse;
+        return true;
+    } catch( errors::RequestError & e ) {
+        L.error(util::format("Request error from %s: %s"
+                , conn.ip_str(), e.what()).c_str());
+        // respond with error
+        respPtr = _error_response(e.statusCode, e.what());
+    } catch( std::exception & e ) {
+        L.error(util::format("Request error from %s: %s"
+                , conn.ip_str(), e.what()).c_str());
+        // respond with error
+        respPtr = _error_response(Msg::InternalServerError, e.what());
+    }
+    // connection is kept only if request was received successfully
+    bool keepAlive = false;
+    if(!respPtr) {
+        assert(conn.request());
+        auto r = _handle(conn, routes);
+        execFlags = r.first;
+        respPtr = r.second;
+        if(execFlags & kHandOver) {
+            try {
+                _hand_over(conn);
+                execFlags = kNoDispatchResponse;
+            } catch( errors::GenericHTTPError & e ) {
+                L.error(util::format("Failed to hand over request from %s"
+                            " to leader shard: %s", conn.ip_str(), e.what()).c_str());
+                execFlags = 0x0;
+                respPtr = _error_response(e.statusCode, e.what());
+            }
+        }
+        if(respPtr && !(execFlags & kNoDispatchResponse)) {
+            _conditional(*conn.request(), respPtr);
+            _ranges(*conn.request(), respPtr);
+        }
+        keepAlive = _keepAliveTimeout
+                 && conn.request()->keep_alive()
+                 && conn.n_served() + 1 < _keepAliveMaxRequests
+                 && !(execFlags & (kNoDispatchResponse | kKeepClientConnection | kStop));
+    }
+    conn.exec_flags(execFlags);
+    conn.keep_alive(keepAlive);
+    if(!(execFlags & kNoDispatchResponse)) {
+        assert(respPtr);
+        _prepare_response(*respPtr, L, conn.request()
+                ? conn.request()->version() : Msg::HTTP_1_1);
+        if( respPtr->has_content() && respPtr->content()->streamed()
+         && !respPtr->chunked() ) {
+            // content is delimited by closing connection
+            keepAlive = false;
+            conn.keep_alive(false);
+        }
+        if(keepAlive) {
+            if(!conn.n_served()) {
+                // responses exceeding one `sendmsg()` end with small
+                // write; prevent Nagle's algorithm from delaying it on
+                // persistent connection till client acknowledges the former
+                const int one = 1;
+                setsockopt(conn.fd(), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            }
+        }
+        // common and connection headers are pre-rendered, server decides on
+        // connection persistence
+        respPtr->erase_header("connection");
+        respPtr->erase_header("keep-alive");
+        respPtr->header_block(keepAlive ? _keepAliveHeaders : _closeHeaders);
+        conn.respond(respPtr);
+    }
+    return true;
+}
+
+uint16_t
+Server::_serve( Connection & conn, const Routes & routes ) {
+    uint16_t execFlags = 0x0;
+    while(true) {
+        // socket operations do not block, so wait for data till deadline
+        bool received;
+        while( !(received = _process(conn, routes, execFlags))
+             && _wait(conn, POLLIN) ) {}
+        if(!received && !_deadline_expired(conn)) break;
+        if(Connection::kSending == conn.state()) {
+            try {
+                while(!conn.send()) {
+                    if(_wait(conn, POLLOUT)) continue;
+                    _deadline_expired(conn);
+                    conn.keep_alive(false);
+                    break;
+                }
+            } catch( errors::ClientSocketError & e ) {
+                conn.journal().warn(util::format("Error dispatching response to %s: %s"
+                            , conn.ip_str(), e.what()).c_str());
+                conn.keep_alive(false);
+            }
+        }
+        if(!(conn.keep_alive() && _keepGoing)) break;
+        conn.reset();
+    }
+    if(!(execFlags & kKeepClientConnection))
+        close(conn.fd());
+    return execFlags;
+}
+
+std::chrono::steady_clock::time_point
+Server::_deadline(const Connection & conn) const {
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    switch(conn.state()) {
+        case Connection::kReceiving:
+            if(conn.idle()) {
+                const uint32_t timeout = conn.n_served() ? _keepAliveTimeout
+                                                         : _connectionTimeout;
+                if(!timeout) return TimePoint::max();
+                return conn.idle_since() + std::chrono::seconds(timeout);
+            }
+            if(!_connectionTimeout) return TimePoint::max();
+            return conn.request_since() + std::chrono::seconds(_connectionTimeout);
+        case Connection::kSending:
+            if(!_connectionTimeout) return TimePoint::max();
+            return conn.last_sent() + std::chrono::seconds(_connectionTimeout);
+        default:
+            return TimePoint::max();
+    };
+}
+
+bool
+Server::_deadline_expired(Connection & conn) {
+    iJournal & L = conn.journal();
+    if(Connection::kReceiving == conn.state()) {
+        if(conn.idle()) {
+            ++_stats.nIdleTimeouts;
+            L.debug(util::format("Idle connection with %s expired."
+                        , conn.ip_str()).c_str());
+            return false;
+        }
+        ++_stats.nReadTimeouts;
+        L.info(util::format("Request from %s was not received in time."
+                    , conn.ip_str()).c_str());
+        auto respPtr = _error_response( Msg::RequestTimeout
+                                      , "Request was not received in time." );
+        _prepare_response(*respPtr, L);
+        respPtr->header_block(_closeHeaders);
+        conn.exec_flags(0x0);
+        conn.keep_alive(false);
+        conn.respond(respPtr);
+        return true;
+    }
+    ++_stats.nWriteTimeouts;
+    L.info(util::format("Client %s did not accept response data in time."
+                , conn.ip_str()).c_str());
+    // abort connection on close, so unsent data are not kept by kernel
+    linger lo;
+    lo.l_onoff = 1;
+    lo.l_linger = 0;
+    setsockopt(conn.fd(), SOL_SOCKET, SO_LINGER, &lo, sizeof(lo));
+    return false;
+}
+
+bool
+Server::_wait(const Connection & conn, short events) const {
+    pollfd pfd;
+    pfd.fd = conn.fd();
+    pfd.events = events;
+    while(true) {
+        const auto deadline = _deadline(conn);
+        int timeoutMs = -1;
+        if(std::chrono::steady_clock::time_point::max() != deadline) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            if(left <= 0) return false;
+            timeoutMs = left < INT_MAX ? (int) left + 1 : INT_MAX;
+        }
+        int rc = poll(&pfd, 1, timeoutMs);
+        if(0 == rc || (rc < 0 && EINTR == errno)) continue;
+        // on error, next socket operation will report it
+        return true;
     }
-    rp->dispatch(clientFD, _respBuffer, _ioBufSize, _L);
 }
 
 void
@@ -664,7 +1820,7 @@ Server::run( const Routes & routes ) {
     socklen_t clientSize = sizeof(clientAddr);
     int clientFD;
 
-    // accept new connections and distribute tasks to worker threads
+    // accept new connections and handle them one by one
     while( _keepGoing ) {
         clientFD = accept4( _sockFD
                           , (sockaddr *)&clientAddr
@@ -676,123 +1832,11 @@ Server::run( const Routes & routes ) {
             _L.warn(util::format("accept4() error: %s", strerror(en)).c_str());
             continue;
         }
-        
-        // get client for logging
-        struct in_addr ipAddr = clientAddr.sin_addr;
-        char clientIPStr[INET_ADDRSTRLEN];
-        inet_ntop( AF_INET, &ipAddr, clientIPStr, INET_ADDRSTRLEN );
-        
-        std::shared_ptr<RequestMsg> rqPtr;
-
-        // try to parse request, return "Bad Request"/400 on parsing failure
-        std::shared_ptr<ResponseMsg> respPtr = nullptr;
-        bool hadError = false;
-        try {
-            rqPtr = _receive(clientFD, clientIPStr);
-        } catch( errors::ClientClosedConnection & e ) {
-            _L.info(util::format("Client closed connection, abort request handling for %s"
-                        , clientIPStr).c_str());
-            close(clientFD);
-            continue;
-        } catch( errors::ClientSocketError & e ) {
-            _L.error(util::format("Client socket error: %s, abort request handling for %s"
-                    , e.what(), clientIPStr).c_str());
-            close(clientFD);
-            continue;
-        } catch( errors::RequestError & e ) {
-            _L.error(util::format("Request error from %s: %s"
-                    , clientIPStr, e.what()).c_str());
-            // respond with error
-            char errBf[256];
-            snprintf( errBf, sizeof(errBf)
-                    , "{\"errors\":[\"%s\"]}"
-                    , e.what() );
-            if(e.statusCode) {
-                respPtr = std::make_shared<ResponseMsg>((Msg::StatusCode) e.statusCode);
-            } else {
-                respPtr = std::make_shared<ResponseMsg>(Msg::BadRequest);
-            }
-            respPtr->content(std::make_shared<StringContent>(errBf));
-            respPtr->set_header("Content-Type", "application/json");
-            hadError = true;
-        } catch( std::exception & e ) {
-            _L.error(util::format("Request error from %s: %s"
-                    , clientIPStr, e.what()).c_str());
-            // respond with error
-            char errBf[512];
-            snprintf( errBf, sizeof(errBf)
-                    , "{\"errors\":[\"%s\"]}"
-                    , e.what() );
-            respPtr = std::make_shared<ResponseMsg>(Msg::InternalServerError);
-            respPtr->content(std::make_shared<StringContent>(errBf));
-            respPtr->set_header("Content-Type", "application/json");
-            hadError = true;
-        }
-        if(rqPtr) {
-            rqPtr->client_ip(clientIPStr);
-        }
-        uint16_t execFlags = 0x0;
-        if(!hadError) {
-            assert(rqPtr);
-            // handle with first matching route
-            iRoute::URLParameters urlParams;
-            for( auto routeIt = routes.begin(); routes.end() != routeIt; ++routeIt ) {
-                if( !routeIt->first->can_handle(rqPtr->uri().path(), urlParams) ) continue;
-                try {
-                    auto r = routeIt->second->handle(*rqPtr, clientFD, urlParams);
-                    respPtr = r.second;
-                    execFlags = r.first;
-                } catch( std::exception & e ) {
-                    _L.error(util::format("Error on route \"%s\" while"
-                        " handling request from %s: \"%s\""
-                        , routeIt->first->name.c_str()
-                        , clientIPStr
-                        , e.what() ).c_str());
-                    // respond with error
-                    char errBf[256];
-                    snprintf( errBf, sizeof(errBf)
-                            , "{\"errors\":[\"%s\"]}"
-                            , e.what() );
-                    assert(!respPtr);
-                    respPtr = std::make_shared<ResponseMsg>(Msg::BadRequest);
-                    respPtr->content(std::make_shared<StringContent>(errBf));
-                    respPtr->set_header("Content-Type", "application/json");
-                    hadError = true;
-                }
-                if( hadError ) execFlags = 0x0;
-                if( respPtr ) break;  // request handled
-                _L.warn(util::format("Route \"%s\" promised to handle path %s"
-                        " from %s but did not return"
-                        " response object."
-                        , routeIt->first->name.c_str()
-                        , rqPtr->uri().path().c_str()
-                        , clientIPStr
-                        ).c_str());
-            }
-        }
-        // TODO: check for server-wide OPTIONS request (may be addressed
-        //       to '*'), need to return methods, content type, etc
-        if(!respPtr) {
-            _L.warn(util::format("No matching route for request from %s with URI %s"
-                , clientIPStr
-                , (rqPtr ? rqPtr->str_uri().c_str() : "(null rq.)") ).c_str());
-            // no matching routes
-            assert(!hadError);
-            // respond with error
-            respPtr = std::make_shared<ResponseMsg>(Msg::NotFound);
-            respPtr->content(std::make_shared<StringContent>(
-                        "{\"errors\":[\"Invalid path, no matching route.\"]}"));
-            respPtr->set_header("Content-Type", "application/json");
-            hadError = true;
-        }
-        assert(respPtr);
-        if(!(execFlags & kNoDispatchResponse)) {
-            respPtr->set_header("Access-Control-Allow-Origin", "*");  // TODO: configurable
-            _dispatch(clientFD, clientIPStr, respPtr);
-        }
-        if(!(execFlags & kKeepClientConnection))
-            close(clientFD);
-        if( execFlags & kStop )
+
+        ++_stats.nConnections;
+        Connection conn( clientFD, clientAddr, _L
+                       , _connBuffers, _ioBufSize, _maxInMemContentLen );
+        if( _serve(conn, routes) & kStop )
             break;
     }  // server's "keepGoing"
     _L.info("Server shutdown.");
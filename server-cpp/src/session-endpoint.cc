@@ -0,0 +1,104 @@
+#include "sync-http-srv/session-endpoint.hh"
+#include "sync-http-srv/error.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+SessionEndpoint::SessionEndpoint(iJournal & L, const char * what)
+        : _L(L)
+        , _what(what)
+        , _stop(false)
+        , _wakeFD(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+        {
+    if(_wakeFD < 0) {
+        throw errors::GenericRuntimeError(util::format("Failed to create"
+                    " wake-up descriptor of %s: %s", what, strerror(errno)).c_str());
+    }
+}
+
+SessionEndpoint::~SessionEndpoint() {
+    _halt();
+    ::close(_wakeFD);
+}
+
+void
+SessionEndpoint::_wake() {
+    const uint64_t one = 1;
+    while(::write(_wakeFD, &one, sizeof(one)) < 0 && EINTR == errno) {}
+}
+
+void
+SessionEndpoint::_start() {
+    if(!_thread.joinable()) _thread = std::thread(&SessionEndpoint::_serve, this);
+    _wake();
+}
+
+void
+SessionEndpoint::_halt() {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _stop = true;
+    }
+    _wake();
+    if(_thread.joinable()) _thread.join();
+}
+
+std::string
+SessionEndpoint::_take_over(int clientFD) {
+    fcntl(clientFD, F_SETFL, fcntl(clientFD, F_GETFL) | O_NONBLOCK);
+    const int one = 1;
+    setsockopt(clientFD, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    sockaddr_in addr;
+    socklen_t addrLen = sizeof(addr);
+    char ipStr[INET_ADDRSTRLEN] = "?";
+    if(0 == getpeername(clientFD, reinterpret_cast<sockaddr *>(&addr), &addrLen))
+        inet_ntop(AF_INET, &addr.sin_addr, ipStr, INET_ADDRSTRLEN);
+    return ipStr;
+}
+
+void
+SessionEndpoint::_serve() {
+    std::vector<pollfd> pfds;
+    std::unique_lock<std::mutex> lock(_mtx);
+    while(!_stop) {
+        const Clock::time_point now = Clock::now();
+        const Clock::time_point deadline = _visit(lock, now);
+        pfds.clear();
+        pfds.push_back(pollfd{_wakeFD, POLLIN, 0});
+        _poll_set(pfds);
+        int timeoutMs = -1;
+        if(Clock::time_point::max() != deadline) {
+            timeoutMs = std::max<int64_t>(0, std::chrono::ceil<std::chrono::milliseconds>(
+                        deadline - now).count());
+        }
+        lock.unlock();
+        const int n = poll(pfds.data(), pfds.size(), timeoutMs);
+        lock.lock();
+        if(n < 0) {
+            if(EINTR != errno) {
+                _L.error(util::format("poll() of %s failed: %s"
+                            , _what, strerror(errno)).c_str());
+            }
+            continue;
+        }
+        if(pfds[0].revents & POLLIN) {
+            uint64_t v;
+            while(::read(_wakeFD, &v, sizeof(v)) < 0 && EINTR == errno) {}
+        }
+        _on_ready(pfds.data() + 1, pfds.size() - 1);
+    }
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -1,13 +1,92 @@
 #include "sync-http-srv/staticFilesRoute.hh"
+#include "sync-http-srv/error.hh"
+#include "sync-http-srv/uri.hh"
 
-#if 0
-#include <dirent.h>
+#include <algorithm>
+#include <cstring>
 #include <filesystem>
 
-namespace na64dp {
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
 namespace util {
 namespace http {
 
+//                                                           __________________
+// ________________________________________________________/ Local file content
+
+LocalFileContent::LocalFileContent(const std::string & filePath, bool followSymlink)
+        : _filePath(filePath)
+        , _fd(-1)
+        , _fileSize(0)
+        {
+    if((_fd = open( _filePath.c_str()
+                  , O_RDONLY | O_CLOEXEC | (followSymlink ? 0 : O_NOFOLLOW) )) < 0) {
+        int en = errno;
+        throw errors::GenericRuntimeError(util::format("Can not open"
+                    " file \"%s\": %s", _filePath.c_str(), strerror(en)).c_str());
+    }
+    struct stat st;
+    if(fstat(_fd, &st) < 0) {
+        int en = errno;
+        close(_fd);
+        throw errors::GenericRuntimeError(util::format("Can not stat"
+                    " file \"%s\": %s", _filePath.c_str(), strerror(en)).c_str());
+    }
+    _fileSize = st.st_size;
+}
+
+LocalFileContent::~LocalFileContent() {
+    if(_fd >= 0) close(_fd);
+}
+
+void
+LocalFileContent::append(const char *, size_t) {
+    throw errors::GenericRuntimeError("Local file content is read-only.");
+}
+
+size_t
+LocalFileContent::copy_to(char * dest, size_t maxLen, size_t from) const {
+    if(from >= _fileSize) {
+        throw errors::GenericRuntimeError(util::format("Can not copy up to %zu"
+                " bytes from file \"%s\" of length %zu from %zu-th byte."
+                , maxLen, _filePath.c_str(), _fileSize, from ).c_str());
+    }
+    const size_t len = std::min(maxLen, _fileSize - from);
+    ssize_t n;
+    while((n = pread(_fd, dest, len, from)) < 0 && EINTR == errno) {}
+    if(n <= 0) {
+        int en = n ? errno : 0;
+        throw errors::GenericRuntimeError(util::format("Can not read file"
+                " \"%s\": %s", _filePath.c_str()
+                , en ? strerror(en) : "file is truncated").c_str());
+    }
+    return n;
+}
+
+size_t
+LocalFileContent::file_region(size_t from, int & fd, off_t & offset) const {
+    fd = _fd;
+    offset = from;
+    return from < _fileSize ? _fileSize - from : 0;
+}
+
+//                                                           __________________
+// ________________________________________________________/ Static files route
+
+namespace {
+/// Returns absolute normalized path with no trailing separator
+std::string
+normalized_dir_path(const std::string & path) {
+    std::string p = std::filesystem::weakly_canonical(path).native();
+    while(p.size() > 1 && '/' == p.back()) p.pop_back();
+    return p;
+}
+}  // anonymous namespace
+
 // Added some common MIME types for static file share. This is a subset of the
 // official table:
 //      https://developer.mozilla.org/en-US/docs/Web/HTTP/Basics_of_HTTP/MIME_types/Common_types
@@ -17,9 +96,12 @@ static const struct { char extension[8], contentType[32]; } _gContentTypes[] = {
     { "ico",    "image/vnd.microsoft.icon" },
     { "css",    "text/css" },
     { "js",     "text/javascript"  },
+    { "mjs",    "text/javascript"  },
     { "json",   "application/json" },
+    { "wasm",   "application/wasm" },
     { "bz",     "application/x-bzip" },
     { "bz2",    "application/x-bzip2" },
+    { "gz",     "application/gzip" },
     { "zip",    "application/zip" },
     { "csv",    "text/csv" },
     { "gif",    "image/gif" },
@@ -40,22 +122,21 @@ LocalDirRoute::LocalDirRoute( const std::string & localPath_
                             , const std::string & urlPrefix
                             , bool defaultContentTypes
                             )
-        : _localPath(std::filesystem::canonical(expand_name(localPath_)))
+        : iRoute("static:" + urlPrefix)
+        , _localPath(normalized_dir_path(localPath_))
         , _urlPath(urlPrefix)
         {
     // check if dir exists
     DIR * dirPtr = opendir(_localPath.c_str());
     if(!dirPtr) {
         int en = errno;
-        char errBf[128];
         if(en == ENOENT) {
-            snprintf( errBf, sizeof(errBf)
-                    , "No such dir: \"%s\" (\"%s\")"
-                    , _localPath.c_str(), localPath_.c_str() );
-            throw std::runtime_error(errBf);
+            throw errors::GenericRuntimeError(util::format("No such dir:"
+                        " \"%s\" (\"%s\")", _localPath.c_str()
+                        , localPath_.c_str()).c_str());
         }
-        snprintf(errBf, sizeof(errBf), "Dir open error: %s", strerror(en));
-        throw std::runtime_error(errBf);
+        throw errors::GenericRuntimeError(util::format("Dir open error: %s"
+                    , strerror(en)).c_str());
     }
     closedir(dirPtr);  // ok
 
@@ -69,54 +150,89 @@ LocalDirRoute::LocalDirRoute( const std::string & localPath_
 void
 LocalDirRoute::add_file_type( const std::string & extension
                             , const std::string &contentType ) {
-    _contentTypes.emplace(extension, contentType);
+    _contentTypes[extension] = contentType;
 }
 
-Server::HandleResult
-LocalDirRoute::try_handle(std::shared_ptr<RequestMsg> rq, int) {
-    Server::HandleResult result = {0x0, nullptr};
-    size_t n = rq->uri().path().find(_urlPath);
-    if(n != 0) return result;  // path doesn't match
-    n += _urlPath.size()+1;
+std::shared_ptr<ResponseMsg>
+LocalDirRoute::_error(Msg::StatusCode code, const char * what) {
+    auto rp = std::make_shared<ResponseMsg>(code);
+    rp->content(std::make_shared<StringContent>(
+                util::format("{\"errors\":[\"%s\"]}", what)));
+    rp->set_header("Content-Type", "application/json");
+    return rp;
+}
 
-    std::filesystem::path absPath(_localPath);
-    absPath += rq->uri().path().substr(n);
-    absPath = std::filesystem::canonical(absPath);
+bool
+LocalDirRoute::can_handle(const std::string & path, URLParameters & urlParams) const {
+    if(path.compare(0, _urlPath.size(), _urlPath)) return false;  // prefix doesn't match
+    size_t n = _urlPath.size();
+    // prefix must end at path segment boundary
+    if(n && n < path.size() && '/' != path[n] && '/' != path[n-1]) return false;
+    while(n < path.size() && '/' == path[n]) ++n;
+    urlParams["path"] = path.substr(n);
+    return true;
+}
+
+std::string
+LocalDirRoute::path_for(const URLParameters & urlParams) const {
+    auto it = urlParams.find("path");
+    if(urlParams.end() == it || it->second.empty()) return _urlPath;
+    if(!_urlPath.empty() && '/' == _urlPath.back()) return _urlPath + it->second;
+    return _urlPath + "/" + it->second;
+}
 
-    // Make sure we're not access parent dirs
-    // TODO: seems not being too reliable actually.
+Server::HandleResult
+LocalDirRoute::handle( const RequestMsg & rq
+                     , int
+                     , const URLParameters & urlParams ) {
+    if(Msg::GET != rq.method()) {
+        auto rp = _error(Msg::MethodNotAllowed, "Method not allowed");
+        rp->set_header("Allow", "GET");
+        return {0x0, rp};
+    }
+    std::filesystem::path absPath(_localPath);
+    {
+        auto it = urlParams.find("path");
+        if(urlParams.end() != it) absPath /= URI::decode(it->second);
+    }
+    std::error_code ec;
+    if(std::filesystem::is_directory(absPath, ec)) absPath /= "index.html";
+    absPath = std::filesystem::weakly_canonical(absPath, ec);
+    // Make sure we're not access parent dirs: path of the file to be served,
+    // with symlinks resolved, must remain within served dir
     {
-        // Get relative path for file enitity
-        auto relPath = std::filesystem::relative(absPath, _localPath);
-        if(std::string(relPath).find("..") != std::string::npos) {
-            result.second = std::make_shared<ResponseMsg>(Msg::Forbidden);
-            //result.second->content("{\"errors\":[\"Access forbidden\"]}");  // TODO
-            return result;
+        const std::string & p = absPath.native();
+        if( ec || p.compare(0, _localPath.size(), _localPath)
+         || (p.size() > _localPath.size() && '/' != p[_localPath.size()]) ) {
+            return {0x0, _error(Msg::Forbidden, "Access forbidden.")};
         }
     }
     // Check file exists
-    if(!std::filesystem::exists(absPath)) {
-        result.second = std::make_shared<ResponseMsg>(Msg::NotFound);
-        //result.second->content("{\"errors\":[\"Not found.\"]}");  // TODO
-        return result;
+    if(!std::filesystem::is_regular_file(absPath, ec)) {
+        return {0x0, _error(Msg::NotFound, "Not found.")};
     }
-
+    std::shared_ptr<LocalFileContent> content;
+    try {
+        // resolved path has no symlinks, the one substituted after the check
+        // is not followed
+        content = std::make_shared<LocalFileContent>(absPath.native(), false);
+    } catch( errors::GenericRuntimeError & e ) {
+        return {0x0, _error(Msg::Forbidden, "Access forbidden.")};
+    }
+    auto rp = std::make_shared<ResponseMsg>(Msg::Ok);
     // Assume file content type by extensions
     std::string extension = absPath.extension();
+    if(!extension.empty()) extension.erase(0, 1);  // leading dot
     auto ctIt = _contentTypes.find(extension);
     if(extension.empty() || ctIt == _contentTypes.end()) {
-        result.second->set_header("Content-Type", "application/octet-stream");
+        rp->set_header("Content-Type", "application/octet-stream");
     } else {
-        result.second->set_header("Content-Type", ctIt->second);
+        rp->set_header("Content-Type", ctIt->second);
     }
-
-    //result.second->set_file_payload(absPath);
-    throw std::runtime_error("TODO");
-
-    return result;
+    rp->content(content);
+    return {0x0, rp};
 }
 
-}  // namespace ::na64dp::util::http
-}  // namespace ::na64dp::util
-}  // namespace na64dp
-#endif
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -0,0 +1,89 @@
+#pragma once
+
+/**\file
+ * \brief String helpers shared by the library sources
+ *
+ * Header field names and most of the tokens of HTTP are case-insensitive;
+ * helpers here compare them with lowercase literals without making a
+ * lowercase copy. Not a part of public interface.
+ * */
+
+#include <cstdint>
+#include <string_view>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+/// Returns ASCII lowercase of the character, locale is not considered
+inline char
+_lower(char c) { return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; }
+
+/// Compares lowercase `lc` with `s` case-insensitively
+inline bool
+_iequals(std::string_view lc, std::string_view s) {
+    if(lc.size() != s.size()) return false;
+    for(size_t i = 0; i < s.size(); ++i) {
+        if(lc[i] != _lower(s[i])) return false;
+    }
+    return true;
+}
+
+/// Returns whether `s` starts with lowercase `lc` case-insensitively
+inline bool
+_istarts_with(std::string_view s, std::string_view lc) {
+    return s.size() >= lc.size() && _iequals(lc, s.substr(0, lc.size()));
+}
+
+/// Returns whether `s` ends with lowercase `lc` case-insensitively
+inline bool
+_iends_with(std::string_view s, std::string_view lc) {
+    return s.size() >= lc.size() && _iequals(lc, s.substr(s.size() - lc.size()));
+}
+
+/// Returns whether `s` contains lowercase `lc` (case-insensitively)
+inline bool
+_icontains(std::string_view s, std::string_view lc) {
+    for(size_t i = 0; i + lc.size() <= s.size(); ++i) {
+        if(_iequals(lc, s.substr(i, lc.size()))) return true;
+    }
+    return false;
+}
+
+/// Strips optional whitespace (spaces and tabs) around the value
+inline std::string_view
+_trim(std::string_view s) {
+    while(!s.empty() && (' ' == s.front() || '\t' == s.front())) s.remove_prefix(1);
+    while(!s.empty() && (' ' == s.back() || '\t' == s.back())) s.remove_suffix(1);
+    return s;
+}
+
+/// Returns whether text is valid UTF-8 (no overlong forms and surrogates)
+inline bool
+_valid_utf8(std::string_view s) {
+    const uint8_t * p = reinterpret_cast<const uint8_t *>(s.data())
+                , * end = p + s.size();
+    while(p < end) {
+        if(*p < 0x80) { ++p; continue; }
+        size_t len;
+        uint32_t cp;
+        if(0xc0 == (*p & 0xe0))      { len = 2; cp = *p & 0x1f; }
+        else if(0xe0 == (*p & 0xf0)) { len = 3; cp = *p & 0x0f; }
+        else if(0xf0 == (*p & 0xf8)) { len = 4; cp = *p & 0x07; }
+        else return false;
+        if(size_t(end - p) < len) return false;
+        for(size_t i = 1; i < len; ++i) {
+            if(0x80 != (p[i] & 0xc0)) return false;
+            cp = (cp << 6) | (p[i] & 0x3f);
+        }
+        if( (2 == len && cp < 0x80) || (3 == len && cp < 0x800)
+         || (4 == len && cp < 0x10000) || cp > 0x10ffff
+         || (cp >= 0xd800 && cp <= 0xdfff) ) return false;
+        p += len;
+    }
+    return true;
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
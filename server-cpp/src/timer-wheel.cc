@@ -0,0 +1,74 @@
+#include "sync-http-srv/timer-wheel.hh"
+
+#include <cassert>
+
+namespace sync_http_srv {
+namespace util {
+
+TimerWheel::TimerWheel( Clock::duration resolution
+                      , size_t nSlots
+                      , Clock::time_point origin
+                      ) : _resolution(resolution)
+                        , _origin(origin)
+                        , _current(0)
+                        , _nActive(0)
+                        , _slots(nSlots ? nSlots : 1)
+                        {
+    assert(_resolution.count() > 0);
+    for(Node & head : _slots) _init(head);
+    _init(_expiring);
+}
+
+TimerWheel::Tick
+TimerWheel::_floor_tick(Clock::time_point tp) const {
+    if(tp <= _origin) return 0;
+    return (tp - _origin)/_resolution;
+}
+
+void
+TimerWheel::schedule(int key, Clock::time_point deadline) {
+    if(Clock::time_point::max() == deadline) {
+        cancel(key);
+        return;
+    }
+    // round up, so timer never fires before deadline
+    Tick tick = _floor_tick(deadline);
+    if(deadline > _origin + tick*_resolution) ++tick;
+    if(tick <= _current) tick = _current + 1;
+    auto ir = _nodes.try_emplace(key);
+    Node & n = ir.first->second;
+    if(ir.second) {
+        n.key = key;
+        n.tick = 0;
+        _init(n);
+    }
+    if(n.tick == tick) return;  // already scheduled
+    if(n.tick) _unlink(n);
+    else ++_nActive;
+    n.tick = tick;
+    _link(_slots[tick % _slots.size()], n);
+}
+
+void
+TimerWheel::cancel(int key) {
+    auto it = _nodes.find(key);
+    if(_nodes.end() == it || !it->second.tick) return;
+    // entry is kept for the key to be rescheduled
+    _unlink(it->second);
+    it->second.tick = 0;
+    --_nActive;
+}
+
+int
+TimerWheel::timeout_ms(Clock::time_point now) const {
+    if(!_nActive) return -1;
+    const auto nextTick = _origin + (_floor_tick(now) + 1)*_resolution;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            nextTick - now).count();
+    // round up, so caller does not wake up before the tick
+    if(nextTick - now > std::chrono::milliseconds(ms)) ++ms;
+    return ms > 0 ? (int) ms : 1;
+}
+
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
@@ -1,7 +1,9 @@
 #include "sync-http-srv/uri.hh"
 
 #include <wordexp.h>
+#include <algorithm>
 #include <regex>
+#include <string_view>
 #include <vector>
 
 namespace sync_http_srv {
@@ -14,20 +16,30 @@ std::unordered_multimap<std::string, std::string>
 URI::parse_query_string( const std::string & str
                        , const std::string & rxS
                        ) {
-    std::regex rx(rxS);
     std::unordered_multimap<std::string, std::string> result;
     if(str.empty()) return result;
-    auto const vec = std::vector<std::string>(
-            std::sregex_token_iterator{begin(str), end(str), rx, -1},
-            std::sregex_token_iterator{}
-        );
-    for(auto entry : vec) {
+    auto add = [&](std::string_view entry) {
         size_t nEq = entry.find('=');
-        if(std::string::npos != nEq)
+        if(std::string_view::npos != nEq)
             result.emplace( entry.substr(0, nEq), entry.substr(nEq+1) );
         else
             result.emplace( entry, "");
+    };
+    if(rxS == "&") {
+        // default delimiter is split without regex
+        std::string_view rest(str);
+        for(size_t n; std::string_view::npos != (n = rest.find('&')); rest.remove_prefix(n + 1)) {
+            add(rest.substr(0, n));
+        }
+        if(!rest.empty()) add(rest);
+        return result;
     }
+    std::regex rx(rxS);
+    auto const vec = std::vector<std::string>(
+            std::sregex_token_iterator{begin(str), end(str), rx, -1},
+            std::sregex_token_iterator{}
+        );
+    for(const auto & entry : vec) add(entry);
     return result;
 }
 
@@ -119,32 +131,39 @@ const std::regex rxURI(
 //           12            3  4          5       6  7        8 9
 
 URI::URI(const std::string & strUri) {
-    std::smatch m;
-    if(!std::regex_match(strUri, m, rxURI)) {
-        char errBf[128];
-        snprintf( errBf, sizeof(errBf)
-                , "String does not match URI format: \"%s\""
-                , strUri.c_str() );
-        throw errors::InvalidURI(errBf);
+    // Splits string as `rxURI` does, without matching it (any string
+    // matches)
+    std::string_view rest(strUri);
+    size_t n = rest.find_first_of(":/?#");
+    if(std::string_view::npos != n && n && ':' == rest[n]) {
+        _scheme = rest.substr(0, n);
+        rest.remove_prefix(n + 1);
     }
+    std::string_view authority;
+    if(!rest.compare(0, 2, "//")) {
+        rest.remove_prefix(2);
+        n = std::min(rest.find_first_of("/?#"), rest.size());
+        authority = rest.substr(0, n);
+        rest.remove_prefix(n);
+    }
+    n = std::min(rest.find_first_of("?#"), rest.size());
+    _path = rest.substr(0, n);
+    rest.remove_prefix(n);
+    if(!rest.empty() && '?' == rest[0]) {
+        n = std::min(rest.find('#'), rest.size());
+        _qParams = parse_query_string(std::string(rest.substr(1, n - 1)));
+        rest.remove_prefix(n);
+    }
+    if(!rest.empty()) _fragment = rest.substr(1);  // after `#`
 
-    std::vector<std::string> groups(m.begin(), m.end());
-
-    _scheme   = groups[2];
-    //_host     = groups[4];
-    _path     = groups[5];
-    _qParams  = parse_query_string(groups[7]);
-    _fragment = groups[9];
-
-    std::string authority = groups[4];
     if(!authority.empty()) {
-        size_t n = authority.find('@');
-        if(n != std::string::npos) {
+        n = authority.find('@');
+        if(n != std::string_view::npos) {
             _userinfo = authority.substr(0, n);
         }
-        if(n == std::string::npos) n = 0; else ++n;
+        if(n == std::string_view::npos) n = 0; else ++n;
         size_t nn = authority.find(':', n);
-        if(nn != std::string::npos) {
+        if(nn != std::string_view::npos) {
             _host = authority.substr(n, nn - n );
             _port = authority.substr(++nn);
         } else {
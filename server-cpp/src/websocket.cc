@@ -0,0 +1,627 @@
+#include "sync-http-srv/websocket.hh"
+#include "sync-http-srv/error.hh"
+#include "strutil.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace sync_http_srv {
+namespace util {
+namespace http {
+
+//                                                        _____________________
+// _____________________________________________________/ Handshake and framing
+
+namespace {
+/// Returns whether comma-separated header value lists lowercase token
+bool
+_has_token(std::string_view value, std::string_view token) {
+    while(!value.empty()) {
+        const size_t e = value.find(',');
+        std::string_view item = _trim(value.substr(0, e));
+        if(_iequals(token, item)) return true;
+        value.remove_prefix(std::string_view::npos == e ? value.size() : e + 1);
+    }
+    return false;
+}
+
+/// SHA-1 digest, needed by opening handshake only (RFC 3174)
+void
+_sha1(std::string_view data, uint8_t digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    auto rol = [](uint32_t v, int n) { return (v << n) | (v >> (32 - n)); };
+    // message is padded with 0x80, zeroes and bit length to 64-byte blocks
+    std::string m(data);
+    const uint64_t nBits = uint64_t(data.size())*8;
+    m.push_back(char(0x80));
+    while(56 != m.size() % 64) m.push_back('\0');
+    for(int i = 7; i >= 0; --i) m.push_back(char(nBits >> (8*i)));
+    for(size_t b = 0; b < m.size(); b += 64) {
+        uint32_t w[80];
+        for(int i = 0; i < 16; ++i) {
+            const uint8_t * p = reinterpret_cast<const uint8_t *>(m.data() + b + 4*i);
+            w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16)
+                 | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+        for(int i = 16; i < 80; ++i) w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+        uint32_t a = h[0], bb = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if(i < 20)      { f = (bb & c) | (~bb & d);           k = 0x5a827999; }
+            else if(i < 40) { f = bb ^ c ^ d;                     k = 0x6ed9eba1; }
+            else if(i < 60) { f = (bb & c) | (bb & d) | (c & d);  k = 0x8f1bbcdc; }
+            else            { f = bb ^ c ^ d;                     k = 0xca62c1d6; }
+            const uint32_t t = rol(a, 5) + f + e + k + w[i];
+            e = d; d = c; c = rol(bb, 30); bb = a; a = t;
+        }
+        h[0] += a; h[1] += bb; h[2] += c; h[3] += d; h[4] += e;
+    }
+    for(int i = 0; i < 5; ++i) {
+        for(int j = 0; j < 4; ++j) digest[4*i + j] = uint8_t(h[i] >> (24 - 8*j));
+    }
+}
+
+std::string
+_base64(const uint8_t * data, size_t len) {
+    static const char kAlphabet[]
+        = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    out.reserve(4*((len + 2)/3));
+    for(size_t i = 0; i < len; i += 3) {
+        const uint32_t v = (uint32_t(data[i]) << 16)
+                         | (i + 1 < len ? uint32_t(data[i + 1]) << 8 : 0)
+                         | (i + 2 < len ? uint32_t(data[i + 2]) : 0);
+        out.push_back(kAlphabet[(v >> 18) & 0x3f]);
+        out.push_back(kAlphabet[(v >> 12) & 0x3f]);
+        out.push_back(i + 1 < len ? kAlphabet[(v >> 6) & 0x3f] : '=');
+        out.push_back(i + 2 < len ? kAlphabet[v & 0x3f] : '=');
+    }
+    return out;
+}
+
+/// Unmasks payload in place, eight bytes at once
+void
+_unmask(char * p, size_t n, const uint8_t key[4]) {
+    uint32_t k4;
+    memcpy(&k4, key, 4);
+    // same halves make byte order of the word irrelevant
+    const uint64_t k8 = (uint64_t(k4) << 32) | k4;
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        uint64_t v;
+        memcpy(&v, p + i, 8);
+        v ^= k8;
+        memcpy(p + i, &v, 8);
+    }
+    for(; i < n; ++i) p[i] ^= key[i & 0x3];
+}
+
+/// Appends unmasked (server) frame
+void
+_append_frame( std::string & out, bool fin
+             , WebSocketEndpoint::Opcode opcode, std::string_view payload ) {
+    const uint64_t len = payload.size();
+    out.reserve(out.size() + 10 + len);
+    out.push_back(char((fin ? 0x80 : 0x0) | opcode));
+    if(len < 126) {
+        out.push_back(char(len));
+    } else if(len <= 0xffff) {
+        out.push_back(char(126));
+        out.push_back(char(len >> 8));
+        out.push_back(char(len & 0xff));
+    } else {
+        out.push_back(char(127));
+        for(int i = 7; i >= 0; --i) out.push_back(char(len >> (8*i)));
+    }
+    out.append(payload);
+}
+
+/// Returns whether close status may be sent by peer (RFC 6455, 7.4)
+bool
+_valid_close_code(uint16_t code) {
+    if(code < 1000 || code >= 5000) return false;
+    if(code >= 3000) return true;  // registered and private ones
+    return code <= 1014 && 1004 != code && 1005 != code && 1006 != code;
+}
+}  // anonymous namespace
+
+std::string
+WebSocketEndpoint::accept_key(std::string_view key) {
+    uint8_t digest[20];
+    _sha1(std::string(key) + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", digest);
+    return _base64(digest, sizeof(digest));
+}
+
+//                                                          ___________________
+// _______________________________________________________/ Endpoint interface
+
+WebSocketEndpoint::WebSocketEndpoint( iJournal & L
+                                    , size_t maxSessions
+                                    , size_t maxMessage
+                                    , std::chrono::milliseconds pingInterval
+                                    , size_t maxFrame
+                                    , size_t maxBacklog )
+        : SessionEndpoint(L, "WebSocket endpoint")
+        , _maxSessions(maxSessions)
+        , _maxMessage(maxMessage)
+        , _maxFrame(maxFrame)
+        , _maxBacklog(maxBacklog)
+        , _pingInterval(pingInterval)
+        , _lastID(0)
+        , _nReceived(0)
+        , _nSent(0)
+        {}
+
+WebSocketEndpoint::~WebSocketEndpoint() {
+    _halt();
+    for(const Session & s : _sessions) ::close(s.fd);
+}
+
+Server::HandleResult
+WebSocketEndpoint::handle( const RequestMsg & rq, int clientFD
+                         , const Server::iRoute::URLParameters & urlParams ) {
+    if(Msg::GET != rq.method()) {
+        auto rp = rq.response(Msg::MethodNotAllowed);
+        rp->set_header("allow", "GET");
+        rp->set_header("content-length", "0");
+        return {0x0, rp};
+    }
+    if( rq.version() < Msg::HTTP_1_1
+     || !_has_token(rq.get_header_view("upgrade"), "websocket")
+     || !_has_token(rq.get_header_view("connection"), "upgrade")
+     || "13" != _trim(rq.get_header_view("sec-websocket-version")) ) {
+        auto rp = rq.response(Msg::UpgradeRequired);
+        rp->set_header("upgrade", "websocket");
+        rp->set_header("sec-websocket-version", "13");
+        rp->set_header("content-length", "0");
+        return {0x0, rp};
+    }
+    // key is base64 of 16 bytes
+    const std::string_view key = _trim(rq.get_header_view("sec-websocket-key"));
+    if(24 != key.size()) {
+        auto rp = rq.response(Msg::BadRequest);
+        rp->set_header("content-length", "0");
+        return {0x0, rp};
+    }
+    if(!accept(rq, urlParams)) {
+        auto rp = rq.response(Msg::Forbidden);
+        rp->set_header("content-length", "0");
+        return {0x0, rp};
+    }
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_sessions.size() >= _maxSessions) {
+        _L.warn(util::format("WebSocket endpoint has %zu session(s) already,"
+                    " upgrade rejected.", _sessions.size()).c_str());
+        auto rp = rq.response(Msg::ServiceUnvailable);
+        rp->set_header("content-type", "application/json");
+        rp->set_header("retry-after", "5");
+        rp->content(std::make_shared<StringContent>(
+                    "{\"errors\":[\"Too many WebSocket sessions.\"]}"));
+        return {0x0, rp};
+    }
+    // socket is served by session thread from now on
+    Session s;
+    s.ipStr = _take_over(clientFD);
+    s.id = ++_lastID;
+    s.fd = clientFD;
+    s.nParsed = 0;
+    s.messageOpcode = kContinuation;
+    s.nSent = 0;
+    s.lastReceived = Clock::now();
+    s.pingSent = s.closeSent = false;
+    s.dropReason = nullptr;
+    s.closeDeadline = Clock::time_point::max();
+    s.closeCode = kNoStatus;
+    s.opened = false;
+    std::string head(Msg::status_line(Msg::SwitchingProtocols));
+    head.append("upgrade: websocket\r\n"
+                "connection: Upgrade\r\n"
+                "sec-websocket-accept: ").append(accept_key(key)).append("\r\n")
+        .append(rq.common_headers()).append("\r\n");
+    s.nQueued = head.size();
+    s.out.push_back(std::move(head));
+    // frames must not precede handshake response
+    s.nUrgent = 1;
+    _L.debug(util::format("WebSocket session #%llu with %s established."
+                , (unsigned long long) s.id, s.ipStr.c_str()).c_str());
+    _sessions.push_back(std::move(s));
+    _start();
+    return {Server::kKeepClientConnection | Server::kNoDispatchResponse, nullptr};
+}
+
+WebSocketEndpoint::Session *
+WebSocketEndpoint::_session(SessionID id) {
+    for(Session & s : _sessions) {
+        if(id == s.id) return &s;
+    }
+    return nullptr;
+}
+
+void
+WebSocketEndpoint::_queue(Session & s, Opcode opcode, std::string_view payload) {
+    if(opcode & 0x8) {
+        // control frame goes ahead of data frames not being sent yet, but
+        // can not interrupt frame being sent
+        const size_t pos = std::max<size_t>(s.nUrgent, s.nSent && !s.out.empty() ? 1 : 0);
+        if(kClose == opcode) {
+            // no data frames are sent after close frame
+            for(size_t i = pos; i < s.out.size(); ++i) s.nQueued -= s.out[i].size();
+            s.out.erase(s.out.begin() + pos, s.out.end());
+        }
+        std::string frame;
+        _append_frame(frame, true, opcode, payload);
+        s.nQueued += frame.size();
+        s.out.insert(s.out.begin() + pos, std::move(frame));
+        s.nUrgent = pos + 1;
+        return;
+    }
+    bool first = true;
+    do {
+        const size_t n = _maxFrame ? std::min(payload.size(), _maxFrame) : payload.size();
+        std::string frame;
+        _append_frame(frame, n == payload.size(), first ? opcode : kContinuation
+                     , payload.substr(0, n));
+        s.nQueued += frame.size();
+        s.out.push_back(std::move(frame));
+        payload.remove_prefix(n);
+        first = false;
+    } while(!payload.empty());
+}
+
+void
+WebSocketEndpoint::_fail(Session & s, uint16_t code, const char * reason) {
+    _L.info(util::format("WebSocket session #%llu with %s failed: %s."
+                , (unsigned long long) s.id, s.ipStr.c_str(), reason).c_str());
+    if(!s.closeSent) {
+        const char status[2] = {char(code >> 8), char(code & 0xff)};
+        _queue(s, kClose, std::string_view(status, 2));
+        s.closeSent = true;
+    }
+    if(!s.dropReason) s.dropReason = reason;
+}
+
+bool
+WebSocketEndpoint::send(SessionID id, std::string_view payload, Opcode opcode) {
+    assert(kText == opcode || kBinary == opcode);
+    std::lock_guard<std::mutex> lock(_mtx);
+    Session * s = _session(id);
+    if(!s || s->closeSent || s->dropReason) return false;
+    if(s->nQueued + payload.size() > _maxBacklog) {
+        // client does not read, further frames would pile up
+        s->out.clear();
+        s->nSent = s->nQueued = s->nUrgent = 0;
+        s->dropReason = "client lags behind";
+        _wake();
+        return false;
+    }
+    _queue(*s, opcode, payload);
+    ++_nSent;
+    _wake();
+    return true;
+}
+
+void
+WebSocketEndpoint::broadcast(std::string_view payload, Opcode opcode) {
+    assert(kText == opcode || kBinary == opcode);
+    // frames are built once and copied to every session
+    Session proto;
+    proto.nSent = proto.nQueued = proto.nUrgent = 0;
+    _queue(proto, opcode, payload);
+    std::lock_guard<std::mutex> lock(_mtx);
+    if(_sessions.empty()) return;
+    for(Session & s : _sessions) {
+        if(s.closeSent || s.dropReason) continue;
+        if(s.nQueued + proto.nQueued > _maxBacklog) {
+            s.out.clear();
+            s.nSent = s.nQueued = s.nUrgent = 0;
+            s.dropReason = "client lags behind";
+            continue;
+        }
+        s.out.insert(s.out.end(), proto.out.begin(), proto.out.end());
+        s.nQueued += proto.nQueued;
+        ++_nSent;
+    }
+    _wake();
+}
+
+void
+WebSocketEndpoint::close(SessionID id, uint16_t code) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    Session * s = _session(id);
+    if(!s || s->closeSent) return;
+    const char status[2] = {char(code >> 8), char(code & 0xff)};
+    _queue(*s, kClose, std::string_view(status, 2));
+    s->closeSent = true;
+    _wake();
+}
+
+size_t
+WebSocketEndpoint::n_sessions() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _sessions.size();
+}
+
+size_t
+WebSocketEndpoint::n_received() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nReceived;
+}
+
+size_t
+WebSocketEndpoint::n_sent() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _nSent;
+}
+
+//                                                              _______________
+// ___________________________________________________________/ Session thread
+
+bool
+WebSocketEndpoint::_receive(Session & s, std::vector<Event> & events) {
+    constexpr size_t kPortion = 16*1024;
+    if(s.dropReason) {
+        // nothing is parsed anymore, data would pile up
+        s.in.clear();
+        s.nParsed = 0;
+    }
+    while(true) {
+        const size_t had = s.in.size();
+        s.in.resize(had + kPortion);
+        const ssize_t n = ::recv(s.fd, s.in.data() + had, kPortion, MSG_DONTWAIT);
+        if(n > 0) {
+            if(s.dropReason) {
+                s.in.resize(had);
+            } else {
+                s.in.resize(had + n);
+                s.lastReceived = Clock::now();
+                s.pingSent = false;  // any data proves client is alive
+            }
+            if(size_t(n) < kPortion) break;
+            continue;
+        }
+        s.in.resize(had);
+        if(0 == n) return false;
+        if(EINTR == errno) continue;
+        if(EAGAIN == errno || EWOULDBLOCK == errno) break;
+        return false;
+    }
+    _parse(s, events);
+    return true;
+}
+
+void
+WebSocketEndpoint::_parse(Session & s, std::vector<Event> & events) {
+    while(!s.dropReason) {
+        const size_t avail = s.in.size() - s.nParsed;
+        const uint8_t * p = reinterpret_cast<const uint8_t *>(s.in.data() + s.nParsed);
+        if(avail < 2) break;
+        const bool fin = p[0] & 0x80
+                 , masked = p[1] & 0x80
+                 ;
+        const Opcode opcode = Opcode(p[0] & 0x0f);
+        uint64_t len = p[1] & 0x7f;
+        size_t hdrLen = 2;
+        if(126 == len) {
+            if(avail < 4) break;
+            len = (uint64_t(p[2]) << 8) | p[3];
+            hdrLen = 4;
+        } else if(127 == len) {
+            if(avail < 10) break;
+            len = 0;
+            for(int i = 0; i < 8; ++i) len = (len << 8) | p[2 + i];
+            hdrLen = 10;
+        }
+        const bool control = opcode & 0x8;
+        if(p[0] & 0x70) {
+            _fail(s, kProtocolError, "reserved bits are set");
+            break;
+        }
+        if(!masked) {
+            _fail(s, kProtocolError, "client frame is not masked");
+            break;
+        }
+        if( control ? (kClose != opcode && kPing != opcode && kPong != opcode)
+                    : (kContinuation != opcode && kText != opcode && kBinary != opcode) ) {
+            _fail(s, kProtocolError, "unknown opcode");
+            break;
+        }
+        if(control && (!fin || len > 125)) {
+            _fail(s, kProtocolError, "fragmented or too long control frame");
+            break;
+        }
+        if(!control && (len > _maxMessage || s.message.size() + len > _maxMessage)) {
+            _fail(s, kMessageTooBig, "message is too big");
+            break;
+        }
+        if(avail < hdrLen + 4 + len) break;  // wait for the rest of frame
+        char * payload = s.in.data() + s.nParsed + hdrLen + 4;
+        _unmask(payload, len, p + hdrLen);
+        s.nParsed += hdrLen + 4 + len;
+        const std::string_view data(payload, len);
+        if(kPing == opcode) {
+            if(!s.closeSent) _queue(s, kPong, data);
+        } else if(kClose == opcode) {
+            uint16_t code = kNoStatus;
+            if(len >= 2) code = (uint16_t(uint8_t(data[0])) << 8) | uint8_t(data[1]);
+            if(1 == len || (len >= 2 && !_valid_close_code(code))) {
+                _fail(s, kProtocolError, "invalid close status");
+                break;
+            }
+            if(len > 2 && !_valid_utf8(data.substr(2))) {
+                _fail(s, kInvalidPayload, "invalid UTF-8 close reason");
+                break;
+            }
+            s.closeCode = code;
+            if(!s.closeSent) {
+                // echo status, connection is closed once echo is sent
+                _queue(s, kClose, data.substr(0, len >= 2 ? 2 : 0));
+                s.closeSent = true;
+            }
+            s.dropReason = "closed by client";
+        } else if(kPong != opcode && !s.closeSent) {
+            // data frame; ones arriving after close frame is sent are ignored
+            if(kContinuation == opcode) {
+                if(kContinuation == s.messageOpcode) {
+                    _fail(s, kProtocolError, "continuation of no message");
+                    break;
+                }
+            } else {
+                if(kContinuation != s.messageOpcode) {
+                    _fail(s, kProtocolError, "new message amid fragmented one");
+                    break;
+                }
+                s.messageOpcode = opcode;
+            }
+            s.message.append(data);
+            if(fin) {
+                if(kText == s.messageOpcode && !_valid_utf8(s.message)) {
+                    _fail(s, kInvalidPayload, "invalid UTF-8 text");
+                    break;
+                }
+                events.push_back(Event{ Event::kMessage, s.id, s.messageOpcode
+                                      , 0, std::move(s.message) });
+                s.message.clear();
+                s.messageOpcode = kContinuation;
+                ++_nReceived;
+            }
+        }
+    }
+    // drop parsed data
+    if(s.nParsed == s.in.size()) {
+        s.in.clear();
+        s.nParsed = 0;
+    } else if(s.nParsed > s.in.size()/2) {
+        s.in.erase(0, s.nParsed);
+        s.nParsed = 0;
+    }
+}
+
+bool
+WebSocketEndpoint::_flush(Session & s) {
+    while(!s.out.empty()) {
+        const std::string & frame = s.out.front();
+        const ssize_t n = ::send( s.fd, frame.data() + s.nSent, frame.size() - s.nSent
+                                , MSG_DONTWAIT | MSG_NOSIGNAL );
+        if(n < 0) {
+            if(EINTR == errno) continue;
+            return EAGAIN == errno || EWOULDBLOCK == errno;
+        }
+        s.nSent += n;
+        s.nQueued -= n;
+        if(s.nSent == frame.size()) {
+            s.out.pop_front();
+            s.nSent = 0;
+            if(s.nUrgent) --s.nUrgent;
+        }
+    }
+    return true;
+}
+
+void
+WebSocketEndpoint::_drop(size_t nSession, const char * reason, std::vector<Event> & events) {
+    assert(nSession < _sessions.size());
+    const Session & s = _sessions[nSession];
+    _L.debug(util::format("WebSocket session #%llu with %s closed: %s."
+                , (unsigned long long) s.id, s.ipStr.c_str(), reason).c_str());
+    ::close(s.fd);
+    if(s.opened) events.push_back(Event{Event::kClose, s.id, kContinuation, s.closeCode, {}});
+    _sessions.erase(_sessions.begin() + nSession);
+}
+
+WebSocketEndpoint::Clock::time_point
+WebSocketEndpoint::_visit(std::unique_lock<std::mutex> & lock, Clock::time_point now) {
+    Clock::time_point deadline = Clock::time_point::max();
+    for(size_t i = 0; i < _sessions.size(); ) {
+        Session & s = _sessions[i];
+        if(!s.opened) {
+            s.opened = true;
+            _events.push_back(Event{Event::kOpen, s.id, kContinuation, 0, {}});
+        }
+        if(s.closeSent || s.dropReason) {
+            // closing session waits for close frame or for queued frames to
+            // be sent, yet no longer than ping interval
+            if(Clock::time_point::max() == s.closeDeadline)
+                s.closeDeadline = now + _pingInterval;
+            if(now >= s.closeDeadline) {
+                _drop(i, s.dropReason ? s.dropReason : "no close frame received", _events);
+                continue;
+            }
+            deadline = std::min(deadline, s.closeDeadline);
+        } else {
+            // silent session is pinged, then dropped if still silent
+            if(now - s.lastReceived >= 2*_pingInterval) {
+                _drop(i, "no pong received", _events);
+                continue;
+            }
+            if(!s.pingSent && now - s.lastReceived >= _pingInterval) {
+                _queue(s, kPing, std::string_view());
+                s.pingSent = true;
+            }
+            deadline = std::min(deadline, s.lastReceived
+                    + (s.pingSent ? 2 : 1)*_pingInterval);
+        }
+        if(!_flush(s)) {
+            _drop(i, strerror(errno), _events);
+            continue;
+        }
+        if(s.dropReason && s.out.empty()) {
+            _drop(i, s.dropReason, _events);
+            continue;
+        }
+        ++i;
+    }
+    if(_events.empty()) return deadline;
+    // events are moved out, as callbacks are called with no lock held
+    std::vector<Event> events;
+    events.swap(_events);
+    lock.unlock();
+    for(Event & e : events) {
+        try {
+            switch(e.type) {
+                case Event::kOpen:
+                    on_open(e.id);
+                    break;
+                case Event::kMessage:
+                    on_message(e.id, e.opcode, e.payload);
+                    break;
+                case Event::kClose:
+                    on_close(e.id, e.closeCode);
+                    break;
+            };
+        } catch( std::exception & err ) {
+            _L.error(util::format("WebSocket session #%llu callback"
+                        " error: %s", (unsigned long long) e.id
+                        , err.what()).c_str());
+        }
+    }
+    lock.lock();
+    // callbacks may have queued messages
+    return now;
+}
+
+void
+WebSocketEndpoint::_poll_set(std::vector<pollfd> & pfds) const {
+    for(const Session & s : _sessions) {
+        pfds.push_back(pollfd{ s.fd
+                , static_cast<short>(POLLIN | (s.out.empty() ? 0 : POLLOUT)), 0 });
+    }
+}
+
+void
+WebSocketEndpoint::_on_ready(const pollfd * pfds, size_t n) {
+    // reverse order keeps indices of polled sessions valid on removal
+    for(size_t i = n; i-- > 0; ) {
+        if(!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        assert(_sessions[i].fd == pfds[i].fd);
+        if(!_receive(_sessions[i], _events))
+            _drop(i, "client closed connection", _events);
+    }
+}
+
+}  // namespace ::sync_http_srv::util::http
+}  // namespace ::sync_http_srv::util
+}  // namespace sync_http_srv
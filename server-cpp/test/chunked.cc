@@ -0,0 +1,187 @@
+#include "sync-http-srv/server.hh"
+#include "silent-journal.hh"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace sync_http_srv::util::http;
+namespace errors = sync_http_srv::errors;
+
+namespace {
+
+/// Parses request fed by portions of `step` bytes
+class ChunkedTest : public ::testing::Test {
+protected:
+    sync_http_srv::test::SilentJournal L;
+    RequestMsg rq;
+    MsgParser parser;
+
+    ChunkedTest(size_t maxContentLen=SIZE_MAX) : parser(rq, 1024*1024, maxContentLen) {}
+
+    /// Feeds data as client socket would, keeping unconsumed tail; returns
+    /// number of bytes left unconsumed
+    size_t feed(const std::string & data, size_t step=std::string::npos) {
+        std::string pending;
+        for(size_t i = 0; i < data.size() && !parser.done(); i += step) {
+            pending.append(data, i, step);
+            pending.erase(0, parser.feed(pending.data(), pending.size(), L));
+            if(std::string::npos == step) break;
+        }
+        return pending.size();
+    }
+
+    std::string content() const {
+        if(!rq.has_content()) return "";
+        std::string s(rq.content()->size(), '\0');
+        rq.content()->copy_to(s.data(), s.size());
+        return s;
+    }
+
+    /// Returns status code of error thrown on parsing, 0 if none
+    int status_of(const std::string & data) {
+        try {
+            feed(data);
+        } catch(errors::GenericHTTPError & e) {
+            return e.statusCode;
+        }
+        return 0;
+    }
+};
+
+/// Parses request with content limited to 16 bytes
+class ContentLimitTest : public ChunkedTest {
+protected:
+    ContentLimitTest() : ChunkedTest(16) {}
+};
+
+const std::string kHead = "POST /x HTTP/1.1\r\nHost: h\r\n"
+                          "Transfer-Encoding: chunked\r\n\r\n";
+
+}  // anonymous namespace
+
+TEST_F(ChunkedTest, DecodesChunks) {
+    EXPECT_EQ(0u, feed(kHead + "5\r\nhello\r\n7\r\n, world\r\n0\r\n\r\n"));
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ("hello, world", content());
+}
+
+TEST_F(ChunkedTest, DecodesHexSizesOfAnyCase) {
+    const std::string data(26, 'x');
+    feed(kHead + "1a\r\n" + data + "\r\n1A\r\n" + data + "\r\n0\r\n\r\n");
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ(data + data, content());
+}
+
+TEST_F(ChunkedTest, IgnoresExtensions) {
+    feed(kHead + "3;name=value\r\nabc\r\n0;last\r\n\r\n");
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ("abc", content());
+}
+
+TEST_F(ChunkedTest, SkipsTrailers) {
+    feed(kHead + "3\r\nabc\r\n0\r\nExpires: never\r\nX-Sum: 1\r\n\r\n");
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ("abc", content());
+}
+
+TEST_F(ChunkedTest, LeavesPipelinedDataUnconsumed) {
+    EXPECT_EQ(3u, feed(kHead + "3\r\nabc\r\n0\r\n\r\nGET"));
+    EXPECT_TRUE(parser.done());
+}
+
+TEST_F(ChunkedTest, DecodesBytewiseFeed) {
+    feed(kHead + "5\r\nhello\r\n1\r\n!\r\n0\r\nX: y\r\n\r\n", 1);
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ("hello!", content());
+}
+
+TEST_F(ChunkedTest, WaitsForCompleteMessage) {
+    feed(kHead + "5\r\nhel");
+    EXPECT_EQ(MsgParser::kChunkData, parser.state());
+    feed("lo\r\n0\r\n");
+    EXPECT_EQ(MsgParser::kTrailers, parser.state());
+    feed("\r\n");
+    EXPECT_TRUE(parser.done());
+    EXPECT_EQ("hello", content());
+}
+
+TEST_F(ChunkedTest, RejectsBadSizeLine) {
+    EXPECT_EQ(400, status_of(kHead + "zz\r\n"));
+}
+
+TEST_F(ChunkedTest, RejectsSizeWithGarbage) {
+    EXPECT_EQ(400, status_of(kHead + "5x\r\nhello\r\n"));
+}
+
+TEST_F(ChunkedTest, RejectsMissingChunkTerminator) {
+    EXPECT_EQ(400, status_of(kHead + "3\r\nabcd\r\n"));
+}
+
+TEST_F(ChunkedTest, RejectsOverflowingSize) {
+    EXPECT_EQ(400, status_of(kHead + "1ffffffffffffffff\r\n"));
+}
+
+TEST_F(ChunkedTest, RejectsEndlessSizeLine) {
+    EXPECT_EQ(400, status_of(kHead + "5" + std::string(2048, ' ')));
+}
+
+TEST_F(ChunkedTest, RejectsChunkedWithContentLength) {
+    EXPECT_EQ(400, status_of( "POST /x HTTP/1.1\r\nContent-Length: 100\r\n"
+                "Transfer-Encoding: chunked\r\n\r\n2\r\nok\r\n0\r\n\r\n" ));
+}
+
+TEST_F(ChunkedTest, AcceptsCodingNamesOfAnyCase) {
+    feed( "POST /x HTTP/1.1\r\nTransfer-Encoding: Identity, CHUNKED\r\n\r\n"
+          "2\r\nok\r\n0\r\n\r\n" );
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ("ok", content());
+}
+
+TEST_F(ChunkedTest, TreatsIdentityAsNoCoding) {
+    EXPECT_EQ(0u, feed("POST /x HTTP/1.1\r\nTransfer-Encoding: Identity\r\n\r\n"));
+    ASSERT_TRUE(parser.done());
+    EXPECT_FALSE(rq.has_content());
+}
+
+TEST_F(ChunkedTest, CombinesRepeatedCodingLines) {
+    // the last line alone would make content to be of no length
+    EXPECT_EQ(501, status_of( "POST /x HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+                "Transfer-Encoding: identity\r\n\r\n2\r\nok\r\n0\r\n\r\n" ));
+}
+
+TEST_F(ChunkedTest, RejectsUnsupportedCodingBeforeChunked) {
+    EXPECT_EQ(501, status_of("POST /x HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n"));
+}
+
+TEST_F(ChunkedTest, RejectsChunkedNotLast) {
+    EXPECT_EQ(501, status_of("POST /x HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n"));
+}
+
+TEST_F(ChunkedTest, RejectsChunkedAppliedTwice) {
+    EXPECT_EQ(501, status_of("POST /x HTTP/1.1\r\nTransfer-Encoding: chunked, chunked\r\n\r\n"));
+}
+
+//                                                        _____________________
+// _____________________________________________________/ Content length limit
+
+TEST_F(ContentLimitTest, AcceptsContentWithinLimit) {
+    feed("POST /x HTTP/1.1\r\nContent-Length: 16\r\n\r\n" + std::string(16, 'a'));
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ(std::string(16, 'a'), content());
+}
+
+TEST_F(ContentLimitTest, AcceptsChunksWithinLimit) {
+    feed(kHead + "8\r\n01234567\r\n8\r\n89abcdef\r\n0\r\n\r\n");
+    ASSERT_TRUE(parser.done());
+    EXPECT_EQ("0123456789abcdef", content());
+}
+
+TEST_F(ContentLimitTest, RejectsDeclaredLengthBeyondLimit) {
+    EXPECT_EQ(413, status_of("POST /x HTTP/1.1\r\nContent-Length: 17\r\n\r\n"));
+}
+
+TEST_F(ContentLimitTest, RejectsChunksGrowingBeyondLimit) {
+    // rejected on size line, before chunk data arrive
+    EXPECT_EQ(413, status_of(kHead + "8\r\n01234567\r\n9\r\n"));
+}
@@ -0,0 +1,121 @@
+#include "sync-http-srv/compression.hh"
+
+#include <gtest/gtest.h>
+
+using namespace sync_http_srv::util::http;
+
+//                                                          ___________________
+// _______________________________________________________/ Coding negotiation
+
+TEST(NegotiateCodingTest, EmptyHeaderMeansIdentity) {
+    EXPECT_EQ(ContentCoding::kIdentity, negotiate_coding(""));
+}
+
+TEST(NegotiateCodingTest, ListedCodingIsChosen) {
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("gzip"));
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("x-gzip"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("deflate"));
+    EXPECT_EQ(ContentCoding::kIdentity, negotiate_coding("br, identity"));
+}
+
+TEST(NegotiateCodingTest, NamesAreCaseInsensitive) {
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("GZip"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("DEFLATE;Q=1"));
+}
+
+TEST(NegotiateCodingTest, GzipIsPreferredOnEqualQuality) {
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("deflate, gzip"));
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("deflate;q=0.5, gzip;q=0.5"));
+}
+
+TEST(NegotiateCodingTest, HigherQualityWins) {
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("gzip;q=0.5, deflate"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding(" gzip ; q=0.8 , deflate ; q=0.9 "));
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("gzip;q=0.001, deflate;q=0"));
+}
+
+TEST(NegotiateCodingTest, ZeroQualityExcludesCoding) {
+    EXPECT_EQ(ContentCoding::kIdentity, negotiate_coding("gzip;q=0"));
+    EXPECT_EQ(ContentCoding::kIdentity, negotiate_coding("gzip;q=0.000, deflate;q=0"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("gzip;q=0, deflate"));
+}
+
+TEST(NegotiateCodingTest, WildcardAppliesToUnlistedCodings) {
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("*"));
+    EXPECT_EQ(ContentCoding::kIdentity, negotiate_coding("*;q=0"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("*, gzip;q=0"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("gzip;q=0.2, *;q=0.5"));
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("gzip, *;q=0"));
+}
+
+TEST(NegotiateCodingTest, OtherParametersAreIgnored) {
+    EXPECT_EQ(ContentCoding::kIdentity, negotiate_coding("gzip;level=1;q=0"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("gzip;q=0.1, deflate;foo=bar"));
+}
+
+TEST(NegotiateCodingTest, MalformedQualityMeansOne) {
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("gzip;q=0.5, deflate;q=abc"));
+    EXPECT_EQ(ContentCoding::kDeflate, negotiate_coding("gzip;q=0.5, deflate;q=0.12345"));
+    // quality values above 1 are clamped
+    EXPECT_EQ(ContentCoding::kGzip, negotiate_coding("deflate, gzip;q=1.5"));
+}
+
+TEST(CompressibleTypeTest, TextualTypesAreCompressible) {
+    EXPECT_TRUE(compressible_type("text/html; charset=utf-8"));
+    EXPECT_TRUE(compressible_type("APPLICATION/JSON"));
+    EXPECT_TRUE(compressible_type("application/ld+json"));
+    EXPECT_TRUE(compressible_type("image/svg+xml"));
+    EXPECT_FALSE(compressible_type("image/png"));
+    EXPECT_FALSE(compressible_type("application/zip"));
+    EXPECT_FALSE(compressible_type(""));
+}
+
+//                                                             ________________
+// __________________________________________________________/ Entity tags
+
+TEST(CodedETagTest, CodingNameIsAppended) {
+    EXPECT_EQ("\"v1-gzip\"", coded_etag("\"v1\"", ContentCoding::kGzip));
+    EXPECT_EQ("W/\"v1-deflate\"", coded_etag("W/\"v1\"", ContentCoding::kDeflate));
+}
+
+TEST(CodedETagTest, IdentityAndMalformedAreKept) {
+    EXPECT_EQ("\"v1\"", coded_etag("\"v1\"", ContentCoding::kIdentity));
+    EXPECT_EQ("v1", coded_etag("v1", ContentCoding::kGzip));
+    EXPECT_EQ("", coded_etag("", ContentCoding::kGzip));
+}
+
+TEST(ETagMatchesTest, SameTagMatches) {
+    EXPECT_TRUE(etag_matches("\"v1\"", "\"v1\""));
+    EXPECT_FALSE(etag_matches("\"v2\"", "\"v1\""));
+    EXPECT_FALSE(etag_matches("", "\"v1\""));
+}
+
+TEST(ETagMatchesTest, ComparisonIsWeak) {
+    EXPECT_TRUE(etag_matches("W/\"v1\"", "\"v1\""));
+    EXPECT_TRUE(etag_matches("\"v1\"", "W/\"v1\""));
+    EXPECT_TRUE(etag_matches("W/\"v1\"", "W/\"v1\""));
+}
+
+TEST(ETagMatchesTest, AnyListedTagMatches) {
+    EXPECT_TRUE(etag_matches("\"a\", \"v1\"", "\"v1\""));
+    EXPECT_TRUE(etag_matches("\"a\",W/\"v1\" ,\"b\"", "\"v1\""));
+    EXPECT_FALSE(etag_matches("\"a\", \"b\"", "\"v1\""));
+    EXPECT_TRUE(etag_matches("*", "\"v1\""));
+}
+
+TEST(ETagMatchesTest, CodingSuffixIsIgnored) {
+    EXPECT_TRUE(etag_matches("\"v1-gzip\"", "\"v1\""));
+    EXPECT_TRUE(etag_matches("\"v1\"", "\"v1-deflate\""));
+    EXPECT_TRUE(etag_matches("\"v1-deflate\"", coded_etag("\"v1\"", ContentCoding::kGzip)));
+    EXPECT_TRUE(etag_matches("\"v1-GZIP\"", "\"v1\""));
+    // unknown codings are a part of opaque tag
+    EXPECT_FALSE(etag_matches("\"v1-br\"", "\"v1\""));
+    EXPECT_FALSE(etag_matches("\"v1gzip\"", "\"v1\""));
+}
+
+TEST(ETagMatchesTest, MalformedTagsDoNotMatch) {
+    EXPECT_FALSE(etag_matches("v1", "v1"));
+    EXPECT_FALSE(etag_matches("*", "v1"));
+    EXPECT_FALSE(etag_matches("\"v1", "\"v1\""));
+    EXPECT_FALSE(etag_matches("W/v1", "\"v1\""));
+}
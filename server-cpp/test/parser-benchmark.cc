@@ -0,0 +1,66 @@
+#include "sync-http-srv/server.hh"
+#include "silent-journal.hh"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <memory_resource>
+#include <string>
+
+using namespace sync_http_srv::util::http;
+
+namespace {
+
+/// Request as sent by browser fetching application data
+const std::string gBrowserRequest =
+    "GET /api/scene?run=1234&event=56789&detectors=ECAL,HCAL,MM HTTP/1.1\r\n"
+    "Host: localhost:8000\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: application/json, text/plain, */*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: http://localhost:8000/viewer/index.html\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=4f2a9c1e7b3d48e6a0c5f1b2d3e4a5b6; theme=dark\r\n"
+    "Sec-Fetch-Dest: empty\r\n"
+    "Sec-Fetch-Mode: cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-None-Match: \"5f3e-18c2a9b1f00\"\r\n"
+    "\r\n";
+
+/// Minimal request, as sent by scripted clients
+const std::string gMinimalRequest = "GET / HTTP/1.1\r\nHost: h\r\n\r\n";
+
+/// Request with large cookie, long values dominate
+const std::string gLongValueRequest = "GET / HTTP/1.1\r\nHost: h\r\nCookie: "
+    + std::string(2048, 'c') + "\r\n\r\n";
+
+/// Parses request received by portions of `step` bytes within request
+/// arena, as connection does: unconsumed data are fed again once more of
+/// them is received
+void
+parse_request(benchmark::State & state, const std::string & raw, size_t step) {
+    sync_http_srv::test::SilentJournal L;
+    char arenaBuffer[8*1024];
+    for(auto _ : state) {
+        std::pmr::monotonic_buffer_resource arena(arenaBuffer, sizeof(arenaBuffer));
+        RequestMsg rq(&arena);
+        MsgParser parser(rq, 1024*1024);
+        for(size_t received = 0, consumed = 0; !parser.done(); ) {
+            received = std::min(raw.size(), received + step);
+            consumed += parser.feed(raw.data() + consumed, received - consumed, L);
+        }
+        benchmark::DoNotOptimize(rq.method());
+    }
+    state.SetBytesProcessed(state.iterations()*raw.size());
+}
+
+}  // anonymous namespace
+
+BENCHMARK_CAPTURE(parse_request, browser, gBrowserRequest, std::string::npos);
+BENCHMARK_CAPTURE(parse_request, minimal, gMinimalRequest, std::string::npos);
+BENCHMARK_CAPTURE(parse_request, long_value, gLongValueRequest, std::string::npos);
+// request split in small segments
+BENCHMARK_CAPTURE(parse_request, browser_split, gBrowserRequest, 64);
+
+BENCHMARK_MAIN();
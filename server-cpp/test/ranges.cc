@@ -0,0 +1,217 @@
+#include "sync-http-srv/ranges.hh"
+#include "sync-http-srv/error.hh"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using namespace sync_http_srv::util::http;
+using sync_http_srv::errors::GenericRuntimeError;
+
+//                                                         ____________________
+// ______________________________________________________/ Range header parser
+
+namespace {
+
+class ParseRangesTest : public ::testing::Test {
+protected:
+    std::pmr::monotonic_buffer_resource arena;
+    std::pmr::vector<ByteRange> ranges;
+
+    ParseRangesTest() : ranges(&arena) {}
+
+    /// Parses header against content of 1000 bytes by default
+    RangesParse parse(std::string_view value, size_t size=1000, size_t maxRanges=16)
+        { return parse_ranges(value, size, ranges, maxRanges); }
+    /// Expects single range parsed
+    void expect_range(size_t first, size_t last) {
+        ASSERT_EQ(1u, ranges.size());
+        EXPECT_EQ(first, ranges[0].first);
+        EXPECT_EQ(last, ranges[0].last);
+    }
+};
+
+}  // anonymous namespace
+
+TEST_F(ParseRangesTest, ParsesClosedRange) {
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=0-499"));
+    expect_range(0, 499);
+    EXPECT_EQ(500u, ranges[0].length());
+}
+
+TEST_F(ParseRangesTest, ParsesOpenAndSuffixRanges) {
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=500-"));
+    expect_range(500, 999);
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=-200"));
+    expect_range(800, 999);
+}
+
+TEST_F(ParseRangesTest, ClipsRangesToContent) {
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=900-5000"));
+    expect_range(900, 999);
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=-2000"));
+    expect_range(0, 999);
+}
+
+TEST_F(ParseRangesTest, UnitAndWhitespaceAreTolerated) {
+    ASSERT_EQ(RangesParse::kSatisfiable, parse(" Bytes = 0-1 , , 5-6 "));
+    ASSERT_EQ(2u, ranges.size());
+    EXPECT_EQ(0u, ranges[0].first);
+    EXPECT_EQ(1u, ranges[0].last);
+    EXPECT_EQ(5u, ranges[1].first);
+    EXPECT_EQ(6u, ranges[1].last);
+}
+
+TEST_F(ParseRangesTest, SortsAndCoalescesRanges) {
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=500-599,0-99"));
+    ASSERT_EQ(2u, ranges.size());
+    EXPECT_EQ(0u, ranges[0].first);
+    EXPECT_EQ(500u, ranges[1].first);
+    // overlapping and adjoining ranges are merged
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=100-199,0-99,50-60,-700"));
+    ASSERT_EQ(2u, ranges.size());
+    EXPECT_EQ(0u, ranges[0].first);
+    EXPECT_EQ(199u, ranges[0].last);
+    EXPECT_EQ(300u, ranges[1].first);
+    EXPECT_EQ(999u, ranges[1].last);
+    ASSERT_EQ(RangesParse::kSatisfiable, parse("bytes=0-10,5-"));
+    expect_range(0, 999);
+}
+
+TEST_F(ParseRangesTest, UnsatisfiableRanges) {
+    EXPECT_EQ(RangesParse::kUnsatisfiable, parse("bytes=1000-"));
+    EXPECT_TRUE(ranges.empty());
+    EXPECT_EQ(RangesParse::kUnsatisfiable, parse("bytes=-0"));
+    EXPECT_EQ(RangesParse::kUnsatisfiable, parse("bytes=-5", 0));
+    EXPECT_EQ(RangesParse::kUnsatisfiable, parse("bytes=2000-3000,1000-"));
+    // satisfiable one is enough
+    EXPECT_EQ(RangesParse::kSatisfiable, parse("bytes=2000-3000,999-"));
+    expect_range(999, 999);
+}
+
+TEST_F(ParseRangesTest, MalformedHeaderIsIgnored) {
+    for(const char * value : { "", "bytes", "bytes=", "bytes=,", "items=0-1"
+                             , "bytes 0-1", "bytes=abc", "bytes=1", "bytes=5-1"
+                             , "bytes=1-2-3", "bytes=0-1,x", "bytes=--5"
+                             , "bytes=0-99999999999999999999999" }) {
+        EXPECT_EQ(RangesParse::kIgnored, parse(value)) << "value: " << value;
+        EXPECT_TRUE(ranges.empty()) << "value: " << value;
+    }
+}
+
+TEST_F(ParseRangesTest, TooManyRangesAreIgnored) {
+    EXPECT_EQ(RangesParse::kSatisfiable, parse("bytes=0-1,3-4", 1000, 2));
+    EXPECT_EQ(RangesParse::kIgnored, parse("bytes=0-1,3-4,6-7", 1000, 2));
+}
+
+//                                                         ____________________
+// ______________________________________________________/ Composite content
+
+namespace {
+
+/// Non-streamed content mapping whole data to file region at offset 100
+struct FileLikeContent : public StringContent {
+    FileLikeContent(const std::string & s) : StringContent(s) {}
+    size_t segment(size_t, const char *& ptr) const override
+        { ptr = nullptr; return 0; }
+    size_t file_region(size_t from, int & fd, off_t & offset) const override {
+        fd = 42;
+        offset = 100 + from;
+        return size() - from;
+    }
+};
+
+/// Composite content made of `<234>!89` with `0123456789` source
+class CompositeContentTest : public ::testing::Test {
+protected:
+    std::pmr::monotonic_buffer_resource arena;
+    std::shared_ptr<Msg::iContent> src;
+    CompositeContent c;
+
+    CompositeContentTest()
+            : src(std::make_shared<StringContent>("0123456789"))
+            , c(&arena) {
+        c.add_text("<");
+        c.add_slice(src, 2, 3);
+        c.add_text(">");
+        c.add_text("!");
+        c.add_slice(src, 8, 2);
+    }
+
+    /// Copies content from given byte by portions of `step` bytes
+    std::string copy(const Msg::iContent & content, size_t from=0, size_t step=3) {
+        std::string out;
+        char bf[16];
+        while(from < content.size()) {
+            const size_t n = content.copy_to(bf, std::min(step, sizeof(bf)), from);
+            EXPECT_GT(n, 0u);
+            out.append(bf, n);
+            from += n;
+        }
+        return out;
+    }
+};
+
+}  // anonymous namespace
+
+TEST_F(CompositeContentTest, CopiesPiecesInOrder) {
+    EXPECT_EQ(8u, c.size());
+    EXPECT_FALSE(c.streamed());
+    EXPECT_EQ("<234>!89", copy(c));
+    EXPECT_EQ("<234>!89", copy(c, 0, 1));
+    EXPECT_EQ("34>!89", copy(c, 2));
+    EXPECT_EQ("9", copy(c, 7));
+}
+
+TEST_F(CompositeContentTest, CopyBeyondEndThrows) {
+    char bf[4];
+    EXPECT_THROW(c.copy_to(bf, sizeof(bf), 8), GenericRuntimeError);
+}
+
+TEST_F(CompositeContentTest, SegmentsAreClippedToPieces) {
+    const char * ptr;
+    ASSERT_EQ(1u, c.segment(0, ptr));
+    EXPECT_EQ("<", std::string(ptr, 1));
+    // slice refers to source data with no copy
+    ASSERT_EQ(2u, c.segment(2, ptr));
+    EXPECT_EQ("34", std::string(ptr, 2));
+    // adjacent fragments are merged
+    ASSERT_EQ(2u, c.segment(4, ptr));
+    EXPECT_EQ(">!", std::string(ptr, 2));
+    ASSERT_EQ(2u, c.segment(6, ptr));
+    EXPECT_EQ("89", std::string(ptr, 2));
+    EXPECT_EQ(0u, c.segment(8, ptr));
+    EXPECT_EQ(nullptr, ptr);
+}
+
+TEST_F(CompositeContentTest, EmptyPiecesAreSkipped) {
+    c.add_text("");
+    c.add_slice(src, 10, 0);
+    EXPECT_EQ(8u, c.size());
+    EXPECT_EQ("<234>!89", copy(c));
+}
+
+TEST_F(CompositeContentTest, AppendThrows) {
+    EXPECT_THROW(c.append("x", 1), GenericRuntimeError);
+}
+
+TEST_F(CompositeContentTest, FileRegionsOfSlicesAreKept) {
+    auto file = std::make_shared<FileLikeContent>("abcdefghij");
+    CompositeContent fc(&arena);
+    fc.add_text("--");
+    fc.add_slice(file, 3, 4);
+    fc.add_text("--");
+    int fd;
+    off_t offset;
+    EXPECT_EQ(0u, fc.file_region(0, fd, offset));
+    EXPECT_EQ(-1, fd);
+    ASSERT_EQ(4u, fc.file_region(2, fd, offset));
+    EXPECT_EQ(42, fd);
+    EXPECT_EQ(103, offset);
+    // region is clipped to the slice
+    ASSERT_EQ(2u, fc.file_region(4, fd, offset));
+    EXPECT_EQ(105, offset);
+    EXPECT_EQ(0u, fc.file_region(6, fd, offset));
+    EXPECT_EQ(-1, fd);
+    EXPECT_EQ("--defg--", copy(fc));
+}
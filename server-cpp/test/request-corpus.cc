@@ -0,0 +1,173 @@
+#include "sync-http-srv/server.hh"
+#include "silent-journal.hh"
+
+#include <gtest/gtest.h>
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace sync_http_srv::util::http;
+namespace errors = sync_http_srv::errors;
+
+namespace {
+
+/// Well-formed request and what parser must get from it
+struct ValidRequest {
+    const char * name;
+    std::string raw;
+    Msg::Method method;
+    std::string target;
+    Msg::Version version;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string content;
+};
+
+/// Malformed request and status code it must be answered with
+struct InvalidRequest {
+    const char * name;
+    std::string raw;
+    int statusCode;
+};
+
+const ValidRequest gValid[] = {
+    { "Minimal", "GET / HTTP/1.1\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {}, "" },
+    { "Http10", "GET /index.html HTTP/1.0\r\nHost: example.org\r\n\r\n"
+    , Msg::GET, "/index.html", Msg::HTTP_1_0, {{"host", "example.org"}}, "" },
+    { "BareLineFeeds", "GET /a HTTP/1.1\nHost: h\nAccept: */*\n\n"
+    , Msg::GET, "/a", Msg::HTTP_1_1, {{"host", "h"}, {"accept", "*/*"}}, "" },
+    { "LeadingBlankLines", "\r\n\r\nGET / HTTP/1.1\r\nHost: h\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"host", "h"}}, "" },
+    { "LowercaseMethod", "get / HTTP/1.1\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {}, "" },
+    { "QueryTarget", "GET /api/scene?x=1&y=a:b HTTP/1.1\r\nHost: h\r\n\r\n"
+    , Msg::GET, "/api/scene?x=1&y=a:b", Msg::HTTP_1_1, {{"host", "h"}}, "" },
+    { "FieldNameCaseInsensitive", "GET / HTTP/1.1\r\nX-CuStOm-FiElD: Value\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"x-custom-field", "Value"}}, "" },
+    { "OptionalWhitespace", "GET / HTTP/1.1\r\nHost:h\r\nAccept: \t*/* \t\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"host", "h"}, {"accept", "*/*"}}, "" },
+    { "EmptyValue", "GET / HTTP/1.1\r\nX-Empty:\r\nX-Blank:   \r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"x-empty", ""}, {"x-blank", ""}}, "" },
+    { "ColonsInValue", "GET / HTTP/1.1\r\nHost: h:8080\r\nX-Time: 12:34:56\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"host", "h:8080"}, {"x-time", "12:34:56"}}, "" },
+    { "TokenCharsInName", "GET / HTTP/1.1\r\nX!#$%&'*+-.^_`|~1: v\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"x!#$%&'*+-.^_`|~1", "v"}}, "" },
+    { "TabInValue", "GET / HTTP/1.1\r\nX-Tab: a\tb\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"x-tab", "a\tb"}}, "" },
+    { "ObsTextInValue", "GET / HTTP/1.1\r\nX-Utf8: \xd0\xbf\xd1\x80\xd0\xb8\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"x-utf8", "\xd0\xbf\xd1\x80\xd0\xb8"}}, "" },
+    { "LongValue", "GET / HTTP/1.1\r\nCookie: " + std::string(300, 'c') + "=1\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"cookie", std::string(300, 'c') + "=1"}}, "" },
+    { "RepeatedFieldLastWins", "GET / HTTP/1.1\r\nX-A: 1\r\nX-A: 2\r\n\r\n"
+    , Msg::GET, "/", Msg::HTTP_1_1, {{"x-a", "2"}}, "" },
+    { "ContentLength", "POST /items HTTP/1.1\r\nContent-Length: 11\r\n\r\nhello world"
+    , Msg::POST, "/items", Msg::HTTP_1_1, {{"content-length", "11"}}, "hello world" },
+    { "ChunkedContent", "PUT /items/1 HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+                        "4\r\nab:c\r\n0\r\n\r\n"
+    , Msg::PUT, "/items/1", Msg::HTTP_1_1, {{"transfer-encoding", "chunked"}}, "ab:c" },
+    { "RepeatedSameContentLength", "POST / HTTP/1.1\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\nok"
+    , Msg::POST, "/", Msg::HTTP_1_1, {{"content-length", "2"}}, "ok" },
+    { "RepeatedTransferEncoding", "POST / HTTP/1.1\r\nTransfer-Encoding: identity\r\n"
+                                  "Transfer-Encoding: chunked\r\n\r\n2\r\nok\r\n0\r\n\r\n"
+    , Msg::POST, "/", Msg::HTTP_1_1, {{"transfer-encoding", "identity, chunked"}}, "ok" },
+    { "ContentWithHeaderLikeData", "POST / HTTP/1.1\r\nContent-Length: 8\r\n\r\nA: b\r\n\r\n"
+    , Msg::POST, "/", Msg::HTTP_1_1, {}, "A: b\r\n\r\n" },
+    { "OptionsAsterisk", "OPTIONS * HTTP/1.1\r\n\r\n"
+    , Msg::OPTIONS, "*", Msg::HTTP_1_1, {}, "" },
+};
+
+const InvalidRequest gInvalid[] = {
+    { "SpaceBeforeColon", "GET / HTTP/1.1\r\nHost : h\r\n\r\n", 400 },
+    { "NoColon", "GET / HTTP/1.1\r\nHost h\r\n\r\n", 400 },
+    { "EmptyFieldName", "GET / HTTP/1.1\r\n: h\r\n\r\n", 400 },
+    { "NonTokenFieldName", "GET / HTTP/1.1\r\nX(a): h\r\n\r\n", 400 },
+    { "ColonInTrailingWhitespaceOnly", "GET / HTTP/1.1\r\nHost\t\r\n\r\n", 400 },
+    { "ControlCharInValue", "GET / HTTP/1.1\r\nX-A: a\x01z\r\n\r\n", 400 },
+    { "DelInValue", "GET / HTTP/1.1\r\nX-A: a\x7fz\r\n\r\n", 400 },
+    { "NulInValue", std::string("GET / HTTP/1.1\r\nX-A: a\0z\r\n\r\n", 29), 400 },
+    { "ObsoleteLineFolding", "GET / HTTP/1.1\r\nX-A: a\r\n b\r\n\r\n", 400 },
+    { "NoTarget", "GET HTTP/1.1\r\n\r\n", 400 },
+    { "NoVersion", "GET /\r\n\r\n", 400 },
+    { "ControlCharInTarget", "GET /a\x01 HTTP/1.1\r\n\r\n", 400 },
+    { "BadVersion", "GET / HTTX/1.1\r\n\r\n", 400 },
+    { "UnsupportedVersion", "GET / HTTP/3.0\r\n\r\n", 505 },
+    { "UnknownMethod", "BREW / HTTP/1.1\r\n\r\n", 405 },
+    { "NonTokenMethod", "G(T / HTTP/1.1\r\n\r\n", 400 },
+    { "BadContentLength", "POST / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n", 400 },
+    { "NegativeContentLength", "POST / HTTP/1.1\r\nContent-Length: -1\r\n\r\n", 400 },
+    { "ConflictingContentLengths", "POST / HTTP/1.1\r\nContent-Length: 2\r\n"
+                                   "Content-Length: 20\r\n\r\nok", 400 },
+    { "ContentLengthWithChunked", "POST / HTTP/1.1\r\nContent-Length: 3\r\n"
+                                  "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n", 400 },
+    { "UnsupportedTransferCoding", "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", 501 },
+};
+
+/// Feeds request by portions of `step` bytes, keeping unconsumed tail as
+/// socket reader would
+void
+parse(RequestMsg & rq, const std::string & raw, size_t step) {
+    sync_http_srv::test::SilentJournal L;
+    MsgParser parser(rq, 1024*1024);
+    std::string pending;
+    for(size_t i = 0; i < raw.size() && !parser.done(); i += step) {
+        pending.append(raw, i, step);
+        pending.erase(0, parser.feed(pending.data(), pending.size(), L));
+    }
+    ASSERT_TRUE(parser.done());
+    EXPECT_TRUE(pending.empty());
+}
+
+/// Portions requests are fed by: whole, split at every byte and at odd
+/// lengths crossing the vector scanning boundaries
+const size_t gSteps[] = { std::string::npos, 1, 7, 17 };
+
+void PrintTo(const ValidRequest & f, std::ostream * os) { *os << f.name; }
+void PrintTo(const InvalidRequest & f, std::ostream * os) { *os << f.name; }
+
+class ValidRequestTest : public ::testing::TestWithParam<ValidRequest> {};
+class InvalidRequestTest : public ::testing::TestWithParam<InvalidRequest> {};
+
+}  // anonymous namespace
+
+TEST_P(ValidRequestTest, IsParsed) {
+    const ValidRequest & f = GetParam();
+    for(size_t step : gSteps) {
+        SCOPED_TRACE(step);
+        RequestMsg rq;
+        parse(rq, f.raw, step);
+        EXPECT_EQ(f.method, rq.method());
+        EXPECT_EQ(f.target, rq.str_uri());
+        EXPECT_EQ(f.version, rq.version());
+        for(const auto & h : f.headers) {
+            EXPECT_EQ(h.second, rq.get_header_view(h.first, "<none>")) << h.first;
+        }
+        std::string content;
+        if(rq.has_content()) {
+            content.resize(rq.content()->size());
+            rq.content()->copy_to(content.data(), content.size());
+        }
+        EXPECT_EQ(f.content, content);
+    }
+}
+
+TEST_P(InvalidRequestTest, IsRejected) {
+    const InvalidRequest & f = GetParam();
+    for(size_t step : gSteps) {
+        SCOPED_TRACE(step);
+        RequestMsg rq;
+        int statusCode = 0;
+        try {
+            parse(rq, f.raw, step);
+        } catch(errors::GenericHTTPError & e) {
+            statusCode = e.statusCode;
+        }
+        EXPECT_EQ(f.statusCode, statusCode);
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(Corpus, ValidRequestTest, ::testing::ValuesIn(gValid)
+        , [](const auto & info) { return std::string(info.param.name); });
+INSTANTIATE_TEST_SUITE_P(Corpus, InvalidRequestTest, ::testing::ValuesIn(gInvalid)
+        , [](const auto & info) { return std::string(info.param.name); });
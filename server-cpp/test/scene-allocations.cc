@@ -0,0 +1,186 @@
+// Counts heap allocations made by server per keep-alive `GET /scene`
+// request, once connection and caches are warmed up. Scene endpoint does
+// what the one of `trivial-srv` does: allocates response in request arena
+// and renders JSON while response is being sent. Exits with non-zero code
+// if steady-state requests allocate.
+//
+// Usage: sync-http-srv-scene-allocations [--epoll|--io-uring|--threads|--blocking] [port]
+
+#include "sync-http-srv/server.hh"
+#include "silent-journal.hh"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace web = sync_http_srv::util::http;
+
+//                                                   __________________________
+// ________________________________________________/ Global allocation counter
+
+static std::atomic<size_t> gNAllocations(0);
+
+void * operator new(size_t n) {
+    ++gNAllocations;
+    if(void * p = malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void * operator new[](size_t n) { return operator new(n); }
+void * operator new(size_t n, const std::nothrow_t &) noexcept {
+    ++gNAllocations;
+    return malloc(n ? n : 1);
+}
+void * operator new[](size_t n, const std::nothrow_t & t) noexcept {
+    return operator new(n, t);
+}
+void operator delete(void * p) noexcept { free(p); }
+void operator delete[](void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
+void operator delete[](void * p, size_t) noexcept { free(p); }
+
+//                                                                 ____________
+// ______________________________________________________________/ Server side
+
+namespace {
+
+const char gScene[] =
+    "{\"iterable\":true,\"geometryData\":{\"materials\":[{\"_name\":"
+    "\"dftMeshMaterial\",\"_type\":\"MeshBasicMaterial\",\"transparent\":true,"
+    "\"color\":16777130}],\"geometry\":[{\"_name\":\"box1\",\"_type\":"
+    "\"BoxGeometry\",\"_material\":\"dftMeshMaterial\",\"sizes\":[7.5,17.5,1],"
+    "\"position\":[0,0,-10],\"rotation\":[0,12,6.5]}]}}";
+
+/// Renders the scene as `trivial-srv` does
+class SceneEndpoint : public web::Server::iEndpoint {
+public:
+    web::Server::HandleResult handle( const web::RequestMsg & rq, int
+                                    , const web::Server::iRoute::URLParameters & ) override {
+        auto rp = rq.response(web::Msg::Ok);
+        rp->set_header("Content-Type", "application/json");
+        rp->content(rq.allocate<web::GeneratorContent>(
+                [](std::ostream & os) {
+                    os.write(gScene, sizeof(gScene) - 1);
+                    return false;
+                }, rq.memory_resource()));
+        return {0x0, rp};
+    }
+};
+
+/// Stops the server
+class StopEndpoint : public web::Server::iEndpoint {
+public:
+    web::Server::HandleResult handle( const web::RequestMsg & rq, int
+                                    , const web::Server::iRoute::URLParameters & ) override {
+        return {web::Server::kStop, rq.response(web::Msg::NoContent)};
+    }
+};
+
+//                                                                 ____________
+// ______________________________________________________________/ Client side
+
+/// Connects to server, retrying till it listens
+int
+connect_to(uint16_t port) {
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    for(int nAttempt = 0; nAttempt < 100; ++nAttempt) {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(0 == connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr))) {
+            // requests are sent one by one, as browser polling does
+            const int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+        close(fd);
+        usleep(20000);
+    }
+    return -1;
+}
+
+/// Sends request and reads response till the end of chunked content, or
+/// head only if there is no content; no heap is used
+bool
+round_trip(int fd, const char * rq, bool chunked) {
+    const size_t len = strlen(rq);
+    if(send(fd, rq, len, MSG_NOSIGNAL) != (ssize_t) len) return false;
+    char bf[4096];
+    size_t n = 0;
+    const char * const end = chunked ? "\r\n0\r\n\r\n" : "\r\n\r\n";
+    const size_t endLen = strlen(end);
+    while(n < endLen || memcmp(bf + n - endLen, end, endLen)) {
+        const ssize_t r = recv(fd, bf + n, sizeof(bf) - n, 0);
+        if(r <= 0) return false;
+        n += r;
+        if(n == sizeof(bf)) return false;
+    }
+    return 0 == memcmp(bf, "HTTP/1.1 200", 12) || !chunked;
+}
+
+}  // anonymous namespace
+
+int
+main(int argc, char * argv[]) {
+    const char * mode = argc > 1 ? argv[1] : "--epoll";
+    const uint16_t port = argc > 2 ? atoi(argv[2]) : 5530;
+    // warm-up outlasts keep-alive timeout, so timers are recycled
+    const std::chrono::milliseconds warmUp(1500);
+    const size_t nMeasured = 10000;
+
+    sync_http_srv::test::SilentJournal L;
+    SceneEndpoint scene;
+    StopEndpoint stop;
+    web::StringRoute sceneRoute("scene", "/scene")
+                   , stopRoute("stop", "/stop");
+    web::Server::Routes routes;
+    routes.push_back({&sceneRoute, &scene});
+    routes.push_back({&stopRoute, &stop});
+    web::Server srv("localhost", port, L, 128, 60, 5*1024, 1024*1024);
+    // all the requests are sent over single connection
+    srv.keep_alive(1, SIZE_MAX);
+    std::thread serving([&]() {
+        if(!strcmp(mode, "--threads")) srv.run_threaded(routes, 2);
+        else if(!strcmp(mode, "--blocking")) srv.run(routes);
+        else if(!strcmp(mode, "--io-uring")) srv.run_io_uring(routes);
+        else srv.run_epoll(routes);
+    });
+
+    const int fd = connect_to(port);
+    if(fd < 0) {
+        fprintf(stderr, "Failed to connect to port %d.\n", (int) port);
+        return EXIT_FAILURE;
+    }
+    const char rq[] = "GET /scene HTTP/1.1\r\nHost: localhost\r\n"
+                      "Accept: application/json\r\n\r\n";
+    bool ok = true;
+    const auto warmUpEnd = std::chrono::steady_clock::now() + warmUp;
+    while(ok && std::chrono::steady_clock::now() < warmUpEnd)
+        ok = round_trip(fd, rq, true);
+    size_t nAllocations = gNAllocations;
+    for(size_t i = 0; ok && i < nMeasured; ++i)
+        ok = round_trip(fd, rq, true);
+    nAllocations = gNAllocations - nAllocations;
+    // server may stop before responding
+    round_trip(fd, "GET /stop HTTP/1.1\r\nHost: localhost\r\n\r\n", false);
+    close(fd);
+    serving.join();
+    if(!ok) {
+        fprintf(stderr, "Request failed.\n");
+        return EXIT_FAILURE;
+    }
+    printf( "%s: %zu heap allocation(s) per %zu requests (%.3f per request)\n"
+          , mode, nAllocations, nMeasured, double(nAllocations)/nMeasured );
+    return nAllocations ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "sync-http-srv/logging.hh"
+
+namespace sync_http_srv {
+namespace test {
+
+/// Journal discarding all the messages
+class SilentJournal : public iJournal {
+public:
+    bool debug_enabled() const override { return false; }
+    void debug(const char *) override {}
+    void info(const char *) override {}
+    void warn(const char *) override {}
+    void error(const char *) override {}
+};
+
+}  // namespace ::sync_http_srv::test
+}  // namespace sync_http_srv
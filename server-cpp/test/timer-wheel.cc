@@ -0,0 +1,114 @@
+#include "sync-http-srv/timer-wheel.hh"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using sync_http_srv::util::TimerWheel;
+using std::chrono::milliseconds;
+
+namespace {
+
+/// Wheel of 8 slots by 10 ms starting at fixed origin
+class TimerWheelTest : public ::testing::Test {
+protected:
+    const TimerWheel::Clock::time_point t0;
+    TimerWheel wheel;
+
+    TimerWheelTest() : t0(TimerWheel::Clock::now())
+                     , wheel(milliseconds(10), 8, t0) {}
+
+    /// Returns keys expired by `t0 + ms`
+    std::vector<int> expire(int ms) {
+        std::vector<int> keys;
+        wheel.expire(t0 + milliseconds(ms), [&](int k) { keys.push_back(k); });
+        return keys;
+    }
+};
+
+}  // anonymous namespace
+
+TEST_F(TimerWheelTest, IsEmptyInitially) {
+    EXPECT_TRUE(wheel.empty());
+    EXPECT_EQ(-1, wheel.timeout_ms(t0));
+    EXPECT_TRUE(expire(1000).empty());
+}
+
+TEST_F(TimerWheelTest, NeverFiresBeforeDeadline) {
+    wheel.schedule(3, t0 + milliseconds(25));
+    EXPECT_EQ(1u, wheel.size());
+    EXPECT_TRUE(expire(20).empty());
+    EXPECT_TRUE(expire(29).empty());
+    EXPECT_EQ(std::vector<int>({3}), expire(30));
+    EXPECT_TRUE(wheel.empty());
+    EXPECT_TRUE(expire(100).empty());
+}
+
+TEST_F(TimerWheelTest, PastDeadlineExpiresOnNextTick) {
+    EXPECT_TRUE(expire(50).empty());
+    wheel.schedule(1, t0);
+    EXPECT_TRUE(expire(55).empty());
+    EXPECT_EQ(std::vector<int>({1}), expire(60));
+}
+
+TEST_F(TimerWheelTest, CancelledTimerDoesNotFire) {
+    wheel.schedule(1, t0 + milliseconds(10));
+    wheel.schedule(2, t0 + milliseconds(10));
+    wheel.cancel(1);
+    wheel.cancel(5);  // not set, ignored
+    EXPECT_EQ(1u, wheel.size());
+    EXPECT_EQ(std::vector<int>({2}), expire(10));
+}
+
+TEST_F(TimerWheelTest, RescheduledTimerFiresOnceAtLatestDeadline) {
+    wheel.schedule(1, t0 + milliseconds(10));
+    wheel.schedule(1, t0 + milliseconds(40));
+    wheel.schedule(1, t0 + milliseconds(40));
+    EXPECT_EQ(1u, wheel.size());
+    EXPECT_TRUE(expire(30).empty());
+    EXPECT_EQ(std::vector<int>({1}), expire(40));
+    EXPECT_TRUE(expire(200).empty());
+    // cancelled timer is rescheduled with its retained entry
+    wheel.schedule(1, t0 + milliseconds(210));
+    wheel.schedule(1, TimerWheel::Clock::time_point::max());
+    EXPECT_TRUE(wheel.empty());
+    EXPECT_TRUE(expire(300).empty());
+}
+
+TEST_F(TimerWheelTest, DeadlineBeyondRoundWaitsForItsRound) {
+    // 8 slots of 10 ms, so tick 12 shares slot with tick 4
+    wheel.schedule(7, t0 + milliseconds(120));
+    EXPECT_TRUE(expire(40).empty());
+    EXPECT_TRUE(expire(110).empty());
+    EXPECT_EQ(std::vector<int>({7}), expire(120));
+}
+
+TEST_F(TimerWheelTest, LongPauseExpiresAllDue) {
+    for(int k = 0; k < 20; ++k) wheel.schedule(k, t0 + milliseconds(10*k + 5));
+    auto keys = expire(1000);
+    EXPECT_EQ(20u, keys.size());
+    EXPECT_TRUE(wheel.empty());
+}
+
+TEST_F(TimerWheelTest, CallbackMayRescheduleAndCancel) {
+    wheel.schedule(1, t0 + milliseconds(15));
+    wheel.schedule(2, t0 + milliseconds(15));
+    wheel.schedule(3, t0 + milliseconds(15));
+    std::vector<int> keys;
+    wheel.expire(t0 + milliseconds(20), [&](int k) {
+        keys.push_back(k);
+        if(1 != k) return;
+        wheel.schedule(1, t0 + milliseconds(50));  // fired one is rescheduled
+        wheel.cancel(2);  // pending one of the same slot is cancelled
+    });
+    EXPECT_EQ(std::vector<int>({1, 3}), keys);
+    EXPECT_EQ(1u, wheel.size());
+    EXPECT_EQ(std::vector<int>({1}), expire(50));
+}
+
+TEST_F(TimerWheelTest, TimeoutPointsToNextTick) {
+    wheel.schedule(1, t0 + milliseconds(100));
+    EXPECT_EQ(10, wheel.timeout_ms(t0));
+    EXPECT_EQ(7, wheel.timeout_ms(t0 + milliseconds(3)));
+    EXPECT_EQ(1, wheel.timeout_ms(t0 + std::chrono::microseconds(9999)));
+}
@@ -0,0 +1,357 @@
+#include "sync-http-srv/websocket.hh"
+#include "silent-journal.hh"
+#include "strutil.hh"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace sync_http_srv::util::http;
+
+//                                                          ___________________
+// _______________________________________________________/ Opening handshake
+
+TEST(WebSocketAcceptKeyTest, MatchesRFCExample) {
+    // RFC 6455, 1.3
+    EXPECT_EQ("s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+             , WebSocketEndpoint::accept_key("dGhlIHNhbXBsZSBub25jZQ=="));
+}
+
+//                                                                 ____________
+// ______________________________________________________________/ UTF-8 check
+
+TEST(ValidUTF8Test, AcceptsWellFormedText) {
+    EXPECT_TRUE(_valid_utf8(""));
+    EXPECT_TRUE(_valid_utf8("plain ASCII"));
+    EXPECT_TRUE(_valid_utf8("caf\xc3\xa9"));  // U+00E9
+    EXPECT_TRUE(_valid_utf8("\xe2\x82\xac"));  // U+20AC
+    EXPECT_TRUE(_valid_utf8("\xf0\x9d\x84\x9e"));  // U+1D11E
+    EXPECT_TRUE(_valid_utf8("\xf4\x8f\xbf\xbf"));  // U+10FFFF
+    EXPECT_TRUE(_valid_utf8(std::string_view("a\0b", 3)));
+}
+
+TEST(ValidUTF8Test, RejectsMalformedText) {
+    EXPECT_FALSE(_valid_utf8("\x80"));  // stray continuation byte
+    EXPECT_FALSE(_valid_utf8("\xc3\x28"));  // bad continuation byte
+    EXPECT_FALSE(_valid_utf8("\xe2\x82"));  // truncated sequence
+    EXPECT_FALSE(_valid_utf8("\xf8\x88\x80\x80\x80"));  // five-byte form
+    EXPECT_FALSE(_valid_utf8("\xff"));
+}
+
+TEST(ValidUTF8Test, RejectsOverlongFormsAndSurrogates) {
+    EXPECT_FALSE(_valid_utf8("\xc0\xaf"));
+    EXPECT_FALSE(_valid_utf8("\xe0\x80\xaf"));
+    EXPECT_FALSE(_valid_utf8("\xf0\x80\x80\xaf"));
+    EXPECT_FALSE(_valid_utf8("\xed\xa0\x80"));  // U+D800
+    EXPECT_FALSE(_valid_utf8("\xed\xbf\xbf"));  // U+DFFF
+    EXPECT_FALSE(_valid_utf8("\xf4\x90\x80\x80"));  // above U+10FFFF
+}
+
+//                                                             ________________
+// __________________________________________________________/ Frame handling
+
+namespace {
+
+/// Exposes frame parser and queue of the endpoint on a session of its own
+class FrameParser : public WebSocketEndpoint {
+public:
+    using WebSocketEndpoint::Event;
+    using WebSocketEndpoint::_queue;
+    using WebSocketEndpoint::_receive;
+    using WebSocketEndpoint::_visit;
+    using WebSocketEndpoint::_sessions;
+    using WebSocketEndpoint::_mtx;
+
+    sync_http_srv::test::SilentJournal journal;
+    Session s;
+    std::vector<Event> events;
+
+    FrameParser(size_t maxMessage=1024) : WebSocketEndpoint(journal, 1, maxMessage) {
+        s.id = 1;
+        s.fd = -1;
+        s.nParsed = 0;
+        s.messageOpcode = kContinuation;
+        s.nSent = s.nQueued = s.nUrgent = 0;
+        s.lastReceived = Clock::now();
+        s.pingSent = s.closeSent = false;
+        s.dropReason = nullptr;
+        s.closeDeadline = Clock::time_point::max();
+        s.closeCode = kNoStatus;
+        s.opened = true;
+    }
+    void on_message(SessionID, Opcode, std::string_view) override {}
+
+    /// Appends received data and parses it
+    void feed(std::string_view data) {
+        s.in.append(data);
+        _parse(s, events);
+    }
+    /// Returns status of close frame queued last
+    uint16_t close_status() const {
+        for(auto it = s.out.rbegin(); it != s.out.rend(); ++it) {
+            if(it->size() == 4 && char(0x88) == (*it)[0]) {
+                return (uint16_t(uint8_t((*it)[2])) << 8) | uint8_t((*it)[3]);
+            }
+        }
+        return 0;
+    }
+};
+
+/// Returns masked (client) frame
+std::string
+client_frame(bool fin, uint8_t opcode, std::string_view payload) {
+    const uint8_t key[4] = {0x37, 0xfa, 0x21, 0x3d};
+    std::string f;
+    f.push_back(char((fin ? 0x80 : 0x0) | opcode));
+    if(payload.size() < 126) {
+        f.push_back(char(0x80 | payload.size()));
+    } else {
+        f.push_back(char(0x80 | 126));
+        f.push_back(char(payload.size() >> 8));
+        f.push_back(char(payload.size() & 0xff));
+    }
+    f.append(reinterpret_cast<const char *>(key), 4);
+    for(size_t i = 0; i < payload.size(); ++i) f.push_back(char(payload[i] ^ key[i & 0x3]));
+    return f;
+}
+
+/// Returns unmasked (server) frame of short payload
+std::string
+server_frame(uint8_t opcode, std::string_view payload) {
+    std::string f;
+    f.push_back(char(0x80 | opcode));
+    f.push_back(char(payload.size()));
+    f.append(payload);
+    return f;
+}
+
+}  // anonymous namespace
+
+TEST(WebSocketParseTest, ParsesMessage) {
+    FrameParser p;
+    p.feed(client_frame(true, WebSocketEndpoint::kText, "Hello"));
+    ASSERT_EQ(1u, p.events.size());
+    EXPECT_EQ(FrameParser::Event::kMessage, p.events[0].type);
+    EXPECT_EQ(WebSocketEndpoint::kText, p.events[0].opcode);
+    EXPECT_EQ("Hello", p.events[0].payload);
+    EXPECT_EQ(1u, p.n_received());
+    EXPECT_FALSE(p.s.dropReason);
+    EXPECT_TRUE(p.s.in.empty());
+}
+
+TEST(WebSocketParseTest, WaitsForCompleteFrame) {
+    FrameParser p;
+    const std::string payload(300, 'x');
+    const std::string f = client_frame(true, WebSocketEndpoint::kBinary, payload)
+                        + client_frame(true, WebSocketEndpoint::kBinary, "y");
+    for(char c : f) p.feed(std::string_view(&c, 1));
+    ASSERT_EQ(2u, p.events.size());
+    EXPECT_EQ(payload, p.events[0].payload);
+    EXPECT_EQ(WebSocketEndpoint::kBinary, p.events[0].opcode);
+    EXPECT_EQ("y", p.events[1].payload);
+}
+
+TEST(WebSocketParseTest, ReassemblesFragmentedMessage) {
+    FrameParser p;
+    p.feed(client_frame(false, WebSocketEndpoint::kText, "Hel"));
+    EXPECT_TRUE(p.events.empty());
+    // control frames may be interleaved with fragments
+    p.feed(client_frame(true, WebSocketEndpoint::kPing, "abc"));
+    p.feed(client_frame(false, WebSocketEndpoint::kContinuation, "l"));
+    EXPECT_TRUE(p.events.empty());
+    p.feed(client_frame(true, WebSocketEndpoint::kContinuation, "o"));
+    ASSERT_EQ(1u, p.events.size());
+    EXPECT_EQ(WebSocketEndpoint::kText, p.events[0].opcode);
+    EXPECT_EQ("Hello", p.events[0].payload);
+    ASSERT_EQ(1u, p.s.out.size());
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kPong, "abc"), p.s.out.front());
+    EXPECT_FALSE(p.s.dropReason);
+}
+
+TEST(WebSocketParseTest, FailsOnContinuationOfNoMessage) {
+    FrameParser p;
+    p.feed(client_frame(true, WebSocketEndpoint::kContinuation, "x"));
+    EXPECT_TRUE(p.events.empty());
+    EXPECT_TRUE(p.s.dropReason);
+    EXPECT_TRUE(p.s.closeSent);
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p.close_status());
+}
+
+TEST(WebSocketParseTest, FailsOnNewMessageAmidFragmentedOne) {
+    FrameParser p;
+    p.feed(client_frame(false, WebSocketEndpoint::kText, "a")
+         + client_frame(true, WebSocketEndpoint::kText, "b"));
+    EXPECT_TRUE(p.events.empty());
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p.close_status());
+}
+
+TEST(WebSocketParseTest, FailsOnUnknownOpcode) {
+    for(uint8_t opcode : {0x3, 0x7, 0xb, 0xf}) {
+        FrameParser p;
+        p.feed(client_frame(true, opcode, "x"));
+        EXPECT_TRUE(p.events.empty());
+        EXPECT_EQ(WebSocketEndpoint::kProtocolError, p.close_status())
+            << "opcode " << int(opcode);
+    }
+}
+
+TEST(WebSocketParseTest, FailsOnReservedBitsAndUnmaskedFrame) {
+    FrameParser p1;
+    std::string f = client_frame(true, WebSocketEndpoint::kText, "x");
+    f[0] |= 0x40;
+    p1.feed(f);
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p1.close_status());
+    FrameParser p2;
+    p2.feed(server_frame(WebSocketEndpoint::kText, "x"));
+    EXPECT_TRUE(p2.events.empty());
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p2.close_status());
+}
+
+TEST(WebSocketParseTest, FailsOnTooLongControlFrame) {
+    FrameParser p1;
+    p1.feed(client_frame(true, WebSocketEndpoint::kPing, std::string(125, 'x')));
+    EXPECT_FALSE(p1.s.dropReason);
+    FrameParser p2;
+    p2.feed(client_frame(true, WebSocketEndpoint::kPing, std::string(126, 'x')));
+    EXPECT_TRUE(p2.s.dropReason);
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p2.close_status());
+    // nor can control frame be fragmented
+    FrameParser p3;
+    p3.feed(client_frame(false, WebSocketEndpoint::kPing, "x"));
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p3.close_status());
+}
+
+TEST(WebSocketParseTest, FailsOnInvalidText) {
+    FrameParser p;
+    p.feed(client_frame(false, WebSocketEndpoint::kText, "\xe2\x82")
+         + client_frame(true, WebSocketEndpoint::kContinuation, "\xac"));
+    ASSERT_EQ(1u, p.events.size());
+    EXPECT_EQ("\xe2\x82\xac", p.events[0].payload);
+    p.feed(client_frame(true, WebSocketEndpoint::kText, "\xed\xa0\x80"));
+    EXPECT_EQ(1u, p.events.size());
+    EXPECT_EQ(WebSocketEndpoint::kInvalidPayload, p.close_status());
+}
+
+TEST(WebSocketParseTest, FailsOnTooBigMessage) {
+    FrameParser p(8);
+    p.feed(client_frame(false, WebSocketEndpoint::kBinary, "12345"));
+    EXPECT_FALSE(p.s.dropReason);
+    p.feed(client_frame(true, WebSocketEndpoint::kContinuation, "6789"));
+    EXPECT_TRUE(p.events.empty());
+    EXPECT_EQ(WebSocketEndpoint::kMessageTooBig, p.close_status());
+}
+
+TEST(WebSocketParseTest, EchoesCloseFrame) {
+    FrameParser p;
+    p.feed(client_frame(true, WebSocketEndpoint::kClose, std::string("\x03\xe8" "bye", 5)));
+    EXPECT_EQ(WebSocketEndpoint::kNormalClosure, p.s.closeCode);
+    EXPECT_TRUE(p.s.closeSent);
+    EXPECT_TRUE(p.s.dropReason);
+    ASSERT_EQ(1u, p.s.out.size());
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kClose, "\x03\xe8"), p.s.out.front());
+    // data arriving after close frame is ignored
+    p.feed(client_frame(true, WebSocketEndpoint::kText, "late"));
+    EXPECT_TRUE(p.events.empty());
+}
+
+TEST(WebSocketParseTest, FailsOnInvalidCloseStatus) {
+    FrameParser p1;
+    p1.feed(client_frame(true, WebSocketEndpoint::kClose, "\x03"));
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p1.close_status());
+    FrameParser p2;
+    p2.feed(client_frame(true, WebSocketEndpoint::kClose, "\x03\xed"));  // 1005
+    EXPECT_EQ(WebSocketEndpoint::kProtocolError, p2.close_status());
+}
+
+TEST(WebSocketQueueTest, ControlFramesFollowHandshake) {
+    FrameParser p;
+    p.s.out.push_back("HTTP/1.1 101 Switching Protocols\r\n\r\n");
+    p.s.nQueued = p.s.out.front().size();
+    p.s.nUrgent = 1;
+    p._queue(p.s, WebSocketEndpoint::kBinary, "data");
+    p._queue(p.s, WebSocketEndpoint::kPing, "1");
+    p._queue(p.s, WebSocketEndpoint::kPong, "2");
+    ASSERT_EQ(4u, p.s.out.size());
+    EXPECT_EQ(0u, p.s.out[0].find("HTTP/1.1 101"));
+    // control frames keep their order, ahead of data frames
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kPing, "1"), p.s.out[1]);
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kPong, "2"), p.s.out[2]);
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kBinary, "data"), p.s.out[3]);
+}
+
+TEST(WebSocketQueueTest, CloseDiscardsDataFramesNotBeingSent) {
+    FrameParser p;
+    p.s.out.push_back("HTTP/1.1 101 Switching Protocols\r\n\r\n");
+    p.s.nQueued = p.s.out.front().size();
+    p.s.nUrgent = 1;
+    p._queue(p.s, WebSocketEndpoint::kBinary, "a");
+    p._queue(p.s, WebSocketEndpoint::kBinary, "b");
+    p._queue(p.s, WebSocketEndpoint::kClose, "\x03\xe8");
+    ASSERT_EQ(2u, p.s.out.size());
+    EXPECT_EQ(0u, p.s.out[0].find("HTTP/1.1 101"));
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kClose, "\x03\xe8"), p.s.out[1]);
+    EXPECT_EQ(p.s.out[0].size() + p.s.out[1].size(), p.s.nQueued);
+}
+
+TEST(WebSocketQueueTest, FrameBeingSentIsNotInterrupted) {
+    FrameParser p(1024);
+    p._queue(p.s, WebSocketEndpoint::kBinary, "first");
+    p._queue(p.s, WebSocketEndpoint::kBinary, "second");
+    // first frame is partially sent
+    p.s.nSent = 3;
+    p.s.nQueued -= 3;
+    p._queue(p.s, WebSocketEndpoint::kPing, "");
+    p._queue(p.s, WebSocketEndpoint::kClose, "\x03\xe8");
+    ASSERT_EQ(3u, p.s.out.size());
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kBinary, "first"), p.s.out[0]);
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kPing, ""), p.s.out[1]);
+    EXPECT_EQ(server_frame(WebSocketEndpoint::kClose, "\x03\xe8"), p.s.out[2]);
+    EXPECT_EQ(p.s.out[0].size() - 3 + p.s.out[1].size() + p.s.out[2].size()
+             , p.s.nQueued);
+}
+
+//                                                              _______________
+// ___________________________________________________________/ Closing session
+
+TEST(WebSocketCloseTest, DataOfDroppedSessionAreDiscarded) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    FrameParser p;
+    p.s.fd = fds[0];
+    p.feed(client_frame(true, WebSocketEndpoint::kText, "\xff"));
+    ASSERT_TRUE(p.s.dropReason);
+    const auto lastReceived = p.s.lastReceived;
+    const std::string data = client_frame(true, WebSocketEndpoint::kText, "more");
+    for(int i = 0; i < 100; ++i)
+        ASSERT_EQ(ssize_t(data.size()), write(fds[1], data.data(), data.size()));
+    EXPECT_TRUE(p._receive(p.s, p.events));
+    EXPECT_TRUE(p.s.in.empty());
+    EXPECT_EQ(lastReceived, p.s.lastReceived);
+    EXPECT_TRUE(p.events.empty());
+    close(fds[0]);
+    close(fds[1]);
+}
+
+TEST(WebSocketCloseTest, ClosingSessionIsDroppedAfterPingInterval) {
+    int fds[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    FrameParser p;
+    p.s.fd = fds[0];
+    p.s.closeSent = true;  // close frame is sent, no answer comes
+    std::unique_lock<std::mutex> lock(p._mtx);
+    p._sessions.push_back(p.s);
+    const auto now = std::chrono::steady_clock::now();
+    // client keeps sending data, yet it does not prolong closing session
+    p._sessions[0].lastReceived = now + std::chrono::seconds(45);
+    EXPECT_EQ(now + std::chrono::seconds(30), p._visit(lock, now));
+    ASSERT_EQ(1u, p._sessions.size());
+    p._visit(lock, now + std::chrono::seconds(29));
+    ASSERT_EQ(1u, p._sessions.size());
+    p._visit(lock, now + std::chrono::seconds(30));
+    EXPECT_TRUE(p._sessions.empty());  // socket is closed by endpoint
+    close(fds[1]);
+}